@@ -0,0 +1,121 @@
+#!/bin/sh
+# Copyright (c) 2024 Yahweasel
+#
+# Permission to use, copy, modify, and/or distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+# OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+# CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+# Times the cook tools over synthetic recordings (from oggsynth) of several
+# sizes. Throughput is reported against the size of the recording (header1,
+# header2 and data) and the number of pages in it, whatever each tool actually
+# reads, so that the numbers are comparable across tools. wavduration is
+# measured against the size of the WAV file instead.
+#
+# Environment:
+#   BENCH_MATRIX: space-separated <tracks>:<seconds> sizes
+#                 (default "2:600 4:3600 8:10800")
+#   BENCH_RUNS:   runs of each tool, the best of which is reported (default 3)
+#   BENCH_SYNTH:  extra options to oggsynth (default "-v -s 2 -r 44100")
+#   TMPDIR:       where to write the recordings
+
+set -e
+
+SCRIPTBASE="$(dirname "$0")"
+SCRIPTBASE="$(realpath "$SCRIPTBASE")"
+COOK="$(realpath "$SCRIPTBASE/..")"
+
+BENCH_MATRIX="${BENCH_MATRIX:-2:600 4:3600 8:10800}"
+BENCH_RUNS="${BENCH_RUNS:-3}"
+BENCH_SYNTH="${BENCH_SYNTH:--v -s 2 -r 44100}"
+
+tmpdir="$(mktemp -d "${TMPDIR:-/tmp}/ecbench.XXXXXX")"
+trap 'rm -rf "$tmpdir"' EXIT
+R="$tmpdir/rec.ogg"
+
+now() {
+    date +%s.%N
+}
+
+# bench <name> <bytes> <pages> <command>
+bench() {
+    name="$1"
+    bytes="$2"
+    pages="$3"
+    shift 3
+    best=
+    i=0
+    while [ $i -lt $BENCH_RUNS ]
+    do
+        start=$(now)
+        sh -c "$*" > /dev/null
+        end=$(now)
+        best=$(echo "$start $end $best" | awk '{
+            t = $2 - $1;
+            if ($3 != "" && $3 < t) t = $3;
+            print t;
+        }')
+        i=$((i+1))
+    done
+    echo "$size $name $bytes $pages $best" | awk '{
+        t = ($5 > 0) ? $5 : 0.000001;
+        mbs = $3 / 1048576 / t;
+        pps = ($4 == "-") ? "-" : sprintf("%.0f", $4 / t);
+        printf("%-10s %-26s %9.3f %10.1f %12s\n", $1, $2, $5, mbs, pps);
+    }'
+}
+
+printf "%-10s %-26s %9s %10s %12s\n" size tool seconds "MB/s" "pages/s"
+
+for size in $BENCH_MATRIX
+do
+    tracks="${size%%:*}"
+    seconds="${size#*:}"
+    "$SCRIPTBASE/oggsynth" -t "$tracks" -d "$seconds" $BENCH_SYNTH -w "$R"
+
+    bytes=$(cat "$R.header1" "$R.header2" "$R.data" | wc -c)
+    pages=$(( $(wc -c < "$R.idx") / 24 ))
+    wavBytes=$(wc -c < "$R.wav")
+    input="cat '$R.header1' '$R.header2' '$R.data'"
+
+    # Every track at once, as a cook does it
+    outs=
+    for s in $(seq 1 $tracks)
+    do
+        outs="$outs -o /dev/null $s"
+    done
+
+    bench oggtracks $bytes $pages "'$COOK/oggtracks' < '$R.header1'"
+    bench oggmeta $bytes $pages "$input | '$COOK/oggmeta'"
+    bench oggmeta-sidecar $bytes $pages "'$COOK/oggmeta' '$R'"
+    bench oggduration $bytes $pages "$input | '$COOK/oggduration'"
+    if [ -x "$COOK/oggduration2" ]
+    then
+        bench oggduration2 $bytes $pages \
+            "'$COOK/oggduration2' '$R.header1' '$R.header2' '$R.data'"
+    fi
+    bench oggduration3 $bytes $pages \
+        "'$COOK/oggduration3' '$R.header1' '$R.header2' '$R.data'"
+    bench oggduration3-index $bytes $pages "'$COOK/oggduration3' --index '$R'"
+    bench oggstender $bytes $pages "$input | '$COOK/oggstender' 1"
+    bench oggcorrect $bytes $pages \
+        "(cat '$R.header1' '$R.header2' '$R.data'; $input) | '$COOK/oggcorrect' 1"
+    bench oggcorrect-once $bytes $pages "$input | '$COOK/oggcorrect' --once 1"
+    bench oggcorrect-once-packed $bytes $pages \
+        "$input | '$COOK/oggcorrect' --pack 0 --once 1"
+    bench oggcorrect-subtracks $bytes $pages \
+        "$input | '$COOK/oggcorrect' --once -O '$tmpdir/sub' 1"
+    bench oggcorrect-all $bytes $pages "$input | '$COOK/oggcorrect' --once $outs"
+    bench oggcorrect-index-all $bytes $pages \
+        "'$COOK/oggcorrect' --index '$R' --once $outs"
+    bench wavduration $wavBytes - "'$COOK/wavduration' $seconds < '$R.wav'"
+
+    rm -f "$R".* "$tmpdir"/sub-*
+done
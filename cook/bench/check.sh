@@ -0,0 +1,140 @@
+#!/bin/sh
+# Copyright (c) 2024 Yahweasel
+#
+# Permission to use, copy, modify, and/or distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+# SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+# OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+# CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+# Checks that the different ways the cook tools can get to the same result
+# agree, over a synthetic recording (from oggsynth):
+#   follow: oggcorrect --follow, run as the recording grows, writes the same
+#           tracks as oggcorrect --once does afterwards.
+#   repack: After oggrepack, oggcorrect makes the same tracks of the recording
+#           as it did before.
+#   split:  A WAV split by wavsplit, encoded a segment at a time by flac, and
+#           stitched by encstitch, decodes to the same audio as the WAV encoded
+#           whole. This is skipped if flac isn't installed.
+#
+# Environment:
+#   CHECK_SYNTH: extra options to oggsynth (default "-t 3 -d 300 -s 2")
+#   TMPDIR:      where to write the recordings
+
+SCRIPTBASE="$(dirname "$0")"
+SCRIPTBASE="$(realpath "$SCRIPTBASE")"
+COOK="$(realpath "$SCRIPTBASE/..")"
+
+CHECK_SYNTH="${CHECK_SYNTH:--t 3 -d 300 -s 2}"
+
+tmpdir="$(mktemp -d "${TMPDIR:-/tmp}/eccheck.XXXXXX")"
+trap 'rm -rf "$tmpdir"' EXIT
+R="$tmpdir/rec.ogg"
+
+FAILED=0
+
+# check <name> <command>: run the command, stopping at the first failure, and
+# report whether it succeeded (not as an if condition, in which set -e wouldn't
+# apply)
+check() {
+    name="$1"
+    shift
+    ( set -e; "$@" ) > "$tmpdir/$name.log" 2>&1
+    if [ $? -eq 0 ]
+    then
+        printf 'ok   %s\n' "$name"
+    else
+        printf 'FAIL %s\n' "$name"
+        sed 's/^/    /' "$tmpdir/$name.log"
+        FAILED=1
+    fi
+}
+
+# Correct every track of the recording $1 with --once, to $2/<stream no>.ogg
+correctall() {
+    mkdir -p "$2"
+    for s in $("$COOK/oggtracks" -n < "$1.header1")
+    do
+        "$COOK/oggcorrect" --index "$1" --once -o "$2/$s.ogg" $s
+    done
+}
+
+# Compare every track in the directory $1 with the same one in $2
+sametracks() {
+    for f in "$1"/*.ogg
+    do
+        cmp "$f" "$2/${f##*/}"
+    done
+}
+
+"$COOK/bench/oggsynth" $CHECK_SYNTH "$R"
+correctall "$R" "$tmpdir/once"
+
+checkfollow() {
+    # Give the follower the recording a quarter at a time
+    mkdir "$tmpdir/live"
+    L="$tmpdir/live/rec.ogg"
+    cp "$R.header1" "$R.header2" "$R.meta" "$tmpdir/live/"
+    : > "$L.data"
+    size=$(stat -c %s "$R.data")
+    i=0
+    while [ $i -lt 4 ]
+    do
+        dd if="$R.data" bs=$(( size / 4 + 1 )) skip=$i count=1 status=none \
+            >> "$L.data"
+        sleep 2
+        i=$(( i + 1 ))
+    done |
+        "$COOK/oggcorrect" --checkpoint 1 --follow "$L" "$L.follow"
+    [ "$(cat "$L.follow/complete")" = "$size" ]
+    sametracks "$L.follow" "$tmpdir/once"
+}
+check follow checkfollow
+
+checkrepack() {
+    mkdir "$tmpdir/repack"
+    P="$tmpdir/repack/rec.ogg"
+    cp "$R".* "$tmpdir/repack/"
+    "$COOK/oggrepack" "$P"
+    [ ! -e "$P.data" ]
+    correctall "$P" "$tmpdir/repacked"
+    sametracks "$tmpdir/once" "$tmpdir/repacked"
+}
+check repack checkrepack
+
+# Run flac, with raw samples in place of WAV, so that only the audio is compared
+flacraw() {
+    flac -s --force-raw-format --endian=little --sign=signed "$@"
+}
+
+checksplit() {
+    W="$tmpdir/split"
+    mkdir "$W"
+    "$COOK/bench/oggsynth" -t 1 -d 300 -w "$W/rec.ogg"
+    "$COOK/wavduration" 300 < "$W/rec.ogg.wav" > "$W/whole.wav"
+    "$COOK/wavsplit" -a 4096 4 "$W/seg" < "$W/whole.wav" > "$W/segs"
+    [ $(wc -l < "$W/segs") -gt 1 ]
+    while read seg
+    do
+        flac -s - -c < "$seg" > "$seg.flac"
+    done < "$W/segs"
+    "$COOK/encstitch" "$W"/seg-*.wav.flac > "$W/stitched.flac"
+    flac -s - -c < "$W/whole.wav" > "$W/whole.flac"
+    flacraw -d -c "$W/stitched.flac" > "$W/stitched.raw"
+    flacraw -d -c "$W/whole.flac" > "$W/whole.raw"
+    cmp "$W/stitched.raw" "$W/whole.raw"
+}
+if command -v flac > /dev/null
+then
+    check split checksplit
+else
+    printf 'skip split (no flac)\n'
+fi
+
+exit $FAILED
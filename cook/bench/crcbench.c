@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Checks every CRC implementation in oggcrc.c against the original table
+ * implementation in crc32.h, then times them. Exits with failure if any of
+ * them disagree.
+ *
+ * Use: crcbench [megabytes]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../crc32.h"
+#include "../oggcrc.h"
+
+static void table(const void *data, size_t size, uint32_t *crc)
+{
+    crc32(data, size, crc);
+}
+
+static void dispatched(const void *data, size_t size, uint32_t *crc)
+{
+    oggCRC(data, size, crc);
+}
+
+static void clmul(const void *data, size_t size, uint32_t *crc)
+{
+    oggCRCClmul(data, size, crc);
+}
+
+struct Impl {
+    const char *name;
+    void (*crc)(const void *, size_t, uint32_t *);
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char **argv)
+{
+    struct Impl impls[4] = {
+        {"table", table},
+        {"slice8", oggCRCSlice8},
+        {"dispatch", dispatched},
+        {"clmul", clmul}
+    };
+    int implCt = 3;
+    size_t mb = 64, size, i;
+    unsigned char *buf;
+    int failed = 0;
+
+    if (argc > 1)
+        mb = atoi(argv[1]);
+    size = mb * 1024 * 1024;
+    if (size < 65536)
+        size = 65536;
+
+    {
+        uint32_t crc = 0;
+        if (oggCRCClmul("", 0, &crc))
+            implCt = 4;
+    }
+
+    buf = malloc(size);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    srand(0);
+    for (i = 0; i < size; i++)
+        buf[i] = rand();
+
+    // 1: Correctness, at every small size and alignment, and some large ones
+    for (size_t off = 0; off < 16; off++) {
+        for (size_t len = 0; len < 1024 + 16; len++) {
+            uint32_t expect = 0xf07159ba;
+            crc32(buf + off, len, &expect);
+            for (int ii = 1; ii < implCt; ii++) {
+                uint32_t crc = 0xf07159ba;
+                impls[ii].crc(buf + off, len, &crc);
+                if (crc != expect) {
+                    fprintf(stderr, "%s: mismatch at offset %d length %d: "
+                            "%08x != %08x\n", impls[ii].name, (int) off,
+                            (int) len, crc, expect);
+                    failed = 1;
+                }
+            }
+        }
+    }
+    for (size_t len = 4096; len <= size; len *= 4) {
+        uint32_t expect = 0;
+        crc32(buf, len, &expect);
+        for (int ii = 1; ii < implCt; ii++) {
+            // Split into two calls, as writeOgg does
+            uint32_t crc = 0;
+            impls[ii].crc(buf, 27, &crc);
+            impls[ii].crc(buf + 27, len - 27, &crc);
+            if (crc != expect) {
+                fprintf(stderr, "%s: mismatch at length %d: %08x != %08x\n",
+                        impls[ii].name, (int) len, crc, expect);
+                failed = 1;
+            }
+        }
+    }
+    if (failed)
+        return 1;
+
+    // 2: Speed, over the whole buffer and in page-sized pieces
+    for (int ii = 0; ii < implCt; ii++) {
+        static const size_t pieces[] = {0, 4096, 255, 3};
+        printf("%s:", impls[ii].name);
+        for (int pi = 0; pi < sizeof(pieces)/sizeof(pieces[0]); pi++) {
+            size_t piece = pieces[pi] ? pieces[pi] : size;
+            size_t total = size - size % piece;
+            uint32_t crc = 0;
+            double start = now(), time;
+            for (i = 0; i < total; i += piece)
+                impls[ii].crc(buf + i, piece, &crc);
+            time = now() - start;
+            printf(" %d bytes: %.1f MB/s (%08x)", (int) piece,
+                   total / time / 1048576.0, crc);
+            if (pi < sizeof(pieces)/sizeof(pieces[0]) - 1)
+                printf(",");
+        }
+        printf("\n");
+    }
+
+    free(buf);
+    return 0;
+}
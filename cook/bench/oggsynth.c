@@ -0,0 +1,571 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Writes a synthetic recording, laid out the way the recording server lays it
+ * out (header1, header2, data, idx and meta), so that the cook tools can be
+ * tested and timed without a real recording. The audio is nonsense, but the
+ * packet sizes, timing and metadata look like a real recording's: speech and
+ * silence, jitter and dropouts from the clients, pauses and resumes on the
+ * meta track, and datax subtracks.
+ *
+ * Use: oggsynth [options] <prefix>
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../oggindex.h"
+#include "../oggpage.h"
+#include "../oggwrite.h"
+
+/* NOTE: Like the rest of the cook tools, this assumes little-endian */
+
+// Granule positions are always in 48kHz, and every packet is 20ms
+#define PACKET_TIME 960
+#define GRANULE_RATE 48000
+
+// Beginning-of-stream page flag
+#define BOS 2
+
+// Precompiled headers, as in server/ennuicastr.ts
+static const unsigned char vadHeader[] = {
+    0x45, 0x43, 0x56, 0x41, 0x44, 0x44, 0x03, 0x00, 0x00, 0x03, 0x01
+};
+
+static const unsigned char opusHead[] = {
+    0x4F, 0x70, 0x75, 0x73, 0x48, 0x65, 0x61, 0x64, 0x01, 0x01, 0x38, 0x01,
+    0x80, 0xBB, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const unsigned char opusTags[] = {
+    0x4F, 0x70, 0x75, 0x73, 0x54, 0x61, 0x67, 0x73, 0x0A, 0x00, 0x00, 0x00,
+    0x65, 0x6E, 0x6E, 0x75, 0x69, 0x63, 0x61, 0x73, 0x74, 0x72
+};
+
+static const unsigned char flacHeader48k[] = {
+    0x7F, 0x46, 0x4C, 0x41, 0x43, 0x01, 0x00, 0x00, 0x03, 0x66, 0x4C, 0x61,
+    0x43, 0x00, 0x00, 0x00, 0x22, 0x03, 0xC0, 0x03, 0xC0, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x0B, 0xB8, 0x01, 0x70, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00
+};
+
+static const unsigned char flacHeader44k[] = {
+    0x7F, 0x46, 0x4C, 0x41, 0x43, 0x01, 0x00, 0x00, 0x03, 0x66, 0x4C, 0x61,
+    0x43, 0x00, 0x00, 0x00, 0x22, 0x03, 0x72, 0x03, 0x72, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x0A, 0xC4, 0x41, 0x70, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00
+};
+
+static const unsigned char flacTags[] = {
+    0x04, 0x00, 0x00, 0x41, 0x0A, 0x00, 0x00, 0x00, 0x65, 0x6E, 0x6E, 0x75,
+    0x69, 0x63, 0x61, 0x73, 0x74, 0x72
+};
+
+static const unsigned char metaHeader1[] = {
+    0x45, 0x43, 0x4d, 0x45, 0x54, 0x41, 0x00, 0x00
+};
+
+static const unsigned char metaHeader2[] = {
+    0x00, 0x00
+};
+
+struct Track {
+    uint32_t streamNo, packetNo;
+    int flac, continuous;
+
+    // The client's idea of the time, which drifts from ours
+    int64_t clientGranule;
+
+    // Speech state, and how many more packets it lasts
+    int speaking;
+    int stateLeft;
+
+    // Packets left in a dropout
+    int dropLeft;
+
+    // Subtracks (datax), with their own sequence numbers
+    int subtracks;
+    uint32_t *subPacketNo;
+    int *subStarted;
+};
+
+struct Output {
+    struct OggWriter writer;
+    uint64_t offset;
+    FILE *idx;
+};
+
+// Random state, so that runs are reproducible
+static uint64_t randState = 1;
+
+static uint32_t rnd(void)
+{
+    // xorshift64*
+    randState ^= randState >> 12;
+    randState ^= randState << 25;
+    randState ^= randState >> 27;
+    return (randState * 2685821657736338717ULL) >> 32;
+}
+
+// Random integer in [lo, hi]
+static int rndRange(int lo, int hi)
+{
+    return lo + rnd() % (hi - lo + 1);
+}
+
+// True with probability p/1000
+static int rndChance(int p)
+{
+    return (int) (rnd() % 1000) < p;
+}
+
+static void openOutput(struct Output *out, const char *prefix, const char *ext, int withIdx)
+{
+    char *path = malloc(strlen(prefix) + strlen(ext) + 6);
+    int fd;
+    if (!path) {
+        perror("malloc");
+        exit(1);
+    }
+
+    sprintf(path, "%s.%s", prefix, ext);
+    fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    if (oggWriterOpen(&out->writer, fd, 1024*1024) != 0) {
+        perror("malloc");
+        exit(1);
+    }
+    out->offset = 0;
+    out->idx = NULL;
+
+    if (withIdx) {
+        sprintf(path, "%s.idx", prefix);
+        out->idx = fopen(path, "wb");
+        if (!out->idx) {
+            perror(path);
+            exit(1);
+        }
+    }
+
+    free(path);
+}
+
+static void closeOutput(struct Output *out)
+{
+    oggWriterClose(&out->writer);
+    close(out->writer.fd);
+    if (out->idx && fclose(out->idx) != 0) {
+        perror("fclose");
+        exit(1);
+    }
+}
+
+// Write a page, and its index entry if this output is indexed
+static void writePage(struct Output *out, uint64_t granulePos, uint32_t streamNo,
+                      uint32_t packetNo, unsigned char flags,
+                      const unsigned char *data, uint32_t size)
+{
+    struct OggHeader header;
+    header.type = flags;
+    header.granulePos = granulePos;
+    header.streamNo = streamNo;
+    header.sequenceNo = packetNo;
+    header.crc = 0;
+    oggWritePage(&out->writer, &header, data, size);
+
+    if (out->idx) {
+        struct OggIndexEntry entry;
+        entry.offset = out->offset;
+        entry.granulePos = granulePos;
+        entry.streamNo = streamNo;
+        entry.packetSize = size;
+        entry.flags = flags;
+        entry.segmentCount = size / 255 + 1;
+        if (fwrite(&entry, sizeof(entry), 1, out->idx) != 1) {
+            perror("fwrite");
+            exit(1);
+        }
+    }
+
+    out->offset += 27 + size / 255 + 1 + size;
+}
+
+// Record a meta packet, in both the data and the meta sidecar
+static uint32_t metaPacketNo = 2;
+static void writeMeta(struct Output *data, struct Output *meta,
+                      uint64_t granulePos, const char *json)
+{
+    writePage(data, granulePos, 0, metaPacketNo, 0,
+              (const unsigned char *) json, strlen(json));
+    writePage(meta, granulePos, 0, metaPacketNo, 0,
+              (const unsigned char *) json, strlen(json));
+    metaPacketNo++;
+}
+
+// Make up a packet for this track
+static uint32_t makePacket(struct Track *track, unsigned char *buf)
+{
+    uint32_t size = 0, bodySize, i;
+
+    // Move between speech and silence
+    if (track->stateLeft-- <= 0) {
+        track->speaking = !track->speaking;
+        if (track->speaking)
+            track->stateLeft = rndRange(50, 500);
+        else
+            track->stateLeft = rndRange(50, 1000);
+    }
+
+    if (track->continuous)
+        buf[size++] = track->speaking ? rndRange(1, 3) : 0;
+
+    if (track->flac) {
+        /* A FLAC frame header, then something around the size of a 20ms
+         * frame (silent frames compress to almost nothing) */
+        buf[size++] = 0xFF;
+        buf[size++] = 0xF8;
+        buf[size++] = 0x69;
+        buf[size++] = 0x08;
+        bodySize = track->speaking ? rndRange(700, 1800) : rndRange(12, 24);
+    } else {
+        // An Opus TOC byte (CELT FB 20ms), then a typical VBR packet
+        buf[size++] = 0xF8;
+        bodySize = track->speaking ? rndRange(60, 160) : rndRange(2, 6);
+    }
+
+    for (i = 0; i < bodySize; i++)
+        buf[size++] = rnd();
+    return size;
+}
+
+static void writeWav(const char *prefix, double seconds)
+{
+    static unsigned char buf[65536];
+    struct {
+        unsigned char riff[4];
+        uint32_t fileSize;
+        unsigned char wave[4];
+        unsigned char fmt[4];
+        uint32_t fmtSize;
+        uint16_t type, channels;
+        uint32_t sampleRate, byteRate;
+        uint16_t blockAlign, bitsPerSample;
+        unsigned char data[4];
+        uint32_t dataSize;
+    } __attribute__((packed)) header;
+    uint64_t dataSize = (uint64_t) (seconds * GRANULE_RATE) * 2;
+    uint64_t left = dataSize;
+    char *path;
+    FILE *f;
+    size_t i;
+
+    path = malloc(strlen(prefix) + 5);
+    if (!path) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(path, "%s.wav", prefix);
+    f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+
+    // Like ffmpeg writing to a pipe, the sizes are left unknown
+    memcpy(header.riff, "RIFF", 4);
+    header.fileSize = -1;
+    memcpy(header.wave, "WAVE", 4);
+    memcpy(header.fmt, "fmt ", 4);
+    header.fmtSize = 16;
+    header.type = 1;
+    header.channels = 1;
+    header.sampleRate = GRANULE_RATE;
+    header.byteRate = GRANULE_RATE * 2;
+    header.blockAlign = 2;
+    header.bitsPerSample = 16;
+    memcpy(header.data, "data", 4);
+    header.dataSize = -1;
+    if (fwrite(&header, sizeof(header), 1, f) != 1) {
+        perror(path);
+        exit(1);
+    }
+
+    // Quiet noise
+    for (i = 0; i < sizeof(buf); i += 2) {
+        int16_t s = (int16_t) (rnd() % 512) - 256;
+        memcpy(buf + i, &s, 2);
+    }
+    while (left) {
+        size_t sz = left < sizeof(buf) ? left : sizeof(buf);
+        if (fwrite(buf, 1, sz, f) != sz) {
+            perror(path);
+            exit(1);
+        }
+        left -= sz;
+    }
+
+    if (fclose(f) != 0) {
+        perror(path);
+        exit(1);
+    }
+    free(path);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "Use: oggsynth [options] <prefix>\n"
+        "Writes <prefix>.header1, .header2, .data, .idx and .meta.\n"
+        "\n"
+        "Options:\n"
+        "  -t <tracks>    Number of audio tracks (default 4)\n"
+        "  -d <seconds>   Duration (default 600)\n"
+        "  -f <n>         Make every nth track FLAC, 0 for none (default 3)\n"
+        "  -r <rate>      FLAC sample rate, 44100 or 48000 (default 48000)\n"
+        "  -v             Use continuous (VAD) mode\n"
+        "  -p <pauses>    Number of pauses (default 2)\n"
+        "  -s <n>         Give the first track n datax subtracks (default 0)\n"
+        "  -j <permille>  Chance of jitter per packet (default 50)\n"
+        "  -x <permille>  Chance of a dropout per packet (default 1)\n"
+        "  -S <seed>      Random seed (default 1)\n"
+        "  -w             Also write <prefix>.wav, of the same duration\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int trackCt = 4, flacEvery = 3, flacRate = 48000, continuous = 0;
+    int pauseCt = 2, subtrackCt = 0, jitter = 50, dropout = 1, wav = 0;
+    double duration = 600;
+    const char *prefix;
+    struct Track *tracks;
+    struct Output header1, header2, data, meta;
+    uint64_t startGranule, endGranule, granulePos, lastGranule;
+    uint64_t *lastSubGranule;
+    uint64_t *pauseAt, *resumeAt;
+    int nextPause = 0, paused = 0;
+    unsigned char buf[4 + 1 + 4 + 2048];
+    char json[128];
+    int opt, ti, si, pi;
+
+    while ((opt = getopt(argc, argv, "t:d:f:r:vp:s:j:x:S:w")) != -1) {
+        switch (opt) {
+            case 't': trackCt = atoi(optarg); break;
+            case 'd': duration = atof(optarg); break;
+            case 'f': flacEvery = atoi(optarg); break;
+            case 'r': flacRate = atoi(optarg); break;
+            case 'v': continuous = 1; break;
+            case 'p': pauseCt = atoi(optarg); break;
+            case 's': subtrackCt = atoi(optarg); break;
+            case 'j': jitter = atoi(optarg); break;
+            case 'x': dropout = atoi(optarg); break;
+            case 'S': randState = strtoull(optarg, NULL, 0) * 2 + 1; break;
+            case 'w': wav = 1; break;
+            default: usage();
+        }
+    }
+    if (optind != argc - 1 || trackCt < 1 || duration <= 0 || pauseCt < 0 ||
+        subtrackCt < 0 || (flacRate != 44100 && flacRate != 48000))
+        usage();
+    prefix = argv[optind];
+
+    openOutput(&header1, prefix, "header1", 0);
+    openOutput(&header2, prefix, "header2", 0);
+    openOutput(&data, prefix, "data", 1);
+    openOutput(&meta, prefix, "meta", 0);
+
+    // The meta track is always first, since the recording starts with "start"
+    writePage(&header1, 0, 0, 0, BOS, metaHeader1, sizeof(metaHeader1));
+    writePage(&header2, 0, 0, 1, 0, metaHeader2, sizeof(metaHeader2));
+
+    // Then the users
+    tracks = calloc(trackCt, sizeof(struct Track));
+    lastSubGranule = calloc(subtrackCt + 1, sizeof(uint64_t));
+    if (!tracks || !lastSubGranule) {
+        perror("calloc");
+        return 1;
+    }
+    for (ti = 0; ti < trackCt; ti++) {
+        struct Track *track = &tracks[ti];
+        const unsigned char *h1, *h2;
+        uint32_t h1Size, h2Size, size;
+
+        track->streamNo = ti + 1;
+        track->flac = flacEvery && (ti + 1) % flacEvery == 0;
+        track->continuous = continuous;
+        track->stateLeft = rndRange(0, 500);
+        if (track->flac) {
+            h1 = (flacRate == 44100) ? flacHeader44k : flacHeader48k;
+            h1Size = sizeof(flacHeader48k);
+            h2 = flacTags;
+            h2Size = sizeof(flacTags);
+        } else {
+            h1 = opusHead;
+            h1Size = sizeof(opusHead);
+            h2 = opusTags;
+            h2Size = sizeof(opusTags);
+        }
+
+        size = 0;
+        if (continuous) {
+            memcpy(buf, vadHeader, sizeof(vadHeader));
+            size = sizeof(vadHeader);
+        }
+        memcpy(buf + size, h1, h1Size);
+        writePage(&header1, 0, track->streamNo, track->packetNo++, BOS, buf, size + h1Size);
+        writePage(&header2, 0, track->streamNo, track->packetNo++, 0, h2, h2Size);
+
+        if (ti == 0 && subtrackCt) {
+            track->subtracks = subtrackCt;
+            track->subPacketNo = calloc(subtrackCt + 1, sizeof(uint32_t));
+            track->subStarted = calloc(subtrackCt + 1, sizeof(int));
+            if (!track->subPacketNo || !track->subStarted) {
+                perror("calloc");
+                return 1;
+            }
+        }
+    }
+
+    // Pick when to pause (each for 5 to 60 seconds)
+    startGranule = lastGranule = GRANULE_RATE * 2;
+    endGranule = startGranule + (uint64_t) (duration * GRANULE_RATE);
+    pauseAt = calloc(pauseCt + 1, sizeof(uint64_t));
+    resumeAt = calloc(pauseCt + 1, sizeof(uint64_t));
+    if (!pauseAt || !resumeAt) {
+        perror("calloc");
+        return 1;
+    }
+    for (pi = 0; pi < pauseCt; pi++) {
+        uint64_t span = (endGranule - startGranule) / (pauseCt + 1);
+        pauseAt[pi] = startGranule + span * (pi + 1) +
+            (uint64_t) rndRange(-5, 5) * GRANULE_RATE;
+        resumeAt[pi] = pauseAt[pi] + (uint64_t) rndRange(5, 60) * GRANULE_RATE;
+    }
+
+    writeMeta(&data, &meta, startGranule, "{\"c\":\"start\"}");
+
+    // Clients start with their own offsets
+    for (ti = 0; ti < trackCt; ti++)
+        tracks[ti].clientGranule = startGranule + rndRange(0, 50) * PACKET_TIME;
+
+    for (granulePos = startGranule; granulePos < endGranule; granulePos += PACKET_TIME) {
+        // Pause and resume
+        if (nextPause < pauseCt) {
+            if (!paused && granulePos >= pauseAt[nextPause]) {
+                writeMeta(&data, &meta, granulePos, "{\"c\":\"pause\"}");
+                paused = 1;
+            } else if (paused && granulePos >= resumeAt[nextPause]) {
+                writeMeta(&data, &meta, granulePos, "{\"c\":\"resume\"}");
+                paused = 0;
+                nextPause++;
+            }
+        }
+
+        // The occasional chat message
+        if (!paused && rndChance(1) && rndChance(100)) {
+            snprintf(json, sizeof(json), "{\"c\":\"text\",\"text\":\"User %d: hello\"}",
+                     rndRange(1, trackCt));
+            writeMeta(&data, &meta, granulePos, json);
+        }
+
+        for (ti = 0; ti < trackCt; ti++) {
+            struct Track *track = &tracks[ti];
+            uint64_t packetGranule;
+            uint32_t size;
+
+            // Clients send whatever they've recorded by now
+            if (track->clientGranule > granulePos)
+                continue;
+
+            size = makePacket(track, buf);
+            packetGranule = track->clientGranule;
+            track->clientGranule += PACKET_TIME;
+
+            if (track->dropLeft) {
+                track->dropLeft--;
+                continue;
+            }
+            if (rndChance(dropout)) {
+                track->dropLeft = rndRange(1, 250);
+                continue;
+            }
+            if (rndChance(jitter)) {
+                packetGranule += (int64_t) rndRange(-3, 3) * PACKET_TIME;
+                if (packetGranule < startGranule)
+                    packetGranule = startGranule;
+            }
+
+            // The server never lets time run backwards, and drops paused data
+            if (packetGranule < lastGranule)
+                packetGranule = lastGranule;
+            lastGranule = packetGranule;
+            if (paused)
+                continue;
+
+            writePage(&data, packetGranule, track->streamNo, track->packetNo++,
+                      0, buf, size);
+
+            // And its subtracks, carrying the same audio
+            for (si = 1; si <= track->subtracks; si++) {
+                int32_t subId = si;
+                uint64_t subGranule = packetGranule;
+                if (!track->subStarted[si]) {
+                    snprintf(json, sizeof(json),
+                             "{\"c\":\"subtrack\",\"id\":%u,\"subId\":%d}",
+                             track->streamNo, si);
+                    writeMeta(&data, &meta, packetGranule, json);
+                    track->subStarted[si] = 1;
+                }
+                if (subGranule < lastSubGranule[si])
+                    subGranule = lastSubGranule[si];
+                lastSubGranule[si] = subGranule;
+                memmove(buf + 4, buf, size);
+                memcpy(buf, &subId, 4);
+                writePage(&data, subGranule, track->streamNo | 0x80000000,
+                          track->subPacketNo[si]++, 0, buf, size + 4);
+                memmove(buf, buf + 4, size);
+            }
+        }
+
+        // Clients drift a bit
+        for (ti = 0; ti < trackCt; ti++) {
+            if (rndChance(2))
+                tracks[ti].clientGranule += PACKET_TIME;
+            else if (rndChance(2))
+                tracks[ti].clientGranule -= PACKET_TIME;
+        }
+    }
+
+    closeOutput(&header1);
+    closeOutput(&header2);
+    closeOutput(&data);
+    closeOutput(&meta);
+
+    if (wav)
+        writeWav(prefix, duration);
+
+    return 0;
+}
@@ -24,7 +24,8 @@ const config = require("../config.js");
 
 const outFile = process.argv[2];
 const inRec = process.argv[3];
-const inBase = config.rec + "/" + inRec + ".ogg.";
+const inPrefix = config.rec + "/" + inRec + ".ogg";
+const inBase = inPrefix + ".";
 
 process.on("unhandledRejection", (reason, promise) => {
     //console.error(promise);
@@ -76,8 +77,8 @@ async function main() {
         {
             const p = cproc.spawn("/bin/sh", [
                 "-c",
-                `cat ${inBase}header1 ${inBase}header2 ${inBase}data ${inBase}header1 ${inBase}header2 ${inBase}data | ` +
-                `${config.repo}/cook/oggcorrect ${si + 1} | ` +
+                `${config.repo}/cook/oggrepack --cat ${inPrefix} | ` +
+                `${config.repo}/cook/oggcorrect --once ${si + 1} | ` +
                 `ffmpeg -c:a ${format} -i - -f ogg -c:a libopus -ac 1 -ar 16000 -b:a 32k -application lowdelay ` +
                 `${config.apiShare.dir}/${name}`
             ], {
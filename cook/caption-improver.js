@@ -23,7 +23,8 @@ const config = require("../config.js");
 
 const outFile = process.argv[2];
 const inRec = process.argv[3];
-const inBase = config.rec + "/" + inRec + ".ogg.";
+const inPrefix = config.rec + "/" + inRec + ".ogg";
+const inBase = inPrefix + ".";
 
 process.on("unhandledRejection", (reason, promise) => {
     //console.error(promise);
@@ -154,9 +155,8 @@ fastPunct.on("data", text => {
     // Get the metadata
     let meta = "";
 
-    let proc = cproc.spawn("/bin/sh", ["-c",
-        `cat ${inBase}header1 ${inBase}header2 ${inBase}data | ` +
-        `${config.repo}/cook/oggmeta`
+    let proc = cproc.spawn(`${config.repo}/cook/oggmeta`, [
+        inBase.slice(0, -1)
     ], {stdio: ["ignore", "pipe", "ignore"]});
     proc.stdout.on("data", chunk => {
         meta = meta + chunk.toString();
@@ -191,8 +191,7 @@ fastPunct.on("data", text => {
     // Get the formats
     let formats = "";
     proc = cproc.spawn("/bin/sh", ["-c",
-        `cat ${inBase}header1 ${inBase}header2 ${inBase}data | ` +
-        `${config.repo}/cook/oggtracks`
+        `${config.repo}/cook/oggtracks < ${inBase}header1`
     ], {stdio: ["ignore", "pipe", "ignore"]});
     proc.stdout.on("data", chunk => {
         formats = formats + chunk.toString();
@@ -262,8 +261,8 @@ fastPunct.on("data", text => {
             curId = data.id;
             const format = (formats[curId - 1] === "flac") ? "flac" : "libopus";
             curStream = new Syncy(
-                `cat ${inBase}header1 ${inBase}header2 ${inBase}data ${inBase}header1 ${inBase}header2 ${inBase}data | ` +
-                `${config.repo}/cook/oggcorrect ${curId} | ` +
+                `${config.repo}/cook/oggrepack --cat ${inPrefix} | ` +
+                `${config.repo}/cook/oggcorrect --once ${curId} | ` +
                 `ffmpeg -c:a ${format} -i - -f s16le -ac 1 -ar 48000 -`
             );
             vosk.write(JSON.stringify({c: "reset"}) + "\n");
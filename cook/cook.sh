@@ -132,8 +132,7 @@ CODECS=`timeout 10 "$SCRIPTBASE/oggtracks" < $ID.ogg.header1`
 STREAM_NOS=`timeout 10 "$SCRIPTBASE/oggtracks" -n < $ID.ogg.header1`
 NB_STREAMS=`echo "$CODECS" | wc -l`
 
-timeout $DEF_TIMEOUT cat $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
-    timeout $DEF_TIMEOUT "$SCRIPTBASE/oggmeta" > $tmpdir/meta
+timeout $DEF_TIMEOUT "$SCRIPTBASE/oggmeta" $ID.ogg > $tmpdir/meta
 NB_SFX=`timeout 10 "$SCRIPTBASE/sfx.js" -i "$ID.ogg.info" < $tmpdir/meta`
 
 # Detect if we have captions
@@ -203,6 +202,28 @@ then
 fi
 
 
+# Get the durations
+if [ -e $ID.ogg.idx ]
+then
+    TRACK_DURATIONS="$(timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggduration3" --index $ID.ogg)"
+else
+    TRACK_DURATIONS="$(timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggduration3" $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data)"
+fi
+
+
+# Correct one track to stdout. With an index, only that track is read (which
+# is also the only way to read the per-stream layout).
+correct() {
+    if [ -e $ID.ogg.idx ]
+    then
+        timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggcorrect" --index $ID.ogg --once "$1"
+    else
+        timeout $DEF_TIMEOUT cat $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
+            timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggcorrect" --once "$1"
+    fi
+}
+
+
 # Encode thru fifos
 for c in `seq -w 1 $NB_STREAMS`
 do
@@ -212,16 +233,13 @@ do
     C_FN="$c${O_USER+-}$O_USER.vtt"
     O_FFN="$OUTDIR/$O_FN"
     C_FFN="$OUTDIR/$C_FN"
-    T_DURATION=`timeout $DEF_TIMEOUT cat $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
-        timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggduration" $c`
+    cn=$(echo "$c" | sed 's/^0*//')
+    T_DURATION="$("$SCRIPTBASE/json-rd.js" "$TRACK_DURATIONS" "$cn" 2.0)"
     sno=`echo "$STREAM_NOS" | sed -n "$c"p`
 
     if [ "$FORMAT" = "copy" -o "$CONTAINER" = "mix" ]
     then
-        timeout $DEF_TIMEOUT cat \
-            $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data \
-            $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
-            timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggcorrect" $sno > "$O_FFN" &
+        correct $sno > "$O_FFN" &
 
     else
         CODEC=`echo "$CODECS" | sed -n "$c"p`
@@ -229,10 +247,7 @@ do
 
         LFILTER="$(echo "$FILTER" | sed 's/@DELAY@/'"$(node -p '18500+Math.random()*2000')"'/g')"
 
-        timeout $DEF_TIMEOUT cat \
-            $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data \
-            $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
-            timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggcorrect" $sno |
+        correct $sno |
             timeout $DEF_TIMEOUT $NICE ffmpeg -codec $CODEC -copyts -i - \
             -filter_complex '[0:a]'"$LFILTER"'[aud]' \
             -map '[aud]' \
@@ -335,9 +350,9 @@ case "$CONTAINER" in
         done
         MIXFILTER="$MIXFILTER amix=$co,dynaudnorm[aud]"
         FILTER="$FILTER$MIXFILTER"
-        DURATION=`timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/cook/oggduration" < "$SCRIPTBASE/rec/$ID.ogg.data"`
+        DURATION="$("$SCRIPTBASE/json-rd.js" "$TRACK_DURATIONS" 0 2.0)"
         timeout $DEF_TIMEOUT $NICE ffmpeg $INPUT -filter_complex "$FILTER" -map '[aud]' -flags bitexact -f wav - < /dev/null |
-            timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/cook/wavduration" "$DURATION" |
+            timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/wavduration" "$DURATION" |
             (
                 timeout $DEF_TIMEOUT $NICE $ENCODE;
                 cat > /dev/null
@@ -70,6 +70,32 @@ ZIPFLAGS=-1
 # Output files
 FILES=
 
+# How many encoders to run at once (default: based on CPUs and memory)
+JOBS=
+
+# Where to report progress, if anywhere
+PROGRESS=
+
+# Where to cache encoded tracks, if anywhere, and how much to keep there
+CACHE=
+CACHE_SIZE=$(( 10 * 1024 * 1024 * 1024 ))
+
+# Where to log the cook tools' statistics, if anywhere
+STATS=
+
+# The part of the recording to cook (in seconds, not counting pauses), for
+# partial downloads and previews. This only applies to the audio tracks.
+RANGE_START=
+RANGE_END=
+
+# How many segments to split each long track into, to encode in parallel (a
+# number, or "auto" for however many cores each track gets), if any
+SPLIT=
+
+# How the cook tools should read the recording (see oggReaderSetPolicy in
+# oggpage.h), if not the default
+IO_POLICY=
+
 usage() {
     printf \
 'Use: cook2.sh --id <ID> [--rec-base <rec dir base>] [--file-name <name>]
@@ -77,6 +103,10 @@ usage() {
               [--sample] [--exclude-all] [--include <audio/captions>]
               [--exclude <audio/captions>]
               [--only <track>] [--subtrack <id>]
+              [--jobs <count>] [--progress <file>]
+              [--cache <dir>] [--cache-size <bytes>] [--stats <file>]
+              [--split <segments|auto>] [--start <secs>] [--end <secs>]
+              [--io <map|stream|direct>[:<read-ahead>]]
 ' >&2
 }
 
@@ -190,6 +220,51 @@ do
             shift
             ;;
 
+        --jobs|-j)
+            JOBS="$1"
+            shift
+            ;;
+
+        --progress)
+            PROGRESS="$(realpath "$1")"
+            shift
+            ;;
+
+        --cache)
+            CACHE="$(realpath "$1")"
+            shift
+            ;;
+
+        --cache-size)
+            CACHE_SIZE="$1"
+            shift
+            ;;
+
+        --stats)
+            STATS="$(realpath "$1")"
+            shift
+            ;;
+
+        --split)
+            SPLIT="$1"
+            shift
+            ;;
+
+        --start)
+            RANGE_START="$1"
+            shift
+            ;;
+
+        --io)
+            IO_POLICY="$1"
+            shift
+            ;;
+
+        --end)
+            RANGE_END="$1"
+            shift
+            ;;
+
         *)
             usage
             exit 1
@@ -270,6 +345,15 @@ then
     ext=ogg
 fi
 
+# Compressed audio gains nothing from deflate, so is just stored, by zipstream,
+# which reads every file at once (and so doesn't need the jobs in order)
+ZIPSTREAM=no
+if [ "$CONTAINER" = "zip" -o "$CONTAINER" = "aupzip" ] &&
+   [ "$ZIPFLAGS" = "-1" -a -x "$SCRIPTBASE/zipstream" ]
+then
+    ZIPSTREAM=yes
+fi
+
 cd "$RECBASE"
 
 # Make a temporary directory for our results
@@ -292,21 +376,48 @@ fi
 
 NICE="nice -n10 ionice -c3 chrt -i 0"
 
+# The file that grows with the recording: its data, or, in the per-stream
+# layout (see oggindex.h), its index
+DATA_FILE=$ID.ogg.data
+[ -e $DATA_FILE ] || DATA_FILE=$ID.ogg.idx
+
+# Get one field for every track from the recording's manifest (which is
+# cached, so only the first of these reads the recording)
+manifest() {
+    timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggmanifest" --cache -l "$1" $ID.ogg
+}
+
 # Figure out the codecs in this file
-CODECS="$(timeout 10 "$SCRIPTBASE/oggtracks" < $ID.ogg.header1)"
+CODECS="$(manifest codec)"
 
 # And stream numbers
-STREAM_NOS="$(timeout 10 "$SCRIPTBASE/oggtracks" -n < $ID.ogg.header1)"
+STREAM_NOS="$(manifest stream)"
 
 # And number of streams
 NB_STREAMS="$(echo "$CODECS" | wc -l)"
 
+# Report the progress of a stage
+progress() {
+    if [ "$PROGRESS" ]
+    then
+        printf '%s %s\n' "$(date +%s.%N | cut -c1-14)" "$*" >> "$PROGRESS"
+    fi
+}
+
+# Quote a string for the shell
+shquote() {
+    printf "'%s'" "$(printf '%s' "$1" | sed "s/'/'\\\\''/g")"
+}
+
+# Read the recording as we were told to
+IO_ARG=
+[ "$IO_POLICY" ] && IO_ARG="--io $IO_POLICY"
+
 # Function to extract the metadata
 mkmeta() {
     if [ ! -e $tmpdir/meta ]
     then
-        timeout $DEF_TIMEOUT cat $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
-            timeout $DEF_TIMEOUT "$SCRIPTBASE/oggmeta" > $tmpdir/meta
+        timeout $DEF_TIMEOUT "$SCRIPTBASE/oggmeta" $IO_ARG $ID.ogg > $tmpdir/meta
     fi
 }
 
@@ -442,11 +553,343 @@ fi
 # Get the durations
 if [ "$INCLUDE_AUDIO" = "yes" -o "$INCLUDE_DURATIONS" = "yes" ]
 then
-    TRACK_DURATIONS="$(timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggduration3" $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data)"
+    TRACK_DURATIONS="$(manifest duration)"
+fi
+
+# Only part of the recording is being cooked, so only part of each track (and
+# of the SFX, captions and chat, which are all given the same range)
+RANGE_ARGS=
+VTT_RANGE_ARGS=
+if [ "$RANGE_START" -o "$RANGE_END" ]
+then
+    RANGE_ARGS="${RANGE_START:+--start $RANGE_START} ${RANGE_END:+--end $RANGE_END}"
+    # The range doesn't count pauses, which the captions may not have in them
+    mkmeta
+    VTT_RANGE_ARGS="$RANGE_ARGS --pauses $tmpdir/meta"
+    TRACK_DURATIONS="$(echo "$TRACK_DURATIONS" | awk -v s="${RANGE_START:-0}" -v e="$RANGE_END" '{
+        d = $1
+        if (e != "" && d > e + 2) d = e + 2
+        d -= s
+        if (d < 2) d = 2
+        printf("%.2f\n", d)
+    }')"
+fi
+
+# Long tracks can be split at silence, encoded in parallel, and stitched back
+# together (see wavsplit.c and encstitch.c), in formats that can be stitched
+# sample-accurately. The cuts must be on the encoder's frame boundaries.
+SPLIT_SEGMENTS=1
+SPLIT_ARGS=
+STITCH_ARGS=
+# Every track may be split at once, so each one keeps no more than its share of
+# the cores' worth of segments waiting to be encoded (wavsplit -w).
+SPLIT_TRACKS=$NB_STREAMS
+[ "$ONLY_TRACK" != "no" ] && SPLIT_TRACKS=1
+[ "$SPLIT_TRACKS" -gt 0 ] || SPLIT_TRACKS=1
+SPLIT_WAITING=$(( $(nproc) / SPLIT_TRACKS ))
+[ "$SPLIT_WAITING" -gt 0 ] || SPLIT_WAITING=1
+if [ "$SPLIT" = "auto" ]
+then
+    SPLIT_SEGMENTS=$SPLIT_WAITING
+elif [ "$SPLIT" ]
+then
+    SPLIT_SEGMENTS="$SPLIT"
+fi
+if [ "$SPLIT_SEGMENTS" -gt 1 -a -x "$SCRIPTBASE/encstitch" ]
+then
+    case "$FORMAT" in
+        copy|vorbis|aac|wav)
+            ;;
+        opus)
+            # 20ms packets, offset by opusenc's pre-skip, which with the
+            # lead-in must be whole packets
+            SPLIT_ARGS="-a 960 -o 312 -l 1608"
+            STITCH_ARGS="-l 1608"
+            TRACK_RATES="$(manifest rate)"
+            ;;
+        *)
+            # flac's default block size
+            SPLIT_ARGS="-a 4096"
+            ;;
+    esac
+fi
+
+
+# Write the stages of the job for track $c that decode it to WAV, each run by
+# $1 (so that we know if any of them failed)
+trackdecode() {
+    if [ "$FILTER" = "anull" -a -x "$SCRIPTBASE/oggpcm" ] &&
+       [ "$TRACK_CODEC" = "libopus" -o "$TRACK_CODEC" = "flac" ]
+    then
+        # Nothing to filter, so decode it directly
+        printf '%s timeout %s %s %s %s < %s |\n' \
+            "$1" $DEF_TIMEOUT "$NICE" "$(shquote "$SCRIPTBASE/oggpcm")" \
+            "$TRACK_DURATION" "$(shquote "$tmpdir/$c.ogg")"
+    else
+        printf '%s timeout %s cat %s |\n' \
+            "$1" $DEF_TIMEOUT "$(shquote "$tmpdir/$c.ogg")"
+        printf '    %s timeout %s %s ffmpeg -codec %s -copyts -i - -filter_complex %s -map %s -flags bitexact -f wav -c:a pcm_s24le - |\n' \
+            "$1" $DEF_TIMEOUT "$NICE" $TRACK_CODEC \
+            "$(shquote "[0:a]$LFILTER[aud]")" "'[aud]'"
+        printf '    %s timeout %s %s %s %s |\n' \
+            "$1" $DEF_TIMEOUT "$NICE" "$(shquote "$SCRIPTBASE/wavduration")" \
+            "$TRACK_DURATION"
+    fi
+}
+
+# Write the job to encode track $1 (numbered $2). If there's a cache, and the
+# track is in it, instead note where in $tmpdir/jobs/$1.cached, and if it's
+# not, have the job put it there. The job waits for the track to be corrected.
+trackjob() {
+    c="$1"
+    cn="$2"
+
+    TRACK_STREAMNO="$(echo "$STREAM_NOS" | sed -n "$cn"p)"
+    TRACK_DURATION="$(echo "$TRACK_DURATIONS" | sed -n "$cn"p)"
+    [ "$TRACK_DURATION" ] || TRACK_DURATION=2.0
+
+    # Get out the codec for this track
+    TRACK_CODEC="$(echo "$CODECS" | sed -n "$cn"p)"
+    [ "$TRACK_CODEC" = "opus" ] && TRACK_CODEC=libopus
+
+    # Split it if it's long enough for at least two segments, and decoded
+    # directly (so at its own rate, which for Opus must be 48kHz)
+    TRACK_SPLIT=no
+    if [ "$SPLIT_ARGS" -a "$FILTER" = "anull" -a -x "$SCRIPTBASE/oggpcm" ] &&
+       [ "$TRACK_CODEC" = "libopus" -o "$TRACK_CODEC" = "flac" ] &&
+       [ "${TRACK_DURATION%.*}" -ge 120 ]
+    then
+        TRACK_SPLIT=yes
+        if [ "$TRACK_RATES" ] &&
+           [ "$(echo "$TRACK_RATES" | sed -n "$cn"p)" != "48000" ]
+        then
+            TRACK_SPLIT=no
+        fi
+    fi
+
+    # Filter for this track (just the standard filter, but add a possible
+    # delay for the sample download
+    LFILTER="$(echo "$FILTER" | sed 's/@DELAY@/'"$(node -p '18500+Math.random()*2000')"'/g')"
+
+    # The pipeline to process the track. Each stage is run by ok, so that we
+    # know if any of them failed, except that a failure while split just means
+    # doing it again unsplit.
+    (
+        if [ "$TRACK_SPLIT" = "yes" ]
+        then
+            # Encode the segments in parallel, and if anything goes wrong with
+            # that, encode the track unsplit instead
+            SEG="$(shquote "$tmpdir/$c-seg")"
+            printf 'segok() { "$@" || : > %s-failed; }\n' "$SEG"
+            trackdecode segok
+            printf '    { segok timeout %s %s %s %s -w %s %s %s; cat > /dev/null; } |\n' \
+                $DEF_TIMEOUT "$NICE" "$(shquote "$SCRIPTBASE/wavsplit")" \
+                "$SPLIT_ARGS" "$SPLIT_WAITING" "$SPLIT_SEGMENTS" "$SEG"
+            printf '    { while read seg; do ( segok timeout %s %s %s < "$seg" > "$seg.enc"; rm -f "$seg" ) & done; wait; }\n' \
+                $DEF_TIMEOUT "$NICE" "$ENCODE"
+            printf 'if [ ! -e %s-failed ] &&\n' "$SEG"
+            printf '   timeout %s %s %s %s %s-*.wav.enc > %s-stitched\n' \
+                $DEF_TIMEOUT "$NICE" "$(shquote "$SCRIPTBASE/encstitch")" \
+                "$STITCH_ARGS" "$SEG" "$SEG"
+            printf 'then\n'
+            printf '    ok cat %s-stitched\n' "$SEG"
+            printf 'else\n'
+            trackdecode ok | sed 's/^/    /'
+            printf '        ( ok timeout %s %s %s; cat > /dev/null )\n' \
+                $DEF_TIMEOUT "$NICE" "$ENCODE"
+            printf 'fi\n'
+            printf 'rm -f %s-*\n' "$SEG"
+        else
+            trackdecode ok
+            printf '    ( ok timeout %s %s %s; cat > /dev/null )\n' \
+                $DEF_TIMEOUT "$NICE" "$ENCODE"
+        fi
+    ) > "$tmpdir/jobs/$c.pipe"
+
+    # The cache is keyed by the recording and the pipeline (which has every
+    # option that affects the result), unless the filter is random
+    TRACK_CACHE=
+    if [ "$CACHE" -a "$LFILTER" = "$FILTER" ]
+    then
+        TRACK_CACHE="$CACHE/$( (
+            printf '%s %s %s %s %s\n' "$ID" "$(stat -c '%s %Y' $DATA_FILE)" \
+                "$TRACK_STREAMNO" "$SUBTRACK" "$RANGE_ARGS"
+            sed "s|$tmpdir|@TMP@|g" "$tmpdir/jobs/$c.pipe"
+        ) | sha256sum | cut -d' ' -f1).$ext"
+
+        if [ -s "$TRACK_CACHE" ]
+        then
+            touch -c "$TRACK_CACHE"
+            printf '%s' "$TRACK_CACHE" > "$tmpdir/jobs/$c.cached"
+            return
+        fi
+    fi
+
+    (
+        printf 'timeout() { /usr/bin/timeout -k 5 "$@"; }\n'
+        printf 'while [ ! -e %s -a ! -e %s ]; do sleep 1; done\n' \
+            "$(shquote "$tmpdir/$c.ogg")" "$(shquote "$tmpdir/corrected")"
+        if [ "$TRACK_CACHE" ]
+        then
+            # Fill the cache as we go, if everything worked
+            printf 'CACHETMP=%s.$$\n' "$(shquote "$CACHE/.${TRACK_CACHE##*/}")"
+            printf 'trap %s EXIT\n' "'rm -f \"\$CACHETMP\" \"\$CACHETMP.fail\"'"
+            printf 'trap %s HUP INT TERM\n' "'exit 1'"
+            printf 'ok() { "$@" || : > "$CACHETMP.fail"; }\n'
+            printf '{\n'
+            cat "$tmpdir/jobs/$c.pipe"
+            printf '} |\n'
+            printf '    tee "$CACHETMP" &&\n'
+            printf '    [ ! -e "$CACHETMP.fail" ] &&\n'
+            printf '    mv "$CACHETMP" %s\n' "$(shquote "$TRACK_CACHE")"
+        else
+            printf 'ok() { "$@"; }\n'
+            cat "$tmpdir/jobs/$c.pipe"
+        fi
+    ) > "$tmpdir/jobs/$c.sh"
+}
+
+# Add up the statistics of every cook tool run for this download, and log them
+# (with each tool's own) as one line of JSON
+logstats() {
+    (
+        printf '{"id":"%s","format":"%s","container":"%s","date":%s,"tools":[' \
+            "$ID" "$FORMAT" "$CONTAINER" "$(date +%s)"
+        cat "$tmpdir"/stats/*.json 2>/dev/null | sed '$!s/$/,/' | tr -d '\n'
+        printf '],"totals":'
+        cat "$tmpdir"/stats/*.json 2>/dev/null | awk '
+            function add(sect, names, values, ct,   s, n, i, kv) {
+                s = $0
+                sub(".*\"" sect "\":[{]", "", s)
+                sub("[}].*", "", s)
+                n = split(s, kv, "[,:]")
+                for (i = 1; i + 1 <= n; i += 2) {
+                    if (!(kv[i] in values))
+                        names[++ct[sect]] = kv[i]
+                    values[kv[i]] += kv[i+1]
+                }
+            }
+            function show(sect, names, values, ct,   i) {
+                printf("\"%s\":{", sect)
+                for (i = 1; i <= ct[sect]; i++)
+                    printf("%s%s:%s", (i > 1) ? "," : "", names[i], values[names[i]])
+                printf("}")
+            }
+            {
+                add("phases", phaseNames, phases, ct)
+                add("counters", counterNames, counters, ct)
+            }
+            END {
+                printf("{")
+                show("phases", phaseNames, phases, ct)
+                printf(",")
+                show("counters", counterNames, counters, ct)
+                printf("}")
+            }'
+        printf '}\n'
+    ) > "$tmpdir/stats/all" &&
+        cat "$tmpdir/stats/all" >> "$STATS"
+}
+
+# Keep the cache within its size, dropping the least recently used first, and
+# drop any temporary files left by jobs that were killed (so older than any job
+# could be)
+prunecache() {
+    find "$CACHE" -maxdepth 1 -type f -name '.*' \
+        -mmin +$(( DEF_TIMEOUT / 60 + 1 )) -delete
+    find "$CACHE" -maxdepth 1 -type f -name '[0-9a-f]*' -printf '%T@ %s %f\n' |
+        sort -rn |
+        awk -v max="$CACHE_SIZE" '{ total += $2; if (total > max) print $3 }' |
+        while read f
+        do
+            rm -f "$CACHE/$f"
+        done
+}
+
+# Encoding is done by a bounded pool of jobs, written to the fifos in order
+mkdir "$tmpdir/jobs"
+: > "$tmpdir/jobs/list"
+[ "$CACHE" ] && mkdir -p "$CACHE"
+
+# Correct every track we need in a single pass over the recording, into
+# temporary files, unless they were already corrected by following the
+# recording as it was recorded, or are already encoded in the cache
+FOLLOWED=no
+if [ "$SUBTRACK" = "0" -a ! "$RANGE_ARGS" -a -e $ID.ogg.follow/complete ] &&
+   [ -e $ID.ogg.data ] &&
+   [ "$(cat $ID.ogg.follow/complete)" = "$(stat -c %s $ID.ogg.data)" ]
+then
+    FOLLOWED=yes
 fi
+CORRECT_ARGS=""
+if [ "$INCLUDE_AUDIO" = "yes" ]
+then
+    for c in $(seq -w 1 $NB_STREAMS)
+    do
+        cn=$(echo "$c" | sed 's/^0*//')
+        if [ "$ONLY_TRACK" != "no" -a "$ONLY_TRACK" != "$cn" ]
+        then
+            continue
+        fi
 
+        TRACK_STREAMNO="$(echo "$STREAM_NOS" | sed -n "$cn"p)"
+        if [ "$FORMAT" != "copy" ]
+        then
+            trackjob "$c" "$cn"
+            [ -e "$tmpdir/jobs/$c.cached" ] && continue
+        fi
+        if [ "$FOLLOWED" = "yes" -a -e $ID.ogg.follow/$TRACK_STREAMNO.ogg ]
+        then
+            ln -s "$RECBASE/$ID.ogg.follow/$TRACK_STREAMNO.ogg" $tmpdir/$c.ogg
+            continue
+        fi
+        CORRECT_ARGS="$CORRECT_ARGS -o $tmpdir/$c.ogg $TRACK_STREAMNO $SUBTRACK"
+    done
+fi
+
+
+# Each cook tool writes its statistics here, if we're keeping them
+STATS_ARG=
+if [ "$STATS" ]
+then
+    mkdir "$tmpdir/stats"
+    STATS_ARG="--stats=$tmpdir/stats/correct.json"
+fi
+
+# Copied tracks go straight out, so pack their packets into fewer pages. The
+# encoders don't need it.
+PACK_ARG=
+[ "$FORMAT" = "copy" ] && PACK_ARG="--pack 0"
 
 # Encode thru fifos
+(
+correct() {
+    progress correct start
+    if [ "$CORRECT_ARGS" -a -e $ID.ogg.idx ]
+    then
+        # With an index, we only need to read the tracks we're correcting
+        timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggcorrect" $STATS_ARG $IO_ARG $PACK_ARG $RANGE_ARGS --index $ID.ogg --once $CORRECT_ARGS
+    elif [ "$CORRECT_ARGS" ]
+    then
+        timeout $DEF_TIMEOUT cat $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
+            timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggcorrect" $STATS_ARG $PACK_ARG $RANGE_ARGS --once $CORRECT_ARGS
+    fi
+    progress correct done
+    : > "$tmpdir/corrected"
+}
+
+# oggcorrect only puts each track in place once it's complete, and each job
+# waits for its own track, so they can start while the rest are corrected.
+# Copied tracks are just copied below, so need them all first.
+CORRECT_PID=
+if [ "$FORMAT" = "copy" ]
+then
+    correct
+else
+    correct &
+    CORRECT_PID=$!
+fi
+
 for c in $(seq -w 1 $NB_STREAMS)
 do
     cn=$(echo "$c" | sed 's/^0*//')
@@ -468,7 +911,8 @@ do
     if [ "$INCLUDE_AUDIO" = "yes" -o "$INCLUDE_DURATIONS" = "yes" ]
     then
         # Get the duration of this track
-        TRACK_DURATION="$(timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/json-rd.js" "$TRACK_DURATIONS" "$cn" 2.0)"
+        TRACK_DURATION="$(echo "$TRACK_DURATIONS" | sed -n "$cn"p)"
+        [ "$TRACK_DURATION" ] || TRACK_DURATION=2.0
     fi
 
     if [ "$INCLUDE_AUDIO" = "yes" ]
@@ -476,34 +920,15 @@ do
         if [ "$FORMAT" = "copy" ]
         then
             # Just copy the data directly
-            timeout $DEF_TIMEOUT cat \
-                $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data \
-                $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
-                timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggcorrect" $TRACK_STREAMNO $SUBTRACK > "$TRACK_FFN" &
+            timeout $DEF_TIMEOUT cat "$tmpdir/$c.ogg" > "$TRACK_FFN" &
+
+        elif [ -e "$tmpdir/jobs/$c.cached" ]
+        then
+            # Already encoded, so straight from the cache
+            timeout $DEF_TIMEOUT cat "$(cat "$tmpdir/jobs/$c.cached")" > "$TRACK_FFN" &
 
         else
-            # Get out the codec for this track
-            TRACK_CODEC="$(echo "$CODECS" | sed -n "$cn"p)"
-            [ "$TRACK_CODEC" = "opus" ] && TRACK_CODEC=libopus
-
-            # Filter for this track (just the standard filter, but add a possible
-            # delay for the sample download
-            LFILTER="$(echo "$FILTER" | sed 's/@DELAY@/'"$(node -p '18500+Math.random()*2000')"'/g')"
-
-            # Process the track
-            timeout $DEF_TIMEOUT cat \
-                $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data \
-                $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
-                timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggcorrect" $TRACK_STREAMNO $SUBTRACK |
-                timeout $DEF_TIMEOUT $NICE ffmpeg -codec $TRACK_CODEC -copyts -i - \
-                -filter_complex '[0:a]'"$LFILTER"'[aud]' \
-                -map '[aud]' \
-                -flags bitexact -f wav -c:a pcm_s24le - |
-                timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/wavduration" "$TRACK_DURATION" |
-                (
-                    timeout $DEF_TIMEOUT $NICE $ENCODE > "$TRACK_FFN";
-                    cat > /dev/null
-                )
+            printf '%s\tsh %s\n' "$TRACK_FFN" "$(shquote "$tmpdir/jobs/$c.sh")" >> "$tmpdir/jobs/list"
 
         fi
     fi
@@ -517,9 +942,9 @@ do
     # And the captions
     if [ "$INCLUDE_CAPTIONS" = "yes" -a "$CONTAINER" != "json" ]
     then
-        timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/vtt.js" -f $CAPTIONFORMAT $TRACK_STREAMNO < $CAPTION_FILE > "$CAP_FFN" &
+        timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/vtt.js" -f $CAPTIONFORMAT $VTT_RANGE_ARGS $TRACK_STREAMNO < $CAPTION_FILE > "$CAP_FFN" &
     fi
-done &
+done
 
 # Same for SFX
 for c in $(seq -w 1 $NB_SFX)
@@ -532,24 +957,41 @@ do
 
     SFX_FN="sfx-$c.$ext"
     SFX_FFN="$OUTDIR/$AUDDIR$SFX_FN"
-    SFX_DURATION="$(timeout $DEF_TIMEOUT "$SCRIPTBASE/sfx.js" -i "$ID.ogg.info" -d $((c-1)) < $tmpdir/meta)"
+    SFX_DURATION="$(timeout $DEF_TIMEOUT "$SCRIPTBASE/sfx.js" -i "$ID.ogg.info" $RANGE_ARGS -d $((c-1)) < $tmpdir/meta)"
 
     if [ "$INCLUDE_AUDIO" = "yes" ]
     then
-        LFILTER="$(timeout $DEF_TIMEOUT "$SCRIPTBASE/sfx.js" -i "$ID.ogg.info" $((c-1)) < $tmpdir/meta)"
-        timeout $DEF_TIMEOUT $NICE ffmpeg -filter_complex "$LFILTER" -map '[aud]' -flags bitexact -f wav - |
-            timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/wavduration" "$SFX_DURATION" |
-            (
-                timeout $DEF_TIMEOUT $NICE $ENCODE > "$SFX_FFN";
-                cat > /dev/null
-            )
+        LFILTER="$(timeout $DEF_TIMEOUT "$SCRIPTBASE/sfx.js" -i "$ID.ogg.info" $RANGE_ARGS $((c-1)) < $tmpdir/meta)"
+        (
+            printf 'timeout() { /usr/bin/timeout -k 5 "$@"; }\n'
+            printf 'timeout %s %s ffmpeg -filter_complex %s -map %s -flags bitexact -f wav - |\n' \
+                $DEF_TIMEOUT "$NICE" "$(shquote "$LFILTER")" "'[aud]'"
+            printf '    timeout %s %s %s %s |\n' \
+                $DEF_TIMEOUT "$NICE" "$(shquote "$SCRIPTBASE/wavduration")" \
+                "$SFX_DURATION"
+            printf '    ( timeout %s %s %s; cat > /dev/null )\n' \
+                $DEF_TIMEOUT "$NICE" "$ENCODE"
+        ) > "$tmpdir/jobs/sfx-$c.sh"
+        printf '%s\tsh %s\n' "$SFX_FFN" "$(shquote "$tmpdir/jobs/sfx-$c.sh")" >> "$tmpdir/jobs/list"
     fi
 
     if [ "$INCLUDE_DURATIONS" = "yes" ]
     then
         printf '"sfx_duration_%s":%s' "$cn" "$SFX_DURATION" > "$SFX_FFN.duration" &
     fi
-done &
+done
+
+progress encode start
+DIRECT=
+[ "$ZIPSTREAM" = "yes" ] && DIRECT=-u
+timeout $DEF_TIMEOUT "$SCRIPTBASE/jobpool" $DIRECT \
+    ${JOBS:+-j "$JOBS"} ${PROGRESS:+-p "$PROGRESS"} -t "$tmpdir" \
+    < "$tmpdir/jobs/list"
+progress encode done
+[ "$CORRECT_PID" ] && wait $CORRECT_PID
+[ "$STATS" ] && logstats
+[ "$CACHE" ] && prunecache
+) &
 
 #if [ "$FORMAT" = "copy" ]
 #then
@@ -568,7 +1010,7 @@ then
         if [ "$INCLUDE_CHAT" = "yes" ]
         then
             mkmeta
-            timeout $DEF_TIMEOUT "$SCRIPTBASE/info2.js" "$ID" < $tmpdir/meta > $OUTDIR/info.txt &
+            timeout $DEF_TIMEOUT "$SCRIPTBASE/info2.js" $RANGE_ARGS "$ID" < $tmpdir/meta > $OUTDIR/info.txt &
         else
             timeout $DEF_TIMEOUT "$SCRIPTBASE/info2.js" "$ID" < /dev/null > $OUTDIR/info.txt &
         fi
@@ -578,17 +1020,13 @@ then
         FILES="$FILES info.json"
         if [ "$INCLUDE_CHAT" = "yes" ]
         then
-            timeout $DEF_TIMEOUT "$SCRIPTBASE/info2.js" --json "$ID" < $tmpdir/meta > $OUTDIR/info.json &
+            timeout $DEF_TIMEOUT "$SCRIPTBASE/info2.js" --json $RANGE_ARGS "$ID" < $tmpdir/meta > $OUTDIR/info.json &
         else
             timeout $DEF_TIMEOUT "$SCRIPTBASE/info2.js" --json "$ID" < /dev/null > $OUTDIR/info.json &
         fi
         mkfifo $OUTDIR/meta.json
         FILES="$FILES meta.json"
-        (
-            printf '"meta":['
-            grep -v '"c":"caption"' $tmpdir/meta | sed 's/$/,/'
-            printf 'null]'
-        ) > $OUTDIR/meta.json &
+        timeout $DEF_TIMEOUT "$SCRIPTBASE/info2.js" --meta $RANGE_ARGS < $tmpdir/meta > $OUTDIR/meta.json &
     fi
 fi
        
@@ -599,14 +1037,14 @@ then
     then
         mkfifo $OUTDIR/captions.json
         FILES="$FILES captions.json"
-        timeout $DEF_TIMEOUT "$SCRIPTBASE/vtt.js" -f json -u $ID.ogg.users < $CAPTION_FILE > $OUTDIR/captions.json &
+        timeout $DEF_TIMEOUT "$SCRIPTBASE/vtt.js" -f json $VTT_RANGE_ARGS -u $ID.ogg.users < $CAPTION_FILE > $OUTDIR/captions.json &
     else
         mkfifo $OUTDIR/captions.vtt
         FILES="$FILES captions.vtt"
-        timeout $DEF_TIMEOUT "$SCRIPTBASE/vtt.js" -f vtt -u $ID.ogg.users < $CAPTION_FILE > $OUTDIR/captions.vtt &
+        timeout $DEF_TIMEOUT "$SCRIPTBASE/vtt.js" -f vtt $VTT_RANGE_ARGS -u $ID.ogg.users < $CAPTION_FILE > $OUTDIR/captions.vtt &
         mkfifo $OUTDIR/transcript.txt
         FILES="$FILES transcript.txt"
-        timeout $DEF_TIMEOUT "$SCRIPTBASE/vtt.js" -f txt -u $ID.ogg.users < $CAPTION_FILE > $OUTDIR/transcript.txt &
+        timeout $DEF_TIMEOUT "$SCRIPTBASE/vtt.js" -f txt $VTT_RANGE_ARGS -u $ID.ogg.users < $CAPTION_FILE > $OUTDIR/transcript.txt &
     fi
 fi
 
@@ -636,7 +1074,12 @@ case "$CONTAINER" in
         ;;
 
     *)
-        timeout $DEF_TIMEOUT $NICE zip $ZIPFLAGS -FI - $FILES
+        if [ "$ZIPSTREAM" = "yes" ]
+        then
+            timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/zipstream" -t "$tmpdir" $FILES
+        else
+            timeout $DEF_TIMEOUT $NICE zip $ZIPFLAGS -FI - $FILES
+        fi
         ;;
 esac | (cat || cat > /dev/null)
 
@@ -0,0 +1,698 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Stitch segments split by wavsplit and encoded separately back into one
+ * file, sample-accurately, without decoding them. The format is detected from
+ * the first segment:
+ *
+ * FLAC: The frames are simply renumbered and their CRCs redone. The cuts must
+ * be at multiples of the block size (wavsplit -a 4096 for flac's default), so
+ * that every frame but the last is full. The seek table is dropped, and the
+ * MD5 sum is left unset, since neither can be known without the whole file.
+ *
+ * Ogg Opus: Each segment after the first was encoded with lead-in (wavsplit
+ * -l) from before its cut. Its packets up to the cut (the lead-in and the
+ * encoder's pre-skip) are dropped, as are those after its own end (encoder
+ * padding), and the rest are rewritten with continuous granule positions. The
+ * cuts must be on packet boundaries, which, since the first segment keeps its
+ * pre-skip, are at multiples of the packet duration less the pre-skip, and the
+ * lead-in plus pre-skip must be a multiple of the packet duration too (wavsplit
+ * -a 960 -o 312 -l 1608 for opusenc's 20ms packets and pre-skip of 312). The decoder state at the seams isn't
+ * exactly what it would have been, but with the lead-in priming the encoder,
+ * and the cuts in silence, the difference isn't audible.
+ *
+ * Use: encstitch [-l lead-in] <segment>... > out
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "oggpage.h"
+#include "oggwrite.h"
+
+/* NOTE: This program assumes little-endian for speed. It WILL NOT WORK on a
+ * big-endian system */
+
+// A segment file, mapped
+struct Segment {
+    const char *name;
+    unsigned char *data;
+    size_t size;
+};
+
+struct Segment *segments;
+int segmentCt;
+
+// Map a segment, or die trying
+void mapSegment(struct Segment *seg)
+{
+    struct stat sbuf;
+    int fd = open(seg->name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &sbuf) != 0) {
+        perror(seg->name);
+        exit(1);
+    }
+    seg->size = sbuf.st_size;
+    seg->data = NULL;
+    if (seg->size) {
+        seg->data = mmap(NULL, seg->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (seg->data == MAP_FAILED) {
+            perror(seg->name);
+            exit(1);
+        }
+    }
+    close(fd);
+}
+
+void writeOrDie(const void *buf, size_t size)
+{
+    if (fwrite(buf, 1, size, stdout) != size) {
+        perror("stdout");
+        exit(1);
+    }
+}
+
+/***************************************************************
+ * FLAC
+ **************************************************************/
+
+// A frame of a segment
+struct FlacFrame {
+    int segment;
+    size_t offset, headerSize, size;
+    uint32_t blockSize;
+};
+
+struct FlacFrame *frames = NULL;
+size_t frameCt = 0, frameAlloc = 0;
+
+uint8_t crc8Table[256];
+uint16_t crc16Table[256];
+
+void flacCRCInit(void)
+{
+    for (int i = 0; i < 256; i++) {
+        uint8_t c8 = i;
+        uint16_t c16 = i << 8;
+        for (int j = 0; j < 8; j++) {
+            c8 = (c8 & 0x80) ? (c8 << 1) ^ 0x07 : (c8 << 1);
+            c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x8005 : (c16 << 1);
+        }
+        crc8Table[i] = c8;
+        crc16Table[i] = c16;
+    }
+}
+
+uint8_t flacCRC8(const unsigned char *buf, size_t size)
+{
+    uint8_t crc = 0;
+    while (size--)
+        crc = crc8Table[crc ^ *buf++];
+    return crc;
+}
+
+uint16_t flacCRC16(uint16_t crc, const unsigned char *buf, size_t size)
+{
+    while (size--)
+        crc = (crc << 8) ^ crc16Table[(crc >> 8) ^ *buf++];
+    return crc;
+}
+
+// Size of a UTF-8-style coded number, from its first byte, or 0 if invalid
+int flacNumberSize(unsigned char first)
+{
+    int size = 0;
+    if (!(first & 0x80))
+        return 1;
+    while (size < 8 && (first & (0x80 >> size)))
+        size++;
+    return (size == 1 || size == 8) ? 0 : size;
+}
+
+/* Parse the frame header at buf, of at most size bytes. Returns its size
+ * (including the CRC), or 0 if it isn't a valid frame header. Sets
+ * *blockSize. */
+size_t flacFrameHeader(const unsigned char *buf, size_t size, uint32_t *blockSize)
+{
+    size_t p = 4;
+    int bsCode, srCode, numberSize;
+
+    if (size < 6 || buf[0] != 0xFF || (buf[1] & 0xFE) != 0xF8)
+        return 0;
+    bsCode = buf[2] >> 4;
+    srCode = buf[2] & 0xF;
+    if (!bsCode || srCode == 15 || (buf[3] >> 4) >= 11 ||
+        ((buf[3] >> 1) & 7) == 3 || (buf[3] & 1))
+        return 0;
+
+    // UTF-8-style coded frame or sample number
+    numberSize = flacNumberSize(buf[p]);
+    if (!numberSize)
+        return 0;
+    if (p + numberSize > size)
+        return 0;
+    for (int i = 1; i < numberSize; i++) {
+        if ((buf[p+i] & 0xC0) != 0x80)
+            return 0;
+    }
+    p += numberSize;
+
+    if (bsCode == 1) {
+        *blockSize = 192;
+    } else if (bsCode <= 5) {
+        *blockSize = 576 << (bsCode - 2);
+    } else if (bsCode == 6) {
+        if (p + 1 > size) return 0;
+        *blockSize = buf[p] + 1;
+        p++;
+    } else if (bsCode == 7) {
+        if (p + 2 > size) return 0;
+        *blockSize = ((buf[p] << 8) | buf[p+1]) + 1;
+        p += 2;
+    } else {
+        *blockSize = 256 << (bsCode - 8);
+    }
+
+    if (srCode == 12) p++;
+    else if (srCode == 13 || srCode == 14) p += 2;
+
+    if (p + 1 > size || flacCRC8(buf, p) != buf[p])
+        return 0;
+    return p + 1;
+}
+
+// Write a UTF-8-style coded number. Returns its size.
+size_t flacNumber(unsigned char *buf, uint64_t num)
+{
+    int size;
+    if (num < 0x80) {
+        buf[0] = num;
+        return 1;
+    }
+    for (size = 2; size < 7 && num >= ((uint64_t) 1 << (5 * size + 1)); size++);
+    for (int i = size - 1; i > 0; i--) {
+        buf[i] = 0x80 | (num & 0x3F);
+        num >>= 6;
+    }
+    buf[0] = (size == 7) ? 0xFE : ((0xFF00 >> size) & 0xFF) | num;
+    return size;
+}
+
+void pushFrame(int segment, size_t offset, size_t headerSize, size_t size,
+               uint32_t blockSize)
+{
+    if (frameCt >= frameAlloc) {
+        frameAlloc = frameAlloc ? frameAlloc * 2 : 4096;
+        frames = realloc(frames, frameAlloc * sizeof(struct FlacFrame));
+        if (!frames) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    frames[frameCt].segment = segment;
+    frames[frameCt].offset = offset;
+    frames[frameCt].headerSize = headerSize;
+    frames[frameCt].size = size;
+    frames[frameCt].blockSize = blockSize;
+    frameCt++;
+}
+
+/* Skip the metadata of a FLAC segment, returning the offset of the first
+ * frame, and setting *streamInfo */
+size_t flacMetadata(struct Segment *seg, const unsigned char **streamInfo)
+{
+    size_t p = 4;
+    *streamInfo = NULL;
+    while (1) {
+        uint32_t blockSize;
+        int last;
+        if (p + 4 > seg->size)
+            goto fail;
+        last = seg->data[p] & 0x80;
+        blockSize = (seg->data[p+1] << 16) | (seg->data[p+2] << 8) | seg->data[p+3];
+        if (p + 4 + blockSize > seg->size)
+            goto fail;
+        if ((seg->data[p] & 0x7F) == 0 && blockSize >= 34)
+            *streamInfo = seg->data + p + 4;
+        p += 4 + blockSize;
+        if (last)
+            break;
+    }
+    if (!*streamInfo)
+        goto fail;
+    return p;
+
+fail:
+    fprintf(stderr, "%s: Invalid FLAC metadata\n", seg->name);
+    exit(1);
+}
+
+// Find the frames of a FLAC segment
+void flacFrames(int si)
+{
+    struct Segment *seg = &segments[si];
+    const unsigned char *streamInfo, *firstStreamInfo, *buf = seg->data;
+    size_t p = flacMetadata(seg, &streamInfo), end = seg->size;
+
+    // Sample rate, channels and bits per sample must match
+    flacMetadata(&segments[0], &firstStreamInfo);
+    if (memcmp(streamInfo + 10, firstStreamInfo + 10, 3) ||
+        (streamInfo[13] & 0xF0) != (firstStreamInfo[13] & 0xF0)) {
+        fprintf(stderr, "%s: Format differs from the first segment\n", seg->name);
+        exit(1);
+    }
+
+    while (p < end) {
+        uint32_t blockSize, nextBlockSize;
+        size_t headerSize = flacFrameHeader(buf + p, end - p, &blockSize);
+        size_t q;
+        uint16_t crc;
+
+        if (!headerSize) {
+            fprintf(stderr, "%s: Invalid FLAC frame at %llu\n", seg->name,
+                    (unsigned long long) p);
+            exit(1);
+        }
+
+        /* There's no frame length, so the frame ends where the next valid
+         * frame header starts, if the CRC up to there is right */
+        crc = flacCRC16(0, buf + p, headerSize);
+        for (q = p + headerSize + 2; ; q++) {
+            // crc is of [p, q-2)
+            if (q >= end ||
+                (buf[q] == 0xFF && flacFrameHeader(buf + q, end - q, &nextBlockSize))) {
+                if (crc == ((buf[q-2] << 8) | buf[q-1]))
+                    break;
+            }
+            if (q >= end) {
+                fprintf(stderr, "%s: Truncated FLAC frame at %llu\n", seg->name,
+                        (unsigned long long) p);
+                exit(1);
+            }
+            crc = (crc << 8) ^ crc16Table[(crc >> 8) ^ buf[q-2]];
+        }
+
+        pushFrame(si, p, headerSize, q - p, blockSize);
+        p = q;
+    }
+}
+
+int stitchFlac(void)
+{
+    const unsigned char *streamInfo;
+    unsigned char si[34];
+    size_t firstFrame, p;
+    uint64_t totalSamples = 0, frameNo = 0, sampleNo = 0;
+    uint32_t minBlock = 0, maxBlock = 0;
+    size_t lastBlock = 0;
+
+    flacCRCInit();
+    for (int si = 0; si < segmentCt; si++)
+        flacFrames(si);
+
+    // Every frame but the very last must be the same size
+    for (size_t fi = 0; fi < frameCt; fi++) {
+        struct FlacFrame *frame = &frames[fi];
+        if (fi + 1 < frameCt && fi && frame->blockSize != frames[0].blockSize) {
+            fprintf(stderr, "%s: Short FLAC frame before the end (misaligned cut?)\n",
+                    segments[frame->segment].name);
+            return 1;
+        }
+        totalSamples += frame->blockSize;
+        if (fi + 1 < frameCt || frameCt == 1) {
+            if (!minBlock || frame->blockSize < minBlock)
+                minBlock = frame->blockSize;
+        }
+        if (frame->blockSize > maxBlock)
+            maxBlock = frame->blockSize;
+    }
+
+    // Write the metadata, updating the stream info, and dropping the seek table
+    firstFrame = flacMetadata(&segments[0], &streamInfo);
+    memcpy(si, streamInfo, 34);
+    si[0] = minBlock >> 8;
+    si[1] = minBlock;
+    si[2] = maxBlock >> 8;
+    si[3] = maxBlock;
+    si[13] = (si[13] & 0xF0) | ((totalSamples >> 32) & 0xF);
+    si[14] = totalSamples >> 24;
+    si[15] = totalSamples >> 16;
+    si[16] = totalSamples >> 8;
+    si[17] = totalSamples;
+    memset(si + 18, 0, 16);
+
+    writeOrDie("fLaC", 4);
+    for (p = 4; p < firstFrame; ) {
+        uint32_t blockSize = (segments[0].data[p+1] << 16) |
+            (segments[0].data[p+2] << 8) | segments[0].data[p+3];
+        if ((segments[0].data[p] & 0x7F) != 3)
+            lastBlock = p;
+        p += 4 + blockSize;
+    }
+    for (p = 4; p < firstFrame; ) {
+        unsigned char *block = segments[0].data + p;
+        uint32_t blockSize = (block[1] << 16) | (block[2] << 8) | block[3];
+        int type = block[0] & 0x7F;
+        if (type != 3) {
+            unsigned char header = type | ((p == lastBlock) ? 0x80 : 0);
+            writeOrDie(&header, 1);
+            writeOrDie(block + 1, 3);
+            if (type == 0 && blockSize >= 34) {
+                // Minimum and maximum frame sizes are unknown (0)
+                memset(si + 4, 0, 6);
+                writeOrDie(si, 34);
+                writeOrDie(block + 4 + 34, blockSize - 34);
+            } else {
+                writeOrDie(block + 4, blockSize);
+            }
+        }
+        p += 4 + blockSize;
+    }
+
+    // Then renumber the frames
+    for (size_t fi = 0; fi < frameCt; fi++) {
+        struct FlacFrame *frame = &frames[fi];
+        const unsigned char *buf = segments[frame->segment].data + frame->offset;
+        unsigned char header[32];
+        size_t hp = 4, rest;
+        uint16_t crc;
+
+        size_t numberSize = flacNumberSize(buf[4]);
+
+        // Fixed block size streams number frames, variable number samples
+        memcpy(header, buf, 4);
+        hp += flacNumber(header + hp, (buf[1] & 1) ? sampleNo : frameNo);
+        rest = frame->headerSize - 1 - 4 - numberSize;
+        memcpy(header + hp, buf + 4 + numberSize, rest);
+        hp += rest;
+        header[hp] = flacCRC8(header, hp);
+        hp++;
+
+        crc = flacCRC16(0, header, hp);
+        crc = flacCRC16(crc, buf + frame->headerSize, frame->size - frame->headerSize - 2);
+        writeOrDie(header, hp);
+        writeOrDie(buf + frame->headerSize, frame->size - frame->headerSize - 2);
+        header[0] = crc >> 8;
+        header[1] = crc;
+        writeOrDie(header, 2);
+
+        frameNo++;
+        sampleNo += frame->blockSize;
+    }
+
+    return 0;
+}
+
+/***************************************************************
+ * Ogg Opus
+ **************************************************************/
+
+// Reassembles packets from pages
+struct PacketReader {
+    struct OggReader reader;
+    struct OggPage page;
+    int pageSegment, havePage;
+    unsigned char *buf;
+    size_t size, alloc;
+    uint32_t streamNo;
+};
+
+void packetReaderOpen(struct PacketReader *pr, const char *name)
+{
+    memset(pr, 0, sizeof(*pr));
+    if (oggReaderOpenFile(&pr->reader, name) != 0) {
+        perror(name);
+        exit(1);
+    }
+}
+
+void packetReaderClose(struct PacketReader *pr)
+{
+    oggReaderClose(&pr->reader);
+    free(pr->buf);
+}
+
+// Read the next packet. Returns 1 if there was one, or 0 at the end.
+int readPacket(struct PacketReader *pr)
+{
+    size_t dataOffset;
+    pr->size = 0;
+    while (1) {
+        if (!pr->havePage) {
+            if (!oggReadPage(&pr->reader, &pr->page))
+                return 0;
+            pr->havePage = 1;
+            pr->pageSegment = 0;
+            pr->streamNo = pr->page.header->streamNo;
+        }
+
+        dataOffset = 0;
+        for (int i = 0; i < pr->pageSegment; i++)
+            dataOffset += pr->page.segments[i];
+        while (pr->pageSegment < pr->page.segmentCount) {
+            unsigned char lacing = pr->page.segments[pr->pageSegment++];
+            if (pr->size + lacing > pr->alloc) {
+                pr->alloc = (pr->size + lacing) * 2;
+                pr->buf = realloc(pr->buf, pr->alloc);
+                if (!pr->buf) {
+                    perror("realloc");
+                    exit(1);
+                }
+            }
+            memcpy(pr->buf + pr->size, pr->page.data + dataOffset, lacing);
+            pr->size += lacing;
+            dataOffset += lacing;
+            if (lacing < 255)
+                return 1;
+        }
+        pr->havePage = 0;
+    }
+}
+
+// Duration (at 48kHz) of an Opus packet, from its TOC
+int opusPacketSamples(const unsigned char *buf, size_t size)
+{
+    static const int silkSizes[] = {480, 960, 1920, 2880};
+    int config, frameSize;
+
+    if (!size)
+        return 0;
+    config = buf[0] >> 3;
+    if (config < 12)
+        frameSize = silkSizes[config & 3];
+    else if (config < 16)
+        frameSize = (config & 1) ? 960 : 480;
+    else
+        frameSize = 120 << (config & 3);
+
+    switch (buf[0] & 3) {
+        case 0: return frameSize;
+        case 1:
+        case 2: return frameSize * 2;
+        default: return (size < 2) ? 0 : frameSize * (buf[1] & 0x3F);
+    }
+}
+
+// The pre-skip of this segment, and the granule position of its last page
+void opusSegmentInfo(struct Segment *seg, uint32_t *preSkip, uint64_t *lastGranulePos)
+{
+    struct PacketReader pr;
+    packetReaderOpen(&pr, seg->name);
+    if (!readPacket(&pr) || pr.size < 19 || memcmp(pr.buf, "OpusHead", 8)) {
+        fprintf(stderr, "%s: Not Ogg Opus\n", seg->name);
+        exit(1);
+    }
+    *preSkip = pr.buf[10] | (pr.buf[11] << 8);
+    *lastGranulePos = 0;
+    do {
+        if (pr.page.header->granulePos != (uint64_t) -1)
+            *lastGranulePos = pr.page.header->granulePos;
+    } while (oggReadPage(&pr.reader, &pr.page));
+    packetReaderClose(&pr);
+}
+
+// Write a packet as its own page (or packed with its neighbors)
+void writePacket(struct OggWriter *writer, int type, uint64_t granulePos,
+                 uint32_t streamNo, const unsigned char *data, uint32_t size)
+{
+    struct OggHeader header;
+    header.type = type;
+    header.granulePos = granulePos;
+    header.streamNo = streamNo;
+    header.sequenceNo = 0;
+    header.crc = 0;
+    oggWritePage(writer, &header, data, size);
+}
+
+int stitchOpus(uint64_t leadIn)
+{
+    struct OggWriter writer;
+    uint64_t granulePos = 0;
+    uint32_t streamNo = 0;
+
+    /* The last packet is held back, so that it can be written with the end of
+     * stream flag and the real end time */
+    unsigned char *pending = NULL;
+    size_t pendingSize = 0, pendingAlloc = 0;
+    int havePending = 0;
+
+    if (oggWriterOpen(&writer, 1, 0) != 0) {
+        perror("stdout");
+        return 1;
+    }
+    oggWriterSetPacking(&writer, 0, 0);
+
+    for (int si = 0; si < segmentCt; si++) {
+        struct Segment *seg = &segments[si];
+        struct PacketReader pr;
+        uint32_t preSkip;
+        uint64_t lastGranulePos, start, end, pos = 0;
+        int last = (si == segmentCt - 1);
+
+        opusSegmentInfo(seg, &preSkip, &lastGranulePos);
+
+        /* The part of this segment's decoded timeline that we keep: after the
+         * lead-in and pre-skip (except for the first, which keeps its
+         * pre-skip), to the end of its input */
+        start = si ? leadIn + preSkip : 0;
+        end = lastGranulePos;
+        if (end < start) {
+            fprintf(stderr, "%s: Shorter than its lead-in\n", seg->name);
+            return 1;
+        }
+
+        packetReaderOpen(&pr, seg->name);
+
+        // Headers, from the first segment only
+        for (int hi = 0; hi < 2; hi++) {
+            if (!readPacket(&pr)) {
+                fprintf(stderr, "%s: Missing Opus headers\n", seg->name);
+                return 1;
+            }
+            if (!si) {
+                streamNo = pr.streamNo;
+                writePacket(&writer, hi ? 0 : 2 /* BOS */, 0, streamNo, pr.buf, pr.size);
+            }
+        }
+
+        // Audio
+        while ((pos < end || last) && readPacket(&pr)) {
+            int samples = opusPacketSamples(pr.buf, pr.size);
+
+            if (pos < start) {
+                pos += samples;
+                if (pos > start) {
+                    fprintf(stderr, "%s: Lead-in doesn't end on a packet boundary\n",
+                            seg->name);
+                    return 1;
+                }
+                continue;
+            }
+
+            pos += samples;
+            if (pos > end && !last) {
+                fprintf(stderr, "%s: Cut isn't on a packet boundary\n", seg->name);
+                return 1;
+            }
+
+            if (havePending)
+                writePacket(&writer, 0, granulePos, streamNo, pending, pendingSize);
+            if (pr.size > pendingAlloc) {
+                pendingAlloc = pr.size * 2;
+                pending = realloc(pending, pendingAlloc);
+                if (!pending) {
+                    perror("realloc");
+                    return 1;
+                }
+            }
+            memcpy(pending, pr.buf, pr.size);
+            pendingSize = pr.size;
+            havePending = 1;
+            granulePos += samples;
+        }
+
+        if (last) {
+            // The real end, for trimming the encoder's padding
+            if (pos > end)
+                granulePos -= pos - end;
+            if (havePending)
+                writePacket(&writer, 4 /* EOS */, granulePos, streamNo, pending, pendingSize);
+        } else if (pos < end) {
+            fprintf(stderr, "%s: Ended early\n", seg->name);
+            return 1;
+        }
+
+        packetReaderClose(&pr);
+    }
+
+    oggWriterClose(&writer);
+    free(pending);
+    return 0;
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Use: encstitch [-l lead-in] <segment>... > out\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t leadIn = 0;
+    int ai;
+
+    for (ai = 1; ai < argc && argv[ai][0] == '-'; ai++) {
+        if (!strcmp(argv[ai], "-l") && ai + 1 < argc)
+            leadIn = strtoull(argv[++ai], NULL, 0);
+        else
+            usage();
+    }
+    if (ai >= argc)
+        usage();
+
+    segmentCt = argc - ai;
+    segments = calloc(segmentCt, sizeof(struct Segment));
+    if (!segments) {
+        perror("calloc");
+        return 1;
+    }
+    for (int si = 0; si < segmentCt; si++) {
+        segments[si].name = argv[ai + si];
+        mapSegment(&segments[si]);
+    }
+
+    if (segments[0].size >= 8 + 34 && !memcmp(segments[0].data, "fLaC", 4)) {
+        int ret = stitchFlac();
+        if (fflush(stdout) != 0) {
+            perror("stdout");
+            return 1;
+        }
+        return ret;
+    } else if (segments[0].size >= 27 && !memcmp(segments[0].data, "OggS", 4)) {
+        return stitchOpus(leadIn);
+    }
+
+    fprintf(stderr, "%s: Unrecognized format\n", segments[0].name);
+    return 1;
+}
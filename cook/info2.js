@@ -17,8 +17,12 @@
 
 const fs = require("fs");
 
+const pauses = require("./pauses.js");
+
 let users = {};
 let outJSON = false;
+let outMeta = false;
+let rangeStart = 0, rangeEnd = Infinity;
 for (let ai = 2; ai < process.argv.length; ai++) {
     const arg = process.argv[ai];
     if (arg[0] === "-") {
@@ -26,6 +30,19 @@ for (let ai = 2; ai < process.argv.length; ai++) {
             case "--json":
                 outJSON = true;
                 break;
+
+            case "--meta":
+                // Just the metadata itself (but captions), as JSON
+                outMeta = true;
+                break;
+
+            case "--start":
+                rangeStart = +process.argv[++ai];
+                break;
+
+            case "--end":
+                rangeEnd = +process.argv[++ai];
+                break;
         }
     } else {
         users = JSON.parse("{" +
@@ -56,15 +73,53 @@ async function main() {
     if (meta.length === 1 && meta[0] === "")
         meta = [];
 
-    for (const line of meta) {
+    meta = meta.map(line => {
+        let c = null;
         try {
-            const c = JSON.parse(line);
-            if (!c.d || c.d.c !== "text")
-                continue;
-            if (!info.chat)
-                info.chat = [];
-            info.chat.push({time: c.t / 48000, text: c.d.text});
+            c = JSON.parse(line);
         } catch (ex) {}
+        return {line, c, time: c ? c.t / 48000 : 0};
+    });
+
+    /* Only what's in the range, relative to its start. The range doesn't
+     * count pauses, so nor do these times. */
+    const ranged = (rangeStart || rangeEnd !== Infinity);
+    if (ranged) {
+        const audioTime = pauses(meta.map(x => x.c));
+        meta = meta.filter(x => {
+            if (!x.c)
+                return true;
+            x.time = audioTime(x.time);
+            if (x.time < rangeStart || x.time >= rangeEnd)
+                return false;
+            x.time -= rangeStart;
+            return true;
+        });
+    }
+
+    if (outMeta) {
+        // Everything but captions, including anything we can't parse
+        process.stdout.write("\"meta\":[");
+        for (const {line, c, time} of meta) {
+            if (c ? (c.d && c.d.c === "caption") : line.includes("\"c\":\"caption\""))
+                continue;
+            if (ranged && c) {
+                c.t = Math.round(time * 48000);
+                process.stdout.write(JSON.stringify(c) + ",\n");
+            } else {
+                process.stdout.write(line + ",\n");
+            }
+        }
+        process.stdout.write("null]");
+        return;
+    }
+
+    for (const {c, time} of meta) {
+        if (!c || !c.d || c.d.c !== "text")
+            continue;
+        if (!info.chat)
+            info.chat = [];
+        info.chat.push({time, text: c.d.text});
     }
 
     // Now output
@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Run a list of jobs on a bounded pool of workers, and write their outputs in
+ * order. The first job whose output hasn't been written yet writes straight to
+ * its destination. Each job behind it writes to a temporary file, which is
+ * copied to the job's destination, as it's written, once every job before it
+ * is done. This lets a cook encode several tracks at once, even though the zip
+ * reading them reads one FIFO at a time.
+ *
+ * Jobs are read from stdin, one per line, as <destination>\t<command>. Commands
+ * are run with /bin/sh -c.
+ *
+ * With -u, outputs go straight to their destinations, in no particular order,
+ * for when whatever's reading them (e.g. zipstream) reads them all at once.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct Job {
+    char *dest;
+    char *command;
+
+    // Temporary file with the output, or -1 if it goes straight out
+    int fd;
+
+    /* While the job is running and its output is being copied, a pipe to the
+     * writer, closed to tell it the job is done */
+    int notify;
+
+    pid_t pid;
+    int done, status;
+    double startTime;
+};
+
+static FILE *progress = NULL;
+static int jobCt = 0;
+static int direct = 0;
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// Report progress, if we're asked to
+static void report(const char *stage, int ji, struct Job *job, const char *extra)
+{
+    if (!progress)
+        return;
+    fprintf(progress, "%.3f %s %d/%d %s%s%s\n", now(), stage, ji + 1, jobCt,
+            job->dest, extra ? " " : "", extra ? extra : "");
+    fflush(progress);
+}
+
+// How many workers can we afford, at this much memory per worker?
+static int defaultWorkers(long mbPerJob)
+{
+    cpu_set_t cpus;
+    long workers, memAvailable = -1;
+    FILE *meminfo;
+    char line[256];
+
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+        workers = CPU_COUNT(&cpus);
+    else
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    meminfo = fopen("/proc/meminfo", "r");
+    if (meminfo) {
+        while (fgets(line, sizeof(line), meminfo)) {
+            if (sscanf(line, "MemAvailable: %ld kB", &memAvailable) == 1)
+                break;
+        }
+        fclose(meminfo);
+    }
+    if (memAvailable >= 0 && mbPerJob > 0 &&
+        memAvailable / 1024 / mbPerJob < workers)
+        workers = memAvailable / 1024 / mbPerJob;
+
+    if (workers < 1)
+        workers = 1;
+    return workers;
+}
+
+static void startJob(struct Job *job, const char *tmpDir, int stream)
+{
+    char *name;
+
+    job->notify = -1;
+    if (stream) {
+        // The child opens the destination itself, since it may be a FIFO
+        job->fd = -1;
+        goto run;
+    }
+
+    name = malloc(strlen(tmpDir) + 16);
+    if (!name) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(name, "%s/jobXXXXXX", tmpDir);
+    // Other jobs mustn't inherit it
+    job->fd = mkostemp(name, O_CLOEXEC);
+    if (job->fd < 0) {
+        perror(name);
+        exit(1);
+    }
+    unlink(name);
+    free(name);
+
+run:
+    job->startTime = now();
+    job->pid = fork();
+    if (job->pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (job->pid == 0) {
+        if (stream) {
+            job->fd = open(job->dest, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+            if (job->fd < 0) {
+                perror(job->dest);
+                exit(1);
+            }
+        }
+        dup2(job->fd, 1);
+        close(job->fd);
+        execl("/bin/sh", "sh", "-c", job->command, (char *) NULL);
+        perror("/bin/sh");
+        exit(127);
+    }
+}
+
+/* Copy a job's output to its destination (in a child process). If the job is
+ * still running, keep copying as it writes, until it's done. */
+static pid_t startWriter(struct Job *job)
+{
+    int notify[2] = {-1, -1};
+    pid_t pid;
+
+    if (!job->done && pipe2(notify, O_CLOEXEC) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        static char buf[65536];
+        off_t off = 0;
+        ssize_t ret;
+        int finished = job->done;
+        int out;
+
+        if (notify[1] >= 0)
+            close(notify[1]);
+
+        out = open(job->dest, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+        if (out < 0) {
+            perror(job->dest);
+            exit(1);
+        }
+
+        while (1) {
+            fd_set fds;
+            struct timeval tv;
+
+            // Try to do it all in kernel space
+            while ((ret = sendfile(out, job->fd, &off, 1 << 30)) > 0);
+            if (ret < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                // Do it ourselves
+                lseek(job->fd, off, SEEK_SET);
+                while ((ret = read(job->fd, buf, sizeof(buf))) > 0) {
+                    ssize_t wt = 0, wret;
+                    while (wt < ret) {
+                        wret = write(out, buf + wt, ret - wt);
+                        if (wret <= 0)
+                            exit(1);
+                        wt += wret;
+                    }
+                    off += ret;
+                }
+            }
+            if (ret < 0)
+                exit(1);
+            if (finished)
+                exit(0);
+
+            /* Wait for more. Nothing's written to the pipe, so it's only
+             * readable once it's closed, when the job is done, and then we
+             * just need to copy whatever's left. */
+            FD_ZERO(&fds);
+            FD_SET(notify[0], &fds);
+            tv.tv_sec = 0;
+            tv.tv_usec = 100000;
+            if (select(notify[0] + 1, &fds, NULL, NULL, &tv) > 0)
+                finished = 1;
+        }
+    }
+
+    if (notify[0] >= 0)
+        close(notify[0]);
+    job->notify = notify[1];
+    return pid;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "Use: jobpool [-j <workers>] [-m <MB per worker>] [-p <progress file>]\n"
+        "             [-t <temporary directory>] [-u] < jobs\n"
+        "Each line of jobs is <destination>\\t<command>.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct Job *jobs = NULL;
+    int jobAlloc = 0;
+    long workers = 0, mbPerJob = 512;
+    const char *tmpDir = getenv("TMPDIR");
+    int running = 0, next = 0, nextWrite = 0, failed = 0;
+    pid_t writer = 0;
+    char *line = NULL;
+    size_t lineSz = 0;
+    ssize_t rd;
+    int opt;
+
+    if (!tmpDir || !tmpDir[0])
+        tmpDir = "/tmp";
+
+    while ((opt = getopt(argc, argv, "j:m:p:t:u")) != -1) {
+        switch (opt) {
+            case 'j':
+                workers = atol(optarg);
+                break;
+
+            case 'm':
+                mbPerJob = atol(optarg);
+                break;
+
+            case 'p':
+                progress = fopen(optarg, "a");
+                if (!progress) {
+                    perror(optarg);
+                    return 1;
+                }
+                break;
+
+            case 't':
+                tmpDir = optarg;
+                break;
+
+            case 'u':
+                direct = 1;
+                break;
+
+            default:
+                usage();
+        }
+    }
+    if (workers <= 0)
+        workers = defaultWorkers(mbPerJob);
+
+    // Read in the jobs
+    while ((rd = getline(&line, &lineSz, stdin)) > 0) {
+        char *tab;
+        if (line[rd-1] == '\n')
+            line[--rd] = 0;
+        tab = strchr(line, '\t');
+        if (!tab)
+            continue;
+        *tab = 0;
+
+        if (jobCt >= jobAlloc) {
+            jobAlloc = jobAlloc ? jobAlloc * 2 : 16;
+            jobs = realloc(jobs, jobAlloc * sizeof(struct Job));
+            if (!jobs) {
+                perror("realloc");
+                return 1;
+            }
+        }
+        memset(&jobs[jobCt], 0, sizeof(struct Job));
+        jobs[jobCt].dest = strdup(line);
+        jobs[jobCt].command = strdup(tab + 1);
+        if (!jobs[jobCt].dest || !jobs[jobCt].command) {
+            perror("strdup");
+            return 1;
+        }
+        jobCt++;
+    }
+    free(line);
+
+    if (progress) {
+        fprintf(progress, "%.3f pool %d jobs %ld workers\n", now(), jobCt, workers);
+        fflush(progress);
+    }
+
+    while (nextWrite < jobCt) {
+        int status, ji;
+        pid_t pid;
+
+        // Start whatever we can
+        while (running < workers && next < jobCt) {
+            startJob(&jobs[next], tmpDir, direct || next == nextWrite);
+            report("start", next, &jobs[next], NULL);
+            running++;
+            next++;
+        }
+
+        // Write out the next output as soon as it's started
+        if (!writer && nextWrite < next) {
+            if (jobs[nextWrite].fd < 0) {
+                // Written straight out
+                if (jobs[nextWrite].done) {
+                    nextWrite++;
+                    continue;
+                }
+            } else {
+                writer = startWriter(&jobs[nextWrite]);
+                report("write", nextWrite, &jobs[nextWrite], NULL);
+            }
+        }
+
+        pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("wait");
+            return 1;
+        }
+
+        if (pid == writer) {
+            close(jobs[nextWrite].fd);
+            if (!WIFEXITED(status) || WEXITSTATUS(status))
+                failed = 1;
+            report("written", nextWrite, &jobs[nextWrite], NULL);
+            writer = 0;
+            nextWrite++;
+            continue;
+        }
+
+        for (ji = 0; ji < next; ji++) {
+            if (jobs[ji].pid == pid && !jobs[ji].done) {
+                char extra[64];
+                jobs[ji].done = 1;
+                jobs[ji].status = status;
+                running--;
+                if (jobs[ji].notify >= 0) {
+                    // Let the writer know
+                    close(jobs[ji].notify);
+                    jobs[ji].notify = -1;
+                }
+                if (!WIFEXITED(status) || WEXITSTATUS(status))
+                    failed = 1;
+                snprintf(extra, sizeof(extra), "status=%d time=%.1fs",
+                         WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+                         now() - jobs[ji].startTime);
+                report("done", ji, &jobs[ji], extra);
+                break;
+            }
+        }
+    }
+
+    return failed;
+}
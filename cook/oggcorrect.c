@@ -15,15 +15,23 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/select.h>
+#include <time.h>
 #include <unistd.h>
 
-#include "crc32.h"
+#include "oggindex.h"
+#include "oggpage.h"
+#include "oggstats.h"
+#include "oggwrite.h"
+#include "oggzero.h"
 
 /* NOTE: We don't use libogg here because the behavior of this program is so
  * trivial, the added memory bandwidth of using it is just a waste of energy */
@@ -31,630 +39,2088 @@
 /* NOTE: This program assumes little-endian for speed. It WILL NOT WORK on a
  * big-endian system. */
 
-struct OggPreHeader {
-    unsigned char capturePattern[4];
-    unsigned char version;
-} __attribute__((packed));
-
-struct OggHeader {
-    unsigned char type;
-    uint64_t granulePos;
-    uint32_t streamNo;
-    uint32_t sequenceNo;
-    uint32_t crc;
-} __attribute__((packed));
-
 #define FLAG_BEGIN      1
 #define FLAG_END        2
 #define FLAG_SILENT     4
 #define FLAG_DROP       8
+#define FLAG_TRIMMED    16 // Dropped as silence, rather than for timing
 
-struct PacketList {
-    struct PacketList *next;
-    int flags;
-    int preSkip; // Number of frames to insert before this
+// Is this track a subtrack (with its ID as the first 4 bytes of each packet)?
+#define IS_SUBTRACK(track) ((track)->keepStreamNoSub & 0x80000000)
+
+struct Packet {
     uint64_t inputGranulePos;
     uint64_t outputGranulePos;
+    int preSkip; // Number of frames to insert before this
+    int flags;
 };
 
-// The time (in 48k samples) per packet, which is always 20ms
-const uint32_t packetTime = 960;
-
-/* The encoding for an Opus packet with only zeroes. This is mono, 48k, but
- * that doesn't matter for the Ogg container. */
-const unsigned char zeroPacketOpus[] = { 0xF8, 0xFF, 0xFE };
-
-/* The encoding for a FLAC packet with only zeroes, 48k. Number of channels
- * counts, so we have one for each channel count. Note that this data is
- * generated by flac-zero/flac-zero.sh */
-const unsigned char zeroPacketFLAC48k[][0x2B] = {
-    { 0x0E, 0xFF, 0xF8, 0x7A, 0x0C, 0x00, 0x03, 0xBF, 0x94, 0x00, 0x00, 0x00, 0x00, 0xB1, 0xCA },
-    { 0x12, 0xFF, 0xF8, 0x7A, 0x1C, 0x00, 0x03, 0xBF, 0xF3, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x64, 0x8A },
-    { 0x16, 0xFF, 0xF8, 0x7A, 0x2C, 0x00, 0x03, 0xBF, 0x5A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4A, 0x73 },
-    { 0x1A, 0xFF, 0xF8, 0x7A, 0x3C, 0x00, 0x03, 0xBF, 0x3D, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4A, 0x1A },
-    { 0x1E, 0xFF, 0xF8, 0x7A, 0x4C, 0x00, 0x03, 0xBF, 0x0F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xE2, 0x7D },
-    { 0x22, 0xFF, 0xF8, 0x7A, 0x5C, 0x00, 0x03, 0xBF, 0x68, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1B, 0x3A },
-    { 0x26, 0xFF, 0xF8, 0x7A, 0x6C, 0x00, 0x03, 0xBF, 0xC1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x57, 0x52 },
-    { 0x2A, 0xFF, 0xF8, 0x7A, 0x7C, 0x00, 0x03, 0xBF, 0xA6, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC8, 0xF7 }
+/* In single-pass mode, the packets we keep are stored as we read them, in
+ * memory until there's too much, then in a temporary file. Header pages are
+ * stored as an OggHeader, a uint32_t size, and the data; data packets as the
+ * page type, a uint32_t size, and the data (already stripped of any VAD or
+ * subtrack prefix). */
+struct Store {
+    unsigned char *buf;
+    size_t size, alloc;
+
+    // Once spilled to disk
+    FILE *spill;
+    int mapped;
+
+    // How many header pages are at the start?
+    uint32_t headerCt;
 };
 
-// The encodings for a FLAC packet with only zeroes, 44.1k
-const unsigned char zeroPacketFLAC44k[][0x2B] = {
-    { 0x0E, 0xFF, 0xF8, 0x79, 0x0C, 0x00, 0x03, 0x71, 0x56, 0x00, 0x00, 0x00, 0x00, 0x63, 0xC5 },
-    { 0x12, 0xFF, 0xF8, 0x79, 0x1C, 0x00, 0x03, 0x71, 0x31, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x8C, 0x61 },
-    { 0x16, 0xFF, 0xF8, 0x79, 0x2C, 0x00, 0x03, 0x71, 0x98, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xE7, 0x42 },
-    { 0x1A, 0xFF, 0xF8, 0x79, 0x3C, 0x00, 0x03, 0x71, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xAD, 0xFD },
-    { 0x1E, 0xFF, 0xF8, 0x79, 0x4C, 0x00, 0x03, 0x71, 0xCD, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x83, 0xBC },
-    { 0x22, 0xFF, 0xF8, 0x79, 0x5C, 0x00, 0x03, 0x71, 0xAA, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3F },
-    { 0x26, 0xFF, 0xF8, 0x79, 0x6C, 0x00, 0x03, 0x71, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0B, 0x13 },
-    { 0x2A, 0xFF, 0xF8, 0x79, 0x7C, 0x00, 0x03, 0x71, 0x64, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFD, 0xF8 }
+/* Each output we're producing. Every output is corrected independently, but
+ * they're all corrected in the same pass over the input. */
+struct Track {
+    // Which stream are we keeping?
+    uint32_t keepStreamNo;
+
+    // Which stream are we keeping (for looking for subtrack data)
+    uint32_t keepStreamNoSub;
+
+    // Which subtrack are we keeping?
+    uint32_t keepSubStreamNo;
+
+    /* Are we instead splitting out every subtrack of this stream, each to its
+     * own track, named <outPrefix>-<subtrack>.ogg? */
+    int allSubtracks;
+    const char *outPrefix;
+
+    // Where are we writing it?
+    struct OggWriter out;
+
+    /* If set, the output is being written to outTmpName, and is renamed to
+     * this when it's complete */
+    char *outName, *outTmpName;
+
+    // What was the sequence number of the last packet we wrote?
+    uint32_t lastSequenceNo;
+
+    /* Our packets, in order. The timing model is built and fixed up as an
+     * array, so that the passes over it are sequential in memory. */
+    struct Packet *packets;
+    size_t packetCt, packetAlloc;
+
+    // The next packet to write
+    size_t cur;
+
+    // Stored pages, if we're only reading the input once
+    int storing;
+    struct Store store;
+
+    // VAD info if applicable
+    unsigned char vadLevel;
+
+    // Sample rate if we're doing FLAC
+    uint32_t flacRate;
+
+    // How many channels does the data actually have?
+    unsigned char channels;
+
+    // Zero packet to use, based on format and # of channels
+    const unsigned char *zeroPacket;
+    uint32_t zeroPacketSz;
+
+    /* In follow mode, how many header pages we've written, whether the next
+     * block to correct is silence, and the working granule position */
+    int headers;
+    int nextSilent;
+    double granulePos;
+
+    /* Also in follow mode, set if we've given up on following this track,
+     * because it turned out to be stereo, so its headers were wrong, or its
+     * headers never arrived, or if it's not a track we can correct at all */
+    int abandoned;
+
+    /* What correcting did, for --stats: gap packets inserted, packets dropped
+     * (other than as silence), silent packets trimmed from the start of
+     * blocks, and how often a packet had to be moved later (with a gap) or
+     * earlier (by dropping it) */
+    uint64_t gapPackets, droppedPackets, silenceTrimmed;
+    uint64_t correctedUp, correctedDown;
 };
 
+// The time (in 48k samples) per packet, which is always 20ms
+const uint32_t packetTime = 960;
 
-// Read this amount of data, repeating if needed to do so
-ssize_t readAll(int fd, void *vbuf, size_t count)
-{
-    unsigned char *buf = (unsigned char *) vbuf;
-    ssize_t rd = 0, ret;
-    while (rd < count) {
-        ret = read(fd, buf + rd, count - rd);
-        if (ret <= 0) return ret;
-        rd += ret;
-    }
-    return rd;
-}
+// How much we'll store in memory (across all tracks) before spilling to disk
+size_t storeCap = 256*1024*1024;
+size_t storeTotal = 0;
+
+// Statistics, if asked for
+struct OggStats stats;
+
+/* The range of the recording to correct (in 48k samples, not counting pauses),
+ * from --start and --end. Packets outside of it are skipped, and the output
+ * starts at its start. */
+uint64_t rangeStart = 0, rangeEnd = (uint64_t) -1;
+
+/* Pages of different streams arrive out of order by up to this much (in 48k
+ * samples), so this much more is read either side of the range */
+#define RANGE_SLACK (48000*30)
+
+/* Whether to pack data packets into pages, and the most bytes and
+ * milliseconds to pack into each (0 for the defaults) */
+int pack = 0;
+size_t packSize = 0;
+uint64_t packTime = 0;
+
+/* Where we're reading from. Normally this is just stdin, which has the
+ * headers and data concatenated twice. With an index, we read the header
+ * files, then only those data pages we actually care about, and do that
+ * twice. In the per-stream layout, those pages come from their own streams'
+ * files, so we never even open the others. */
+struct Input {
+    int indexed, perStream;
+    struct OggReader readers[3]; // header1, header2, data (or just stdin)
+    struct OggStreamFiles streams;
+    int file, pass;
+    struct OggIndexEntry *index;
+    size_t indexCt, indexCur;
+};
 
 // Read an Ogg packet
-int readOgg(struct OggPreHeader *preHeader,
-            struct OggHeader *oggHeader,
-            unsigned char **buf,
-            uint32_t *bufSz,
-            uint32_t *packetSize)
+int readInput(struct Input *in,
+              struct OggHeader *oggHeader,
+              unsigned char **buf,
+              uint32_t *packetSize)
 {
-    unsigned char segmentCount, segmentVal;
-
-    // Check the pre-header
-    if (readAll(0, preHeader, sizeof(*preHeader)) != sizeof(*preHeader))
-        return 0;
-    if (memcmp(preHeader->capturePattern, "OggS", 4))
-        return 0;
-
-    // It's an ogg header, get the header data
-    if (readAll(0, oggHeader, sizeof(*oggHeader)) != sizeof(*oggHeader))
-        return 0;
+    struct OggPage page;
 
-    // Get the data size
-    *packetSize = 0;
-    if (readAll(0, &segmentCount, 1) != 1)
-        return 0;
-    for (; segmentCount; segmentCount--) {
-        if (readAll(0, &segmentVal, 1) != 1)
+    if (!in->indexed) {
+        if (!oggReadPage(&in->readers[0], &page))
             return 0;
-        *packetSize += (uint32_t) segmentVal;
-    }
 
-    // Get the data
-    if (*packetSize > *bufSz) {
-        *buf = realloc(*buf, *packetSize);
-        if (!*buf)
+    } else while (1) {
+        if (in->pass >= 2) {
             return 0;
-        *bufSz = *packetSize;
+
+        } else if (in->file < 2) {
+            // Reading a header file
+            if (oggReadPage(&in->readers[in->file], &page))
+                break;
+            in->file++;
+
+        } else if (in->indexCur < in->indexCt) {
+            // Reading a data page from the index
+            struct OggIndexEntry *entry = &in->index[in->indexCur++];
+            struct OggReader *reader = &in->readers[2];
+            if (in->perStream &&
+                !(reader = oggStreamReader(&in->streams, entry->streamNo)))
+                return 0;
+            if (oggReaderSeek(reader, entry->offset) != 0 ||
+                !oggReadPage(reader, &page))
+                return 0;
+            break;
+
+        } else {
+            // Back to the beginning
+            oggReaderSeek(&in->readers[0], 0);
+            oggReaderSeek(&in->readers[1], 0);
+            in->file = 0;
+            in->indexCur = 0;
+            in->pass++;
+
+        }
     }
-    if (readAll(0, *buf, *packetSize) != *packetSize)
-        return 0;
 
+    *oggHeader = *page.header;
+    *buf = page.data;
+    *packetSize = page.packetSize;
     return 1;
 }
 
-ssize_t writeAll(int fd, const void *vbuf, size_t count)
+struct Packet *pushPacket(struct Track *track)
 {
-    const unsigned char *buf = (const unsigned char *) vbuf;
-    ssize_t wt = 0, ret;
-    while (wt < count) {
-        ret = write(fd, buf + wt, count - wt);
-
-        if (ret <= 0) {
-            if (ret < 0 && errno == EAGAIN) {
-                // Wait 'til we can write again
-                fd_set wfds;
-                FD_ZERO(&wfds);
-                FD_SET(fd, &wfds);
-                select(fd + 1, NULL, &wfds, NULL, NULL);
-                continue;
-            }
-
-            perror("write");
-            return ret;
+    struct Packet *ret;
+    if (track->packetCt >= track->packetAlloc) {
+        size_t alloc = track->packetAlloc ? track->packetAlloc * 2 : 4096;
+        struct Packet *packets = realloc(track->packets, alloc * sizeof(struct Packet));
+        if (packets == NULL) {
+            perror("realloc");
+            exit(1);
         }
-        wt += ret;
+        track->packets = packets;
+        track->packetAlloc = alloc;
     }
-    return wt;
+    ret = &track->packets[track->packetCt++];
+    memset(ret, 0, sizeof(*ret));
+    return ret;
 }
 
-void writeOgg(struct OggHeader *header, const unsigned char *data, uint32_t size)
+void preSkip(struct Packet *packet, double *granulePos)
 {
-    static unsigned char seqBuf[256];
-    uint32_t seqCt = 0;
-    uint32_t sizeMod;
-    uint32_t crc;
-
-    // Calculate the sequence info
-    seqBuf[seqCt++] = (size+255)/255;
-    sizeMod = size;
-    while (sizeMod >= 255) {
-        seqBuf[seqCt++] = 255;
-        sizeMod -= 255;
+    if (packet && packet->inputGranulePos > *granulePos) {
+        packet->preSkip = (packet->inputGranulePos - *granulePos) / packetTime;
+        *granulePos += packet->preSkip * packetTime;
     }
-    seqBuf[seqCt++] = sizeMod;
+}
 
-    // Calculate the CRC
-    header->crc = 0;
-    crc = 0xf07159ba; // crc32("OggS\0", 5, &crc);
-    crc32(header, sizeof(*header), &crc);
-    crc32(seqBuf, seqCt, &crc);
-    crc32(data, size, &crc);
-    header->crc = crc;
+// Move a store to a temporary file
+void storeSpill(struct Store *store)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    char *name;
+    int fd;
+
+    if (!tmpdir || !tmpdir[0])
+        tmpdir = "/tmp";
+    name = malloc(strlen(tmpdir) + 20);
+    if (!name) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(name, "%s/oggcorrectXXXXXX", tmpdir);
+    fd = mkstemp(name);
+    if (fd < 0) {
+        perror(name);
+        exit(1);
+    }
+    unlink(name);
+    free(name);
 
-    // Write the header
-    if (writeAll(1, "OggS\0", 5) != 5 ||
-        writeAll(1, header, sizeof(*header)) != sizeof(*header))
+    store->spill = fdopen(fd, "w+");
+    if (!store->spill) {
+        perror("fdopen");
         exit(1);
+    }
+    if (store->size &&
+        fwrite(store->buf, 1, store->size, store->spill) != store->size) {
+        perror("fwrite");
+        exit(1);
+    }
+    storeTotal -= store->size;
+    free(store->buf);
+    store->buf = NULL;
+    store->alloc = 0;
+}
 
-    // Write the sequence info
-    if (writeAll(1, seqBuf, seqCt) != seqCt) exit(1);
+// Add data to a store
+void storeAppend(struct Store *store, const void *data, size_t size)
+{
+    if (!store->spill && storeTotal + size > storeCap)
+        storeSpill(store);
+
+    if (store->spill) {
+        if (size && fwrite(data, 1, size, store->spill) != size) {
+            perror("fwrite");
+            exit(1);
+        }
+        store->size += size;
+        return;
+    }
 
-    // Then write the data
-    if (writeAll(1, data, size) != size) exit(1);
+    if (store->size + size > store->alloc) {
+        size_t alloc = store->alloc ? store->alloc : 65536;
+        unsigned char *buf;
+        while (alloc < store->size + size)
+            alloc *= 2;
+        buf = realloc(store->buf, alloc);
+        if (!buf) {
+            perror("realloc");
+            exit(1);
+        }
+        store->buf = buf;
+        store->alloc = alloc;
+    }
+    memcpy(store->buf + store->size, data, size);
+    store->size += size;
+    storeTotal += size;
 }
 
-struct PacketList *pushPacket(struct PacketList *tail)
+// Copy everything in one store to another
+void storeCopy(struct Store *dst, struct Store *src)
 {
-    struct PacketList *ret = calloc(1, sizeof(struct PacketList));
-    if (ret == NULL) {
-        perror("calloc");
+    static unsigned char buf[65536];
+    off_t off = 0;
+    ssize_t rd;
+
+    if (!src->spill) {
+        storeAppend(dst, src->buf, src->size);
+        return;
+    }
+
+    if (fflush(src->spill) != 0) {
+        perror("fflush");
         exit(1);
     }
-    tail->next = ret;
-    return ret;
+    while (off < src->size) {
+        rd = pread(fileno(src->spill), buf, sizeof(buf), off);
+        if (rd <= 0) {
+            perror("pread");
+            exit(1);
+        }
+        storeAppend(dst, buf, rd);
+        off += rd;
+    }
 }
 
-void preSkip(struct PacketList *packet, double *granulePos)
+// Get a store's data back, to read it
+unsigned char *storeFinish(struct Store *store)
 {
-    if (packet && packet->inputGranulePos > *granulePos) {
-        packet->preSkip = (packet->inputGranulePos - *granulePos) / packetTime;
-        *granulePos += packet->preSkip * packetTime;
+    void *map;
+
+    if (!store->spill || !store->size)
+        return store->buf;
+
+    if (fflush(store->spill) != 0) {
+        perror("fflush");
+        exit(1);
+    }
+    map = mmap(NULL, store->size, PROT_READ|PROT_WRITE, MAP_PRIVATE,
+               fileno(store->spill), 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
     }
+    store->buf = map;
+    store->mapped = 1;
+    return store->buf;
 }
 
-int main(int argc, char **argv)
+// Stop reading a store's data (from storeFinish), so that it can be added to
+void storeUnfinish(struct Store *store)
 {
-    // Which stream are we keeping?
-    uint32_t keepStreamNo;
-
-    // Which stream are we keeping (for looking for subtrack data)
-    uint32_t keepStreamNoSub;
-
-    // Which subtrack are we keeping?
-    uint32_t keepSubStreamNo;
+    if (store->mapped) {
+        munmap(store->buf, store->size);
+        store->buf = NULL;
+        store->mapped = 0;
+    }
+}
 
-    // Meta track info (used for pauses)
-    int foundMeta = 0;
-    uint32_t metaStreamNo = 0;
+void storeFree(struct Store *store)
+{
+    if (store->mapped)
+        munmap(store->buf, store->size);
+    else
+        free(store->buf);
+    if (store->spill)
+        fclose(store->spill);
+    memset(store, 0, sizeof(*store));
+}
 
-    // What should we be subtracting from our granule position?
-    uint64_t granuleOffset = 0;
+// Scan a header packet for the info we need about this track
+void scanHeader(struct Track *track, struct OggHeader *oggHeader,
+                unsigned char *buf, uint32_t packetSize)
+{
+    uint32_t skip;
 
-    // When did we last pause?
-    uint64_t pauseTime = 0;
+    if (oggHeader->streamNo != track->keepStreamNo)
+        return;
 
-    // What was the sequence number of the last packet we wrote?
-    uint32_t lastSequenceNo = 0;
+    if (track->storing) {
+        storeAppend(&track->store, oggHeader, sizeof(*oggHeader));
+        storeAppend(&track->store, &packetSize, sizeof(packetSize));
+        storeAppend(&track->store, buf, packetSize);
+        track->store.headerCt++;
+    }
 
-    // Size of our packet and how many bytes to skip
-    uint32_t packetSize, skip = 0;
+    skip = 0;
+    if (packetSize > 8 && !memcmp(buf, "ECVADD", 6)) {
+        // It's our VAD header. Get our VAD info and skip
+        skip = 8 + *((unsigned short *) (buf + 6));
+        if (packetSize > 10)
+            track->vadLevel = buf[10];
+    }
 
-    // Working granule position
-    double granulePos;
+    if (packetSize < (skip+5) ||
+        (memcmp(buf + skip, "Opus", 4) &&
+         memcmp(buf + skip, "\x7f""FLAC", 5) &&
+         memcmp(buf + skip, "\x04\0\0\x41", 4))) {
+        // This isn't an expected header!
+        return;
+    }
 
-    // Our list of packets
-    struct PacketList head = {0};
-    struct PacketList *cur, *tail = &head;
+    // Check if this is a FLAC header
+    if (packetSize > skip + 29 && !memcmp(buf + skip, "\x7f""FLAC", 5)) {
+        // Get our sample rate
+        track->flacRate = ((uint32_t) buf[skip+27] << 12) + ((uint32_t) buf[skip+28] << 4) + ((uint32_t) buf[skip+29] >> 4);
 
-    // Buffer info
-    unsigned char *buf = NULL;
-    uint32_t bufSz = 0;
+        // Which is what our granule positions will count
+        if (pack && track->flacRate)
+            oggWriterSetPackTime(&track->out, packTime, track->flacRate);
+    }
+}
 
-    // Header
-    struct OggPreHeader preHeader;
-    struct OggHeader oggHeader;
+/* Is this (pause-adjusted) granule position in the range? If so, make it
+ * relative to the range. */
+int inRange(uint64_t *granulePos)
+{
+    if (*granulePos < rangeStart || *granulePos >= rangeEnd)
+        return 0;
+    *granulePos -= rangeStart;
+    return 1;
+}
 
-    // VAD info if applicable
-    unsigned char vadLevel = 0;
+// Adjust the granule offset for a pause or resume on the meta track
+void checkPause(const unsigned char *buf, uint32_t packetSize,
+                uint64_t granulePos, uint64_t *granuleOffset,
+                uint64_t *pauseTime, uint64_t *pauses)
+{
+    if (!strncmp((char *) buf, "{\"c\":\"pause\"}", packetSize)) {
+        // Start of pause
+        *pauseTime = granulePos;
+    } else if (!strncmp((char *) buf, "{\"c\":\"resume\"}", packetSize)) {
+        // End of pause
+        *granuleOffset += granulePos - *pauseTime;
+        (*pauses)++;
+    }
+}
 
-    // Sample rate if we're doing FLAC
-    uint32_t flacRate = 0;
+// Add a data packet to this track's timing model, if it's ours
+void scanPacket(struct Track *track, struct OggHeader *oggHeader,
+                unsigned char *buf, uint32_t packetSize,
+                uint64_t granuleOffset)
+{
+    unsigned char packetCC = 1;
+    struct Packet *packet;
+    uint64_t inputGranulePos;
+    uint32_t skip;
 
-    // How many channels does the data actually have?
-    unsigned char channels = 1;
+    if (oggHeader->streamNo != track->keepStreamNoSub)
+        return;
 
-    // Zero packet to use, based on format and # of channels
-    const unsigned char *zeroPacket = NULL;
-    uint32_t zeroPacketSz = 0;
+    if (IS_SUBTRACK(track) && *((uint32_t *) buf) != track->keepSubStreamNo)
+        return;
 
-    if (argc < 2) {
-        fprintf(stderr, "Use: oggcorrect <track no>\n");
-        exit(1);
-    }
-    keepStreamNo = keepStreamNoSub = atoi(argv[1]);
+    inputGranulePos = (oggHeader->granulePos > granuleOffset) ? oggHeader->granulePos - granuleOffset : 0;
+    if (!inRange(&inputGranulePos))
+        return;
 
-    if (argc > 2) {
-        keepSubStreamNo = atoi(argv[2]);
-        if (keepSubStreamNo)
-            keepStreamNoSub = keepStreamNo | 0x80000000;
-    } else {
-        keepSubStreamNo = 0;
-    }
+    skip = track->vadLevel ? 1 : 0;
+    if (IS_SUBTRACK(track))
+        skip += sizeof(uint32_t); // Substream is kept as first 4 bytes of data
 
-    // First look for the header info
-    while (readOgg(&preHeader, &oggHeader, &buf, &bufSz, &packetSize)) {
-        if (oggHeader.granulePos != 0) {
-            // Not a header
-            granuleOffset = oggHeader.granulePos;
-            break;
+    // Check channel count
+    if (track->flacRate) {
+        /*
+         * buf[0,1] = sync code = 0xFFF8 (ignore last 2 bits)
+         * buf[2] = irrelevant
+         * buf[3] high 4 bits = channel assignment
+         *  Channel assignments over 0x8 are joint stereo
+         */
+        if (packetSize > skip + 3 &&
+            buf[skip] == 0xFF &&
+            (buf[skip + 1] & 0xFC) == 0xF8) {
+            packetCC = buf[skip + 3] >> 4;
+            if (packetCC >= 0x8)
+                packetCC = 2;
+            else
+                packetCC++;
         }
 
-        // Look for a meta track
-        if (!foundMeta && packetSize >= 8 && !memcmp(buf, "ECMETA", 6)) {
-            foundMeta = 1;
-            metaStreamNo = oggHeader.streamNo;
+    } else /* (Opus) */ {
+        /* buf[0] is the TOC, and bit 5 is stereo bit */
+        if (packetSize > skip) {
+            packetCC = (buf[skip] & 0x4) ? 2 : 1;
         }
 
-        if (oggHeader.streamNo != keepStreamNo)
-            continue;
+    }
 
-        skip = 0;
-        if (packetSize > 8 && !memcmp(buf, "ECVADD", 6)) {
-            // It's our VAD header. Get our VAD info and skip
-            skip = 8 + *((unsigned short *) (buf + 6));
-            if (packetSize > 10)
-                vadLevel = buf[10];
-        }
+    if (packetCC > track->channels)
+        track->channels = packetCC;
 
-        if (packetSize < (skip+5) ||
-            (memcmp(buf + skip, "Opus", 4) &&
-             memcmp(buf + skip, "\x7f""FLAC", 5) &&
-             memcmp(buf + skip, "\x04\0\0\x41", 4))) {
-            // This isn't an expected header!
-            continue;
-        }
+    if (track->storing) {
+        uint32_t storeSize = (packetSize > skip) ? packetSize - skip : 0;
+        storeAppend(&track->store, &oggHeader->type, 1);
+        storeAppend(&track->store, &storeSize, sizeof(storeSize));
+        storeAppend(&track->store, buf + skip, storeSize);
+    }
 
-        // Check if this is a FLAC header
-        if (packetSize > skip + 29 && !memcmp(buf + skip, "\x7f""FLAC", 5)) {
-            // Get our sample rate
-            flacRate = ((uint32_t) buf[skip+27] << 12) + ((uint32_t) buf[skip+28] << 4) + ((uint32_t) buf[skip+29] >> 4);
+    // Add it to the list
+    packet = pushPacket(track);
+    packet->inputGranulePos = inputGranulePos;
+
+    // Check if it's silent
+    if (track->vadLevel) {
+        unsigned char pktVad = buf[0];
+        if (IS_SUBTRACK(track))
+            pktVad = buf[sizeof(uint32_t)];
+        if (pktVad < track->vadLevel) {
+            // Silent
+            packet->flags |= FLAG_SILENT;
         }
+    } else {
+        // Silly detection
+        if (packetSize - skip < (track->flacRate?16:8))
+            packet->flags |= FLAG_SILENT;
     }
+}
 
-    skip = vadLevel ? 1 : 0;
-    if (keepSubStreamNo)
-        skip += sizeof(uint32_t); // Substream is kept as first 4 bytes of data
-
-    // Now get the actual packet info
-    do {
-        unsigned char packetCC = 1;
+/* Open an output file. A regular file is written under a temporary name, and
+ * only renamed into place by finishTrack, so that anything waiting for it can
+ * tell when it's complete. */
+int openOutput(struct Track *track, const char *name)
+{
+    struct stat sbuf;
+    int fd;
 
-        if (oggHeader.granulePos == 0) {
-            // We've come back to the header, so break out
-            break;
-        }
+    if (stat(name, &sbuf) == 0 && !S_ISREG(sbuf.st_mode)) {
+        fd = open(name, O_WRONLY);
 
-        // Check for pauses and adjust
-        if (foundMeta && oggHeader.streamNo == metaStreamNo) {
-            if (!strncmp((char *) buf, "{\"c\":\"pause\"}", packetSize)) {
-                // Start of pause
-                pauseTime = oggHeader.granulePos;
-            } else if (!strncmp((char *) buf, "{\"c\":\"resume\"}", packetSize)) {
-                // End of pause
-                granuleOffset += oggHeader.granulePos - pauseTime;
-            }
+    } else {
+        track->outName = strdup(name);
+        track->outTmpName = malloc(strlen(name) + 5);
+        if (!track->outName || !track->outTmpName) {
+            perror("malloc");
+            exit(1);
         }
+        sprintf(track->outTmpName, "%s.tmp", name);
+        name = track->outTmpName;
+        fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0666);
 
-        if (oggHeader.streamNo != keepStreamNoSub)
-            continue;
-
-        if (keepSubStreamNo && *((uint32_t *) buf) != keepSubStreamNo)
-            continue;
+    }
 
-        // Check channel count
-        if (flacRate) {
-            /*
-             * buf[0,1] = sync code = 0xFFF8 (ignore last 2 bits)
-             * buf[2] = irrelevant
-             * buf[3] high 4 bits = channel assignment
-             *  Channel assignments over 0x8 are joint stereo
-             */
-            if (packetSize > skip + 3 &&
-                buf[skip] == 0xFF &&
-                (buf[skip + 1] & 0xFC) == 0xF8) {
-                packetCC = buf[skip + 3] >> 4;
-                if (packetCC >= 0x8)
-                    packetCC = 2;
-                else
-                    packetCC++;
-            }
+    if (fd < 0) {
+        perror(name);
+        exit(1);
+    }
+    return fd;
+}
 
-        } else /* (Opus) */ {
-            /* buf[0] is the TOC, and bit 5 is stereo bit */
-            if (packetSize > skip) {
-                packetCC = (buf[skip] & 0x4) ? 2 : 1;
-            }
+/* If this packet is from a subtrack we're splitting out but haven't seen yet,
+ * add a track for it, based on the splitting track. The new track is added at
+ * the end of the list, so will see this packet itself. */
+void findSubtrack(struct Track **tracks, int *trackCt, int *trackAlloc, int ti,
+                  struct OggHeader *oggHeader, unsigned char *buf,
+                  uint32_t packetSize, size_t flushAt)
+{
+    struct Track *parent = &(*tracks)[ti], *track;
+    uint32_t subStreamNo;
+    char *name;
+    int fd;
+
+    if (oggHeader->streamNo != parent->keepStreamNoSub ||
+        packetSize < sizeof(uint32_t))
+        return;
+    subStreamNo = *((uint32_t *) buf);
+
+    for (int si = ti + 1; si < *trackCt; si++) {
+        track = &(*tracks)[si];
+        if (!track->allSubtracks &&
+            track->keepStreamNoSub == parent->keepStreamNoSub &&
+            track->keepSubStreamNo == subStreamNo &&
+            track->outPrefix == parent->outPrefix)
+            return;
+    }
 
+    // It's new, so make a track for it
+    if (*trackCt >= *trackAlloc) {
+        *trackAlloc *= 2;
+        *tracks = realloc(*tracks, *trackAlloc * sizeof(struct Track));
+        if (!*tracks) {
+            perror("realloc");
+            exit(1);
         }
+        parent = &(*tracks)[ti];
+    }
+    track = &(*tracks)[(*trackCt)++];
+    memset(track, 0, sizeof(*track));
 
-        if (packetCC > channels)
-            channels = packetCC;
+    name = malloc(strlen(parent->outPrefix) + 16);
+    if (!name) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(name, "%s-%u.ogg", parent->outPrefix, subStreamNo);
+    fd = openOutput(track, name);
+    free(name);
+    if (oggWriterOpen(&track->out, fd, flushAt) != 0) {
+        perror("malloc");
+        exit(1);
+    }
+    track->keepStreamNo = parent->keepStreamNo;
+    track->keepStreamNoSub = parent->keepStreamNoSub;
+    track->keepSubStreamNo = subStreamNo;
+    track->outPrefix = parent->outPrefix;
+    track->vadLevel = parent->vadLevel;
+    track->flacRate = parent->flacRate;
+    if (pack) {
+        oggWriterSetPacking(&track->out, packSize, 0);
+        oggWriterSetPackTime(&track->out, packTime,
+                             track->flacRate ? track->flacRate : 48000);
+    }
+    track->channels = 1;
 
-        // Add it to the list
-        tail = pushPacket(tail);
-        tail->inputGranulePos = (oggHeader.granulePos > granuleOffset) ? oggHeader.granulePos - granuleOffset : 0;
+    // The headers were stored before we knew about this subtrack
+    track->storing = parent->storing;
+    if (track->storing) {
+        storeCopy(&track->store, &parent->store);
+        track->store.headerCt = parent->store.headerCt;
+    }
+}
 
-        // Check if it's silent
-        if (vadLevel) {
-            unsigned char pktVad = buf[0];
-            if (keepSubStreamNo)
-                pktVad = buf[sizeof(uint32_t)];
-            if (pktVad < vadLevel) {
-                // Silent
-                tail->flags |= FLAG_SILENT;
-            }
-        } else {
-            // Silly detection
-            if (packetSize - skip < (flacRate?16:8))
-                tail->flags |= FLAG_SILENT;
-        }
+// Build the corrected timeline for this track
+void correctTrack(struct Track *track)
+{
+    struct Packet *packets = track->packets;
+    size_t ct = track->packetCt, cur;
 
-    } while (readOgg(&preHeader, &oggHeader, &buf, &bufSz, &packetSize));
+    // Working granule position
+    double granulePos;
 
     // Now, find ranges of audio that ought to be continuous
-    for (cur = head.next; cur; cur = cur->next) {
-        cur->flags |= FLAG_BEGIN;
+    for (cur = 0; cur < ct; cur++) {
+        packets[cur].flags |= FLAG_BEGIN;
 
         // Look for a gap or silence to end this block
-        for (; cur->next; cur = cur->next) {
-            if (cur->next->flags & FLAG_SILENT) {
+        for (; cur + 1 < ct; cur++) {
+            if (packets[cur+1].flags & FLAG_SILENT) {
                 // Gap of silence
                 break;
-            } else if (cur->next->inputGranulePos > cur->inputGranulePos + packetTime * 25) {
+            } else if (packets[cur+1].inputGranulePos > packets[cur].inputGranulePos + packetTime * 25) {
                 // Significant gap in timestamps
                 break;
             }
         }
-        cur->flags |= FLAG_END;
+        packets[cur].flags |= FLAG_END;
 
         // If this is silence, make a silent block
-        if (cur->next && cur->next->flags & FLAG_SILENT) {
-            cur = cur->next;
-            cur->flags |= FLAG_BEGIN;
-            for (; cur->next; cur = cur->next) {
-                if (!(cur->next->flags & FLAG_SILENT))
+        if (cur + 1 < ct && packets[cur+1].flags & FLAG_SILENT) {
+            cur++;
+            packets[cur].flags |= FLAG_BEGIN;
+            for (; cur + 1 < ct; cur++) {
+                if (!(packets[cur+1].flags & FLAG_SILENT))
                     break;
             }
-            cur->flags |= FLAG_END;
+            packets[cur].flags |= FLAG_END;
         }
     }
 
     // Adjust timestamps for the blocks
-    cur = head.next;
     granulePos = packetTime;
-    preSkip(cur, &granulePos);
-    for (; cur; cur = cur->next) {
-        struct PacketList *begin, *end, *mid;
-        int ct;
+    preSkip(ct ? &packets[0] : NULL, &granulePos);
+    for (cur = 0; cur < ct; cur++) {
+        size_t begin, end, mid;
+        int blockCt;
 
         // We should be at the beginning of a block. Find the end
         begin = cur;
-        ct = 0;
-        for (end = begin; end; end = end->next) {
-            ct++;
-            if (end->flags & FLAG_END)
+        blockCt = 0;
+        for (end = begin; end < ct; end++) {
+            blockCt++;
+            if (packets[end].flags & FLAG_END)
                 break;
         }
-        if (!end)
+        if (end >= ct)
             break;
 
         // Check the difference between the expected range and the actual range
-        double expected = granulePos + ct * packetTime;
+        double expected = granulePos + blockCt * packetTime;
         /* + 2 packets: 1 for the length of the packet, 1 for the gap at the
          * beginning */
-        double actual = end->inputGranulePos + packetTime * 2;
-        if (actual < expected && (begin->flags & FLAG_SILENT)) {
+        double actual = packets[end].inputGranulePos + packetTime * 2;
+        if (actual < expected && (packets[begin].flags & FLAG_SILENT)) {
             // Cut out silence from the beginning
             while (actual < expected) {
-                if (begin->preSkip) {
-                    begin->preSkip--;
+                if (packets[begin].preSkip) {
+                    packets[begin].preSkip--;
                     expected -= packetTime;
                     if (granulePos > packetTime)
                         granulePos -= packetTime;
                     else
                         granulePos = 0;
                 } else if (begin != end) {
-                    begin->flags |= FLAG_DROP;
+                    packets[begin].flags |= FLAG_DROP | FLAG_TRIMMED;
                     expected -= packetTime;
-                    begin = begin->next;
+                    begin++;
                 } else break;
+                track->silenceTrimmed++;
             }
         }
 
         // Set the output granule positions
-        for (mid = begin; mid != end->next; mid = mid->next) {
+        for (mid = begin; mid <= end; mid++) {
+            struct Packet *packet = &packets[mid];
             if (granulePos + packetTime * 25 <
-                mid->inputGranulePos) {
+                packet->inputGranulePos) {
                 // Too little data, add a gap
-                int64_t diff = mid->inputGranulePos - granulePos;
-                mid->preSkip = diff / packetTime;
-                granulePos += mid->preSkip * packetTime;
-                mid->outputGranulePos = granulePos;
+                int64_t diff = packet->inputGranulePos - granulePos;
+                track->correctedUp++;
+                packet->preSkip = diff / packetTime;
+                granulePos += packet->preSkip * packetTime;
+                packet->outputGranulePos = granulePos;
                 granulePos += packetTime;
 
             } else if (granulePos >
-                mid->inputGranulePos + packetTime * 25) {
+                packet->inputGranulePos + packetTime * 25) {
                 // Too much data, drop a packet
-                mid->flags |= FLAG_DROP;
+                packet->flags |= FLAG_DROP;
+                track->correctedDown++;
 
             } else {
                 // Just right!
-                mid->outputGranulePos = granulePos;
+                packet->outputGranulePos = granulePos;
                 granulePos += packetTime;
 
             }
         }
 
         // And adjust for any skip at the end
-        preSkip(mid, &granulePos);
+        preSkip((mid < ct) ? &packets[mid] : NULL, &granulePos);
         cur = end;
     }
 
     // If we're FLAC 44100kHz, adjust the granule positions for that
-    if (flacRate == 44100) {
-        for (cur = head.next; cur; cur = cur->next)
-            cur->outputGranulePos = cur->outputGranulePos * 147 / 160;
+    if (track->flacRate == 44100) {
+        for (cur = 0; cur < ct; cur++)
+            packets[cur].outputGranulePos = packets[cur].outputGranulePos * 147 / 160;
     }
 
     // Choose a zero packet
-    switch (flacRate) {
-        case 0: // Opus
-            zeroPacket = zeroPacketOpus;
-            zeroPacketSz = sizeof(zeroPacketOpus);
-            break;
+    track->zeroPacket = oggZeroPacket(track->flacRate, track->channels,
+                                      &track->zeroPacketSz);
 
-        case 44100:
-            zeroPacket = zeroPacketFLAC44k[channels - 1];
-            zeroPacketSz = zeroPacket[0];
-            zeroPacket++;
-            break;
+    track->cur = 0;
+}
 
-        default: // FLAC 48k
-            zeroPacket = zeroPacketFLAC48k[channels - 1];
-            zeroPacketSz = zeroPacket[0];
-            zeroPacket++;
-            break;
+// Pass through a header packet, if it's ours
+void writeHeader(struct Track *track, struct OggHeader *inHeader,
+                 unsigned char *buf, uint32_t packetSize)
+{
+    struct OggHeader oggHeader = *inHeader;
+    unsigned char *copy = NULL;
+    uint32_t skip;
+
+    if (oggHeader.streamNo != track->keepStreamNo)
+        return;
+
+    skip = 0;
+    if (packetSize > 8 && !memcmp(buf, "ECVADD", 6)) {
+        // It's our VAD header, so skip that
+        skip = 8 + *((unsigned short *) (buf + 6));
     }
 
-    // Now read and pass thru the header
-    do {
-        if (oggHeader.granulePos != 0) {
-            // Passed the header
-            break;
+    /* Possibly adjust channel count. The header is shared with any other
+     * tracks of the same stream, so this is done in a copy. */
+    if (track->channels > 1) {
+        copy = malloc(packetSize);
+        if (!copy) {
+            perror("malloc");
+            exit(1);
         }
+        memcpy(copy, buf, packetSize);
+        buf = copy;
 
-        if (oggHeader.streamNo != keepStreamNo)
-            continue;
+        if (track->flacRate) {
+            /*
+             * buf[0-4] = Ogg FLAC header = 0x7f FLAC
+             * buf[5-8] = irrelevant
+             * buf[9-12] = FLAC stream marker = fLaC
+             * buf[13] = metadata block type (ignore first bit) = 0
+             * buf[14-28] = irrelevant
+             * buf[29]
+             *  bits 0-3 = last bits of sample rate (irrelevant)
+             *  bits 4-6 = number of channels minus 1
+             *  bit    7 = first bit of bits per sample (irrelevant)
+             */
+            if (packetSize > skip + 29 &&
+                !memcmp(buf + skip, "\x7f""FLAC", 5) &&
+                !memcmp(buf + skip + 9, "fLaC", 4) &&
+                (buf[skip + 13] & 0x7F) == 0) {
+                buf[skip + 29] =
+                    (buf[skip + 29] & 0xF1) |
+                    ((track->channels - 1) << 1);
+            }
+
+        } else /* (Opus) */ {
+            /*
+             * buf[0-7] = magic signature = OpusHead
+             * buf[8] = irrelevant
+             * buf[9] = channel count
+             */
+            if (packetSize > skip + 9 &&
+                !memcmp(buf + skip, "OpusHead", 8)) {
+                buf[skip + 9] = track->channels;
+            }
 
-        skip = 0;
-        if (packetSize > 8 && !memcmp(buf, "ECVADD", 6)) {
-            // It's our VAD header, so skip that
-            skip = 8 + *((unsigned short *) (buf + 6));
         }
+    }
 
-        // Possibly adjust channel count
-        if (channels > 1) {
-            if (flacRate) {
-                /*
-                 * buf[0-4] = Ogg FLAC header = 0x7f FLAC
-                 * buf[5-8] = irrelevant
-                 * buf[9-12] = FLAC stream marker = fLaC
-                 * buf[13] = metadata block type (ignore first bit) = 0
-                 * buf[14-28] = irrelevant
-                 * buf[29]
-                 *  bits 0-3 = last bits of sample rate (irrelevant)
-                 *  bits 4-6 = number of channels minus 1
-                 *  bit    7 = first bit of bits per sample (irrelevant)
-                 */
-                if (packetSize > skip + 29 &&
-                    !memcmp(buf + skip, "\x7f""FLAC", 5) &&
-                    !memcmp(buf + skip + 9, "fLaC", 4) &&
-                    (buf[skip + 13] & 0x7F) == 0) {
-                    buf[skip + 29] =
-                        (buf[skip + 29] & 0xF1) |
-                        ((channels - 1) << 1);
-                }
+    // Pass through the normal header
+    oggHeader.sequenceNo = track->lastSequenceNo++;
+    oggWritePage(&track->out, &oggHeader, buf + skip, packetSize - skip);
+    free(copy);
+}
 
-            } else /* (Opus) */ {
-                /*
-                 * buf[0-7] = magic signature = OpusHead
-                 * buf[8] = irrelevant
-                 * buf[9] = channel count
-                 */
-                if (packetSize > skip + 9 &&
-                    !memcmp(buf + skip, "OpusHead", 8)) {
-                    buf[skip + 9] = channels;
-                }
+/* FLAC in ffmpeg is picky about channel counts, so throw in a zero packet
+ * right at the start */
+void writeInitialZero(struct Track *track)
+{
+    struct OggHeader zeroHeader = {0};
+    zeroHeader.granulePos = (track->flacRate == 44100) ? (packetTime * 147 / 160) : packetTime;
+    zeroHeader.streamNo = track->keepStreamNo;
+    zeroHeader.sequenceNo = track->lastSequenceNo++;
+    oggWritePage(&track->out, &zeroHeader, track->zeroPacket, track->zeroPacketSz);
+}
 
-            }
+// Write a data packet, with any gap before it, at its corrected timestamp
+void emitPacket(struct Track *track, struct OggHeader *oggHeader,
+                const unsigned char *data, uint32_t size)
+{
+    struct Packet *cur = &track->packets[track->cur];
+
+    // Add any gaps
+    if (cur->preSkip) {
+        struct OggHeader gapHeader = {0};
+        uint32_t time = (track->flacRate == 44100) ? (packetTime * 147 / 160) : packetTime;
+        gapHeader.type = 0;
+        gapHeader.granulePos = cur->outputGranulePos - time * cur->preSkip;
+        gapHeader.streamNo = track->keepStreamNo;
+
+        track->gapPackets += cur->preSkip;
+        for (int i = 0; i < cur->preSkip; i++) {
+            gapHeader.sequenceNo = track->lastSequenceNo++;
+            oggWritePage(&track->out, &gapHeader, track->zeroPacket, track->zeroPacketSz);
+            gapHeader.granulePos += time;
         }
+    }
 
-        // Pass through the normal header
-        oggHeader.sequenceNo = lastSequenceNo++;
-        writeOgg(&oggHeader, buf + skip, packetSize - skip);
+    // Then insert the current packet
+    if (!(cur->flags & FLAG_DROP)) {
+        oggHeader->streamNo = track->keepStreamNo;
+        oggHeader->granulePos = cur->outputGranulePos;
+        oggHeader->sequenceNo = track->lastSequenceNo++;
+        oggWritePage(&track->out, oggHeader, data, size);
+    } else if (!(cur->flags & FLAG_TRIMMED)) {
+        // (Trimmed silence is counted as such)
+        track->droppedPackets++;
+    }
 
-    } while (readOgg(&preHeader, &oggHeader, &buf, &bufSz, &packetSize));
+    if (track->cur + 1 < track->packetCt)
+        track->cur++;
+}
 
-    skip = vadLevel ? 1 : 0;
-    if (keepSubStreamNo)
-        skip += sizeof(uint32_t);
+// Pass through a data packet with corrected timestamps, if it's ours
+void writePacket(struct Track *track, struct OggHeader *inHeader,
+                 unsigned char *buf, uint32_t packetSize,
+                 uint64_t granuleOffset)
+{
+    struct OggHeader oggHeader = *inHeader;
+    uint64_t inputGranulePos;
+    uint32_t skip;
 
-    // FLAC in ffmpeg is picky about channel counts, so throw in a zero packet right at the start
-    {
-        struct OggHeader zeroHeader = {0};
-        zeroHeader.granulePos = (flacRate == 44100) ? (packetTime * 147 / 160) : packetTime;
-        zeroHeader.streamNo = keepStreamNo;
-        zeroHeader.sequenceNo = lastSequenceNo++;
-        writeOgg(&zeroHeader, zeroPacket, zeroPacketSz);
-    }
+    if (oggHeader.streamNo != track->keepStreamNoSub)
+        return;
 
-    // And finally, pass thru the data with corrected timestamps
-    cur = head.next;
-    do {
-        if (oggHeader.streamNo != keepStreamNoSub)
-            continue;
+    if (IS_SUBTRACK(track) && *((uint32_t *) buf) != track->keepSubStreamNo)
+        return;
 
-        if (keepSubStreamNo && *((uint32_t *) buf) != keepSubStreamNo)
-            continue;
+    // Skip exactly what scanPacket skipped
+    inputGranulePos = (oggHeader.granulePos > granuleOffset) ? oggHeader.granulePos - granuleOffset : 0;
+    if (!inRange(&inputGranulePos))
+        return;
 
-        // Add any gaps
-        if (cur->preSkip) {
-            struct OggHeader gapHeader = {0};
-            uint32_t time = (flacRate == 44100) ? (packetTime * 147 / 160) : packetTime;
-            gapHeader.type = 0;
-            gapHeader.granulePos = cur->outputGranulePos - time * cur->preSkip;
-            gapHeader.streamNo = keepStreamNo;
-
-            for (int i = 0; i < cur->preSkip; i++) {
-                gapHeader.sequenceNo = lastSequenceNo++;
-                writeOgg(&gapHeader, zeroPacket, zeroPacketSz);
-                gapHeader.granulePos += time;
-            }
-        }
+    skip = track->vadLevel ? 1 : 0;
+    if (IS_SUBTRACK(track))
+        skip += sizeof(uint32_t);
 
-        // Then insert the current packet
-        if (!(cur->flags & FLAG_DROP)) {
-            oggHeader.streamNo = keepStreamNo;
-            oggHeader.granulePos = cur->outputGranulePos;
-            oggHeader.sequenceNo = lastSequenceNo++;
-            writeOgg(&oggHeader, buf + skip, packetSize - skip);
-        }
+    emitPacket(track, &oggHeader, buf + skip, packetSize - skip);
+}
 
-        cur = cur->next ? cur->next : cur;
+// Write a track entirely from its store
+void writeStored(struct Track *track)
+{
+    unsigned char *buf = storeFinish(&track->store);
+    size_t off = 0, end = track->store.size;
+    uint32_t i, size;
+
+    // Headers
+    for (i = 0; i < track->store.headerCt; i++) {
+        struct OggHeader oggHeader;
+        memcpy(&oggHeader, buf + off, sizeof(oggHeader));
+        memcpy(&size, buf + off + sizeof(oggHeader), sizeof(size));
+        off += sizeof(oggHeader) + sizeof(size);
+        writeHeader(track, &oggHeader, buf + off, size);
+        off += size;
+    }
 
-    } while (readOgg(&preHeader, &oggHeader, &buf, &bufSz, &packetSize));
+    writeInitialZero(track);
 
-    if (lastSequenceNo <= 2) {
-        // This track had no actual audio. To avoid breakage, throw some on.
+    // And the data
+    while (off < end) {
         struct OggHeader oggHeader = {0};
-        oggHeader.streamNo = keepStreamNo;
-        oggHeader.sequenceNo = lastSequenceNo++;
-        writeOgg(&oggHeader, zeroPacket, zeroPacketSz);
+        oggHeader.type = buf[off];
+        memcpy(&size, buf + off + 1, sizeof(size));
+        off += 1 + sizeof(size);
+        emitPacket(track, &oggHeader, buf + off, size);
+        off += size;
+    }
+
+    storeFree(&track->store);
+}
+
+// Finish off a track
+void finishTrack(struct Track *track)
+{
+    if (track->lastSequenceNo <= 2) {
+        // This track had no actual audio. To avoid breakage, throw some on.
+        struct OggHeader oggHeader = {0};
+        oggHeader.streamNo = track->keepStreamNo;
+        oggHeader.sequenceNo = track->lastSequenceNo++;
+        oggWritePage(&track->out, &oggHeader, track->zeroPacket, track->zeroPacketSz);
+    }
+
+    oggWriterClose(&track->out);
+    if (track->out.fd != 1)
+        close(track->out.fd);
+    if (track->outName) {
+        if (rename(track->outTmpName, track->outName) != 0) {
+            perror(track->outName);
+            exit(1);
+        }
+        free(track->outName);
+        free(track->outTmpName);
+    }
+    free(track->packets);
+}
+
+// Open an input file, or die trying
+void openOrDie(struct OggReader *reader, const char *prefix, const char *footer)
+{
+    char *name = malloc(strlen(prefix) + strlen(footer) + 1);
+    if (!name) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(name, "%s%s", prefix, footer);
+    if (oggReaderOpenFile(reader, name) != 0) {
+        perror(name);
+        exit(1);
+    }
+    free(name);
+}
+
+/* Find the part of the index (from *lo to *hi) covering the range. The range
+ * doesn't count pauses, so the meta track's pages are read to find them. */
+void indexRange(struct Input *in, int foundMeta, uint32_t metaStreamNo,
+                size_t *lo, size_t *hi)
+{
+    uint64_t granuleOffset = 0, pauseTime = 0, pauses = 0;
+    uint64_t rawStart = 0, rawEnd = 0;
+    int foundStart = 0, foundEnd = (rangeEnd == (uint64_t) -1);
+    size_t ei;
+
+    for (ei = 0; ei < in->indexCt; ei++) {
+        struct OggIndexEntry *entry = &in->index[ei];
+        struct OggReader *reader = &in->readers[2];
+        struct OggPage page;
+        uint64_t before = granuleOffset;
+
+        if (!granuleOffset) {
+            granuleOffset = entry->granulePos;
+            continue;
+        }
+        if (!foundMeta || entry->streamNo != metaStreamNo)
+            continue;
+
+        if (in->perStream &&
+            !(reader = oggStreamReader(&in->streams, entry->streamNo)))
+            break;
+        if (oggReaderSeek(reader, entry->offset) != 0 ||
+            !oggReadPage(reader, &page))
+            break;
+        checkPause(page.data, page.packetSize, entry->granulePos,
+                   &granuleOffset, &pauseTime, &pauses);
+
+        // A pause ended, so everything before it is at a known offset
+        if (granuleOffset != before) {
+            if (!foundStart && pauseTime - before >= rangeStart) {
+                rawStart = rangeStart + before;
+                foundStart = 1;
+            }
+            if (!foundEnd && pauseTime - before >= rangeEnd) {
+                rawEnd = rangeEnd + before;
+                foundEnd = 1;
+            }
+        }
+    }
+    if (!foundStart)
+        rawStart = rangeStart + granuleOffset;
+    if (!foundEnd)
+        rawEnd = rangeEnd + granuleOffset;
+
+    *lo = oggIndexBisect(in->index, in->indexCt,
+                         (rawStart > RANGE_SLACK) ? rawStart - RANGE_SLACK : 0);
+    *hi = (rangeEnd == (uint64_t) -1) ? in->indexCt :
+        oggIndexBisect(in->index, in->indexCt, rawEnd + RANGE_SLACK);
+}
+
+/* Open the recording with the given prefix (e.g. 123.ogg) for indexed reading
+ * of the given tracks */
+void openIndexed(struct Input *in, const char *prefix,
+                 struct Track *tracks, int trackCt)
+{
+    struct OggPage page;
+    int foundMeta = 0, foundFirst = 0;
+    uint32_t metaStreamNo = 0;
+    char *name;
+    size_t ei, keep, rangeLo = 0, rangeHi;
+
+    in->indexed = 1;
+    openOrDie(&in->readers[0], prefix, ".header1");
+    openOrDie(&in->readers[1], prefix, ".header2");
+
+    name = malloc(strlen(prefix) + 6);
+    if (!name) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(name, "%s.data", prefix);
+    in->perStream = (oggStreamFilesOpen(&in->streams, name) == 0);
+    if (!in->perStream)
+        openOrDie(&in->readers[2], prefix, ".data");
+
+    sprintf(name, "%s.idx", prefix);
+    if (in->perStream)
+        in->index = oggIndexLoadStreams(name, &in->streams, &in->indexCt);
+    else
+        in->index = oggIndexLoad(name, in->readers[2].fd, &in->indexCt);
+    if (!in->index) {
+        perror(name);
+        exit(1);
+    }
+    free(name);
+
+    // Find the meta track, which we need for pauses
+    for (int fi = 0; fi < 2 && !foundMeta; fi++) {
+        while (oggReadPage(&in->readers[fi], &page)) {
+            if (page.packetSize >= 8 && !memcmp(page.data, "ECMETA", 6)) {
+                foundMeta = 1;
+                metaStreamNo = page.header->streamNo;
+                break;
+            }
+        }
+        oggReaderSeek(&in->readers[fi], 0);
+    }
+
+    /* If we only want part of the recording, only read that part of our own
+     * tracks */
+    rangeHi = in->indexCt;
+    if (rangeStart || rangeEnd != (uint64_t) -1)
+        indexRange(in, foundMeta, metaStreamNo, &rangeLo, &rangeHi);
+
+    /* Keep only the pages we need: the first data page (for the granule
+     * offset), the meta track, and our own tracks */
+    keep = 0;
+    for (ei = 0; ei < in->indexCt; ei++) {
+        struct OggIndexEntry *entry = &in->index[ei];
+        int want = 0;
+        if (!foundFirst || entry->granulePos == 0) {
+            want = 1;
+            if (entry->granulePos)
+                foundFirst = 1;
+        } else if (foundMeta && entry->streamNo == metaStreamNo) {
+            want = 1;
+        } else if (ei >= rangeLo && ei < rangeHi) {
+            for (int ti = 0; ti < trackCt; ti++) {
+                if (entry->streamNo == tracks[ti].keepStreamNoSub) {
+                    want = 1;
+                    break;
+                }
+            }
+        }
+        if (want)
+            in->index[keep++] = *entry;
+    }
+    in->indexCt = keep;
+}
+
+/*
+ * Following a recording in progress. Every track is corrected and written a
+ * block at a time as the recording grows, to <directory>/<stream no>.ogg, so
+ * that by the time the recording ends, only its last few blocks are left to
+ * do. The state is checkpointed to <directory>/state, so that a follower can
+ * be restarted where it left off. The recording is over when stdin (normally
+ * a pipe from the recording server) closes. Then the rest is written, and
+ * <directory>/complete is written with the size of the data we corrected.
+ *
+ * Subtracks aren't followed, and neither are tracks which turn out to be
+ * stereo, since their headers have already been written by then. A track
+ * that's given up on has its output removed, so the cook corrects it itself.
+ */
+
+// How often (in seconds) to look for more data
+#define FOLLOW_POLL_TIME        1
+
+// And how often to checkpoint
+int followCheckpointTime = 60;
+
+#define FOLLOW_STATE_MAGIC      "ECFOLLW1"
+
+struct Follower {
+    const char *dir;
+    size_t flushAt;
+
+    // header1, header2 and data, all still growing
+    struct OggReader readers[3];
+
+    // Every track we've found
+    struct Track *tracks;
+    int trackCt, trackAlloc;
+
+    // Meta track info, and the timing it gives us
+    int foundMeta, foundFirst;
+    uint32_t metaStreamNo;
+    uint64_t granuleOffset, pauseTime;
+
+    /* When we find a page for a stream whose headers we haven't read (yet),
+     * we stop there until they've been written. Once the recording is over,
+     * there's nothing left to wait for, so this is set, and such pages are
+     * skipped, giving up on their tracks. */
+    int final;
+};
+
+// The checkpointed state of a follower
+struct FollowState {
+    char magic[8];
+    uint64_t offsets[3];
+    int32_t foundMeta, foundFirst;
+    uint32_t metaStreamNo;
+    uint64_t granuleOffset, pauseTime;
+    uint32_t trackCt;
+} __attribute__((packed));
+
+// And of each track, followed by its pending packets and their stored data
+struct FollowTrackState {
+    uint32_t streamNo;
+    int32_t abandoned, headers, nextSilent;
+    uint32_t lastSequenceNo, flacRate;
+    unsigned char vadLevel, channels;
+    double granulePos;
+    uint64_t outSize, packetCt, storeSize;
+} __attribute__((packed));
+
+// Get the name of a file in the follow directory
+char *followName(struct Follower *f, const char *name)
+{
+    char *ret = malloc(strlen(f->dir) + strlen(name) + 2);
+    if (!ret) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(ret, "%s/%s", f->dir, name);
+    return ret;
+}
+
+char *followTrackName(struct Follower *f, struct Track *track)
+{
+    char name[16];
+    sprintf(name, "%u.ogg", track->keepStreamNo);
+    return followName(f, name);
+}
+
+struct Track *followFindTrack(struct Follower *f, uint32_t streamNo)
+{
+    for (int ti = 0; ti < f->trackCt; ti++) {
+        if (f->tracks[ti].keepStreamNo == streamNo)
+            return &f->tracks[ti];
+    }
+    return NULL;
+}
+
+struct Track *followAddTrack(struct Follower *f, uint32_t streamNo)
+{
+    struct Track *track;
+
+    if (f->trackCt >= f->trackAlloc) {
+        f->trackAlloc = f->trackAlloc ? f->trackAlloc * 2 : 16;
+        f->tracks = realloc(f->tracks, f->trackAlloc * sizeof(struct Track));
+        if (!f->tracks) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    track = &f->tracks[f->trackCt++];
+    memset(track, 0, sizeof(*track));
+    track->keepStreamNo = track->keepStreamNoSub = streamNo;
+    track->channels = 1;
+    track->granulePos = packetTime;
+    track->out.fd = -1;
+    return track;
+}
+
+// Open a track's output, keeping only the first size bytes of what's there
+void followOpenOutput(struct Follower *f, struct Track *track, uint64_t size)
+{
+    char *name = followTrackName(f, track);
+    int fd = open(name, O_WRONLY|O_CREAT, 0666);
+    if (fd < 0 || ftruncate(fd, size) != 0 ||
+        lseek(fd, size, SEEK_SET) == (off_t) -1) {
+        perror(name);
+        exit(1);
+    }
+    free(name);
+    if (oggWriterOpen(&track->out, fd, f->flushAt) != 0) {
+        perror("malloc");
+        exit(1);
+    }
+}
+
+// Give up on following this track
+void followAbandon(struct Follower *f, struct Track *track)
+{
+    char *name = followTrackName(f, track);
+    oggWriterClose(&track->out);
+    close(track->out.fd);
+    unlink(name);
+    free(name);
+
+    free(track->packets);
+    track->packets = NULL;
+    track->packetCt = track->packetAlloc = 0;
+    storeFree(&track->store);
+    track->out.fd = -1;
+    track->abandoned = 1;
+}
+
+/* Handle a page from one of the header files. Returns 0 if we should stop
+ * reading this file for now. */
+int followHeader(struct Follower *f, int fi, struct OggPage *page)
+{
+    struct OggHeader oggHeader = *page->header;
+    unsigned char *buf = page->data;
+    uint32_t packetSize = page->packetSize;
+    struct Track *track;
+
+    if (packetSize >= 8 && !memcmp(buf, "ECMETA", 6)) {
+        f->foundMeta = 1;
+        f->metaStreamNo = oggHeader.streamNo;
+        return 1;
+    }
+
+    track = followFindTrack(f, oggHeader.streamNo);
+    if (!track && fi == 0) {
+        // A new track, if it's one we can correct
+        uint32_t skip = 0;
+        if (packetSize > 8 && !memcmp(buf, "ECVADD", 6))
+            skip = 8 + *((unsigned short *) (buf + 6));
+        track = followAddTrack(f, oggHeader.streamNo);
+        if (packetSize < skip + 5 ||
+            (memcmp(buf + skip, "Opus", 4) &&
+             memcmp(buf + skip, "\x7f""FLAC", 5))) {
+            // Not one we can correct, so just remember to ignore it
+            track->abandoned = 1;
+            return 1;
+        }
+        followOpenOutput(f, track, 0);
+    }
+
+    if (!track) {
+        // Wait for its first header to be written
+        return f->final;
+    }
+    if (track->abandoned || track->headers >= 2)
+        return 1;
+
+    scanHeader(track, &oggHeader, buf, packetSize);
+    writeHeader(track, &oggHeader, buf, packetSize);
+    if (++track->headers == 2) {
+        // Ready for data
+        track->zeroPacket = oggZeroPacket(track->flacRate, track->channels,
+                                          &track->zeroPacketSz);
+        writeInitialZero(track);
+        track->storing = 1;
+    }
+    return 1;
+}
+
+/* Handle a page from the data file. Returns 0 if we should stop reading it
+ * for now. */
+int followData(struct Follower *f, struct OggPage *page)
+{
+    struct OggHeader *oggHeader = page->header;
+    unsigned char *buf = page->data;
+    uint32_t packetSize = page->packetSize;
+    struct Track *track;
+
+    if (!f->foundFirst) {
+        f->foundFirst = 1;
+        f->granuleOffset = oggHeader->granulePos;
+    }
+
+    // Check for pauses and adjust
+    if (f->foundMeta && oggHeader->streamNo == f->metaStreamNo) {
+        if (!strncmp((char *) buf, "{\"c\":\"pause\"}", packetSize)) {
+            // Start of pause
+            f->pauseTime = oggHeader->granulePos;
+        } else if (!strncmp((char *) buf, "{\"c\":\"resume\"}", packetSize)) {
+            // End of pause
+            f->granuleOffset += oggHeader->granulePos - f->pauseTime;
+        }
+        return 1;
+    }
+
+    if (oggHeader->streamNo & 0x80000000)
+        return 1;
+
+    track = followFindTrack(f, oggHeader->streamNo);
+    if (!track || (!track->abandoned && track->headers < 2)) {
+        // Wait for its headers to be written
+        if (!f->final)
+            return 0;
+
+        // They never were, so this track can't be followed
+        if (track)
+            followAbandon(f, track);
+        return 1;
+    }
+    if (track->abandoned)
+        return 1;
+
+    scanPacket(track, oggHeader, buf, packetSize, f->granuleOffset);
+    if (track->channels > 1)
+        followAbandon(f, track);
+    return 1;
+}
+
+/* Correct and write every block of this track that's complete. This is the
+ * same correction as correctTrack, a block at a time. If final, the last
+ * block is complete. */
+void followCorrect(struct Track *track, int final)
+{
+    struct Packet *packets = track->packets;
+    size_t ct = track->packetCt, begin = 0, first, end, mid;
+    unsigned char *data = storeFinish(&track->store);
+    size_t off = 0;
+
+    while (begin < ct) {
+        int blockCt;
+        double expected, actual;
+
+        // Find the end of this block
+        end = begin;
+        if (track->nextSilent) {
+            while (end + 1 < ct && (packets[end+1].flags & FLAG_SILENT))
+                end++;
+        } else {
+            while (end + 1 < ct &&
+                   !(packets[end+1].flags & FLAG_SILENT) &&
+                   packets[end+1].inputGranulePos <= packets[end].inputGranulePos + packetTime * 25)
+                end++;
+        }
+        if (end + 1 >= ct && !final) {
+            // The next packet could still be part of this block
+            break;
+        }
+
+        // A block of silence follows a block of sound
+        track->nextSilent = !track->nextSilent && end + 1 < ct &&
+            (packets[end+1].flags & FLAG_SILENT);
+
+        // Check the difference between the expected range and the actual range
+        preSkip(&packets[begin], &track->granulePos);
+        first = begin;
+        blockCt = end - begin + 1;
+        expected = track->granulePos + blockCt * packetTime;
+        actual = packets[end].inputGranulePos + packetTime * 2;
+        if (actual < expected && (packets[first].flags & FLAG_SILENT)) {
+            // Cut out silence from the beginning
+            while (actual < expected) {
+                if (packets[first].preSkip) {
+                    packets[first].preSkip--;
+                    expected -= packetTime;
+                    if (track->granulePos > packetTime)
+                        track->granulePos -= packetTime;
+                    else
+                        track->granulePos = 0;
+                } else if (first != end) {
+                    packets[first].flags |= FLAG_DROP | FLAG_TRIMMED;
+                    expected -= packetTime;
+                    first++;
+                } else break;
+            }
+        }
+
+        // Set the output granule positions
+        for (mid = first; mid <= end; mid++) {
+            struct Packet *packet = &packets[mid];
+            if (track->granulePos + packetTime * 25 <
+                packet->inputGranulePos) {
+                // Too little data, add a gap
+                int64_t diff = packet->inputGranulePos - track->granulePos;
+                packet->preSkip = diff / packetTime;
+                track->granulePos += packet->preSkip * packetTime;
+                packet->outputGranulePos = track->granulePos;
+                track->granulePos += packetTime;
+
+            } else if (track->granulePos >
+                packet->inputGranulePos + packetTime * 25) {
+                // Too much data, drop a packet
+                packet->flags |= FLAG_DROP;
+
+            } else {
+                // Just right!
+                packet->outputGranulePos = track->granulePos;
+                track->granulePos += packetTime;
+
+            }
+        }
+
+        // And write the block out
+        for (mid = begin; mid <= end; mid++) {
+            struct OggHeader oggHeader = {0};
+            uint32_t size;
+            if (track->flacRate == 44100)
+                packets[mid].outputGranulePos = packets[mid].outputGranulePos * 147 / 160;
+            oggHeader.type = data[off];
+            memcpy(&size, data + off + 1, sizeof(size));
+            off += 1 + sizeof(size);
+            track->cur = mid;
+            emitPacket(track, &oggHeader, data + off, size);
+            off += size;
+        }
+
+        begin = end + 1;
+    }
+
+    // Forget what we've written
+    if (begin) {
+        memmove(packets, packets + begin, (ct - begin) * sizeof(struct Packet));
+        track->packetCt = ct - begin;
+    }
+    if (track->store.spill) {
+        if (begin) {
+            // Start a new store with just what's left
+            struct Store rest = {0};
+            storeAppend(&rest, data + off, track->store.size - off);
+            storeFree(&track->store);
+            track->store = rest;
+        } else {
+            storeUnfinish(&track->store);
+        }
+    } else if (begin) {
+        memmove(data, data + off, track->store.size - off);
+        track->store.size -= off;
+        storeTotal -= off;
+    }
+}
+
+// Read whatever's been added to the recording, and write what we can
+void followRead(struct Follower *f)
+{
+    struct OggPage page;
+
+    // Headers first, so we know about any tracks the data has
+    for (int fi = 0; fi < 2; fi++) {
+        while (oggReadPage(&f->readers[fi], &page)) {
+            if (!followHeader(f, fi, &page)) {
+                oggReaderSeek(&f->readers[fi], page.offset);
+                break;
+            }
+        }
+    }
+
+    while (oggReadPage(&f->readers[2], &page)) {
+        if (!followData(f, &page)) {
+            oggReaderSeek(&f->readers[2], page.offset);
+            break;
+        }
+    }
+
+    for (int ti = 0; ti < f->trackCt; ti++) {
+        if (!f->tracks[ti].abandoned && f->tracks[ti].headers >= 2)
+            followCorrect(&f->tracks[ti], 0);
+    }
+}
+
+// Checkpoint our state
+void followCheckpoint(struct Follower *f)
+{
+    struct FollowState state = {0};
+    char *name = followName(f, "state"), *tmpName = followName(f, "state.tmp");
+    FILE *out = fopen(tmpName, "w");
+    if (!out) {
+        perror(tmpName);
+        exit(1);
+    }
+
+    memcpy(state.magic, FOLLOW_STATE_MAGIC, sizeof(state.magic));
+    for (int fi = 0; fi < 3; fi++)
+        state.offsets[fi] = f->readers[fi].offset;
+    state.foundMeta = f->foundMeta;
+    state.foundFirst = f->foundFirst;
+    state.metaStreamNo = f->metaStreamNo;
+    state.granuleOffset = f->granuleOffset;
+    state.pauseTime = f->pauseTime;
+    state.trackCt = f->trackCt;
+    fwrite(&state, sizeof(state), 1, out);
+
+    for (int ti = 0; ti < f->trackCt; ti++) {
+        struct Track *track = &f->tracks[ti];
+        struct FollowTrackState ts = {0};
+
+        if (!track->abandoned) {
+            // The output has to actually have what we say it has
+            oggWriterFlush(&track->out);
+            ts.outSize = lseek(track->out.fd, 0, SEEK_CUR);
+        }
+        ts.streamNo = track->keepStreamNo;
+        ts.abandoned = track->abandoned;
+        ts.headers = track->headers;
+        ts.nextSilent = track->nextSilent;
+        ts.lastSequenceNo = track->lastSequenceNo;
+        ts.flacRate = track->flacRate;
+        ts.vadLevel = track->vadLevel;
+        ts.channels = track->channels;
+        ts.granulePos = track->granulePos;
+        ts.packetCt = track->packetCt;
+        ts.storeSize = track->store.size;
+        fwrite(&ts, sizeof(ts), 1, out);
+        if (track->packetCt)
+            fwrite(track->packets, sizeof(struct Packet), track->packetCt, out);
+        if (track->store.size) {
+            fwrite(storeFinish(&track->store), 1, track->store.size, out);
+            storeUnfinish(&track->store);
+        }
+    }
+
+    if (ferror(out) || fclose(out) != 0 || rename(tmpName, name) != 0) {
+        perror(name);
+        exit(1);
+    }
+    free(name);
+    free(tmpName);
+}
+
+// Drop all our tracks, as after a bad checkpoint
+void followReset(struct Follower *f)
+{
+    for (int ti = 0; ti < f->trackCt; ti++) {
+        struct Track *track = &f->tracks[ti];
+        if (track->out.fd >= 0) {
+            oggWriterClose(&track->out);
+            close(track->out.fd);
+        }
+        free(track->packets);
+        storeFree(&track->store);
+    }
+    f->trackCt = 0;
+    f->foundMeta = f->foundFirst = 0;
+    f->metaStreamNo = 0;
+    f->granuleOffset = f->pauseTime = 0;
+    storeTotal = 0;
+}
+
+/* Pick up where a previous follower left off, if there's a checkpoint.
+ * Returns 1 if there was. */
+int followRestore(struct Follower *f)
+{
+    struct FollowState state;
+    char *name = followName(f, "state");
+    FILE *in = fopen(name, "r");
+    free(name);
+    if (!in)
+        return 0;
+
+    if (fread(&state, sizeof(state), 1, in) != 1 ||
+        memcmp(state.magic, FOLLOW_STATE_MAGIC, sizeof(state.magic)))
+        goto fail;
+    f->foundMeta = state.foundMeta;
+    f->foundFirst = state.foundFirst;
+    f->metaStreamNo = state.metaStreamNo;
+    f->granuleOffset = state.granuleOffset;
+    f->pauseTime = state.pauseTime;
+
+    for (uint32_t ti = 0; ti < state.trackCt; ti++) {
+        struct FollowTrackState ts;
+        struct Track *track;
+        struct stat sbuf;
+
+        if (fread(&ts, sizeof(ts), 1, in) != 1)
+            goto fail;
+        track = followAddTrack(f, ts.streamNo);
+        track->abandoned = ts.abandoned;
+        track->headers = ts.headers;
+        track->nextSilent = ts.nextSilent;
+        track->lastSequenceNo = ts.lastSequenceNo;
+        track->flacRate = ts.flacRate;
+        track->vadLevel = ts.vadLevel;
+        track->channels = ts.channels;
+        track->granulePos = ts.granulePos;
+
+        track->packets = malloc((ts.packetCt ? ts.packetCt : 1) * sizeof(struct Packet));
+        if (!track->packets) {
+            perror("malloc");
+            exit(1);
+        }
+        track->packetCt = track->packetAlloc = ts.packetCt;
+        if (fread(track->packets, sizeof(struct Packet), ts.packetCt, in) != ts.packetCt)
+            goto fail;
+        while (ts.storeSize) {
+            static unsigned char buf[65536];
+            size_t part = (ts.storeSize > sizeof(buf)) ? sizeof(buf) : ts.storeSize;
+            if (fread(buf, 1, part, in) != part)
+                goto fail;
+            storeAppend(&track->store, buf, part);
+            ts.storeSize -= part;
+        }
+
+        if (track->abandoned)
+            continue;
+
+        // The output must have survived as well
+        name = followTrackName(f, track);
+        if (stat(name, &sbuf) != 0 || (uint64_t) sbuf.st_size < ts.outSize) {
+            free(name);
+            goto fail;
+        }
+        free(name);
+        followOpenOutput(f, track, ts.outSize);
+        if (track->headers >= 2) {
+            track->zeroPacket = oggZeroPacket(track->flacRate, track->channels,
+                                              &track->zeroPacketSz);
+            track->storing = 1;
+        }
+    }
+
+    fclose(in);
+    for (int fi = 0; fi < 3; fi++) {
+        if (oggReaderSeek(&f->readers[fi], state.offsets[fi]) != 0) {
+            perror("lseek");
+            exit(1);
+        }
+    }
+    return 1;
+
+fail:
+    fclose(in);
+    followReset(f);
+    return 0;
+}
+
+// Follow this recording until it's over
+void follow(const char *prefix, const char *dir, size_t flushAt)
+{
+    static const char *footers[3] = {".header1", ".header2", ".data"};
+    struct Follower f;
+    time_t lastCheckpoint;
+    char *name;
+    FILE *complete;
+    int done = 0;
+
+    memset(&f, 0, sizeof(f));
+    f.dir = dir;
+    f.flushAt = flushAt;
+
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        perror(dir);
+        exit(1);
+    }
+    name = followName(&f, "complete");
+    unlink(name);
+    free(name);
+
+    for (int fi = 0; fi < 3; fi++) {
+        int fd;
+        name = malloc(strlen(prefix) + strlen(footers[fi]) + 1);
+        if (!name) {
+            perror("malloc");
+            exit(1);
+        }
+        sprintf(name, "%s%s", prefix, footers[fi]);
+        fd = open(name, O_RDONLY);
+        if (fd < 0 || oggReaderOpenGrowing(&f.readers[fi], fd) != 0) {
+            perror(name);
+            exit(1);
+        }
+        f.readers[fi].ownFd = 1;
+        free(name);
+    }
+
+    followRestore(&f);
+
+    lastCheckpoint = time(NULL);
+    while (!done) {
+        struct pollfd pfd = {0, POLLIN, 0};
+
+        followRead(&f);
+
+        // Wait for the end, or some more data
+        if (poll(&pfd, 1, FOLLOW_POLL_TIME * 1000) > 0) {
+            char buf[256];
+            ssize_t rd = read(0, buf, sizeof(buf));
+            if (rd == 0 || (rd < 0 && errno != EINTR && errno != EAGAIN))
+                done = 1;
+        }
+
+        if (!done && time(NULL) - lastCheckpoint >= followCheckpointTime) {
+            followCheckpoint(&f);
+            lastCheckpoint = time(NULL);
+        }
+    }
+
+    // The recording is over, so finish everything off
+    f.final = 1;
+    followRead(&f);
+    for (int ti = 0; ti < f.trackCt; ti++) {
+        struct Track *track = &f.tracks[ti];
+        if (track->abandoned)
+            continue;
+        if (track->headers < 2) {
+            // Never got all its headers
+            followAbandon(&f, track);
+            continue;
+        }
+        followCorrect(track, 1);
+        finishTrack(track);
+        storeFree(&track->store);
+    }
+
+    name = followName(&f, "state");
+    unlink(name);
+    free(name);
+
+    name = followName(&f, "complete");
+    complete = fopen(name, "w");
+    if (!complete ||
+        fprintf(complete, "%llu\n", (unsigned long long) f.readers[2].offset) < 0 ||
+        fclose(complete) != 0) {
+        perror(name);
+        exit(1);
+    }
+    free(name);
+}
+
+void usage(void)
+{
+    fprintf(stderr,
+        "Use: oggcorrect [options] <track no> [subtrack]\n"
+        "  or oggcorrect [options] -o <output> <track no> [subtrack]\n"
+        "                [-o <output> <track no> [subtrack] ...]\n"
+        "                [-O <prefix> <track no> ...]\n"
+        "  or oggcorrect [options] --follow <recording> <directory>\n"
+        "\n"
+        "-O writes every subtrack of the given track to <prefix>-<subtrack>.ogg.\n"
+        "\n"
+        "--follow corrects every track of a recording in progress into\n"
+        "<directory>, until stdin closes.\n"
+        "\n"
+        "Without --index or --once, the input must be given twice.\n"
+        "\n"
+        "Options:\n"
+        "  --index <recording>  Read <recording>.header1, .header2 and .data\n"
+        "                       (or its per-stream files) using\n"
+        "                       <recording>.idx, instead of stdin\n"
+        "  --once               Read the input only once, storing the kept\n"
+        "                       packets\n"
+        "  --start <secs>       Only correct from this time (not counting\n"
+        "                       pauses), which is time 0 in the output\n"
+        "  --end <secs>         Only correct up to this time. With --index,\n"
+        "                       only this range of the data is read\n"
+        "  --store-cap <bytes>  With --once or --follow, store at most this\n"
+        "                       much in memory before using temporary files\n"
+        "  --flush <bytes>      Output buffer size\n"
+        "  --pack <bytes>       Pack data packets into pages of up to this\n"
+        "                       size (0 for the default, 4096)\n"
+        "  --pack-time <ms>     Pack data packets into pages of up to this\n"
+        "                       duration (default 1000)\n"
+        "  --checkpoint <secs>  With --follow, how often to checkpoint\n"
+        "  --io <policy>        How to read the input: map (the default),\n"
+        "                       stream or direct, optionally followed by\n"
+        "                       :<read-ahead>, e.g. stream:4M\n"
+        "  --stats=<file>       Write statistics to <file>, as JSON\n");
+    exit(1);
+}
+
+/* Write out our statistics. Tracks should be finished, since that's when their
+ * output is flushed. */
+void writeStats(struct Input *in, struct Track *tracks, int trackCt,
+                uint64_t pauses)
+{
+    for (int fi = 0; fi < 3; fi++)
+        oggStatsReader(&stats, &in->readers[fi]);
+    for (size_t si = 0; si < in->streams.ct; si++) {
+        if (in->streams.files[si].open)
+            oggStatsReader(&stats, &in->streams.files[si].reader);
+    }
+    oggStatsAdd(&stats, "pauses", pauses);
+    for (int ti = 0; ti < trackCt; ti++) {
+        struct Track *track = &tracks[ti];
+        if (track->allSubtracks)
+            continue;
+        oggStatsAdd(&stats, "tracks", 1);
+        oggStatsWriter(&stats, &track->out);
+        oggStatsAdd(&stats, "gapPackets", track->gapPackets);
+        oggStatsAdd(&stats, "droppedPackets", track->droppedPackets);
+        oggStatsAdd(&stats, "silenceTrimmed", track->silenceTrimmed);
+        oggStatsAdd(&stats, "correctTimestampsUp", track->correctedUp);
+        oggStatsAdd(&stats, "correctTimestampsDown", track->correctedDown);
+    }
+    oggStatsClose(&stats);
+}
+
+// Set up a track given its arguments, writing to the named file, or stdout
+void initTrack(struct Track *track, const char *name, size_t flushAt, const char *streamNo, const char *subStreamNo)
+{
+    memset(track, 0, sizeof(*track));
+    if (oggWriterOpen(&track->out, name ? openOutput(track, name) : 1, flushAt) != 0) {
+        perror("malloc");
+        exit(1);
+    }
+    if (pack) {
+        // Until we know otherwise from a FLAC header, it's 48k
+        oggWriterSetPacking(&track->out, packSize, 0);
+        oggWriterSetPackTime(&track->out, packTime, 48000);
+    }
+    track->keepStreamNo = track->keepStreamNoSub = atoi(streamNo);
+    if (subStreamNo) {
+        track->keepSubStreamNo = atoi(subStreamNo);
+        if (track->keepSubStreamNo)
+            track->keepStreamNoSub = track->keepStreamNo | 0x80000000;
+    }
+    track->channels = 1;
+}
+
+int main(int argc, char **argv)
+{
+    // The outputs we're generating
+    struct Track *tracks;
+    int trackCt = 0, trackAlloc, ti;
+
+    // Where we're reading from
+    struct Input in = {0};
+    const char *indexPrefix = NULL;
+    const char *followPrefix = NULL, *followDir = NULL;
+    const char *statsFile = NULL;
+    size_t flushAt = 0;
+    int once = 0;
+    int ai = 1;
+
+    // Meta track info (used for pauses)
+    int foundMeta = 0;
+    uint32_t metaStreamNo = 0;
+
+    /* What should we be subtracting from our granule position? (And what was
+     * it before any pauses, for the second pass?) */
+    uint64_t granuleOffset = 0, firstGranuleOffset = 0;
+
+    // When did we last pause, and how many pauses were there?
+    uint64_t pauseTime = 0, pauses = 0;
+
+    // Size of our packet
+    uint32_t packetSize;
+
+    // Current packet
+    unsigned char *buf = NULL;
+
+    // Header
+    struct OggHeader oggHeader;
+
+    while (ai < argc && !strncmp(argv[ai], "--", 2)) {
+        if (!strcmp(argv[ai], "--once")) {
+            once = 1;
+            ai++;
+            continue;
+        }
+        if (!strncmp(argv[ai], "--stats=", 8)) {
+            statsFile = argv[ai] + 8;
+            ai++;
+            continue;
+        }
+        if (!strcmp(argv[ai], "--follow") && ai + 2 < argc) {
+            followPrefix = argv[ai+1];
+            followDir = argv[ai+2];
+            ai += 3;
+            continue;
+        }
+        if (ai + 1 >= argc)
+            usage();
+        if (!strcmp(argv[ai], "--index"))
+            indexPrefix = argv[ai+1];
+        else if (!strcmp(argv[ai], "--flush"))
+            flushAt = atol(argv[ai+1]);
+        else if (!strcmp(argv[ai], "--pack")) {
+            pack = 1;
+            packSize = atol(argv[ai+1]);
+        } else if (!strcmp(argv[ai], "--pack-time")) {
+            pack = 1;
+            packTime = atol(argv[ai+1]);
+        }
+        else if (!strcmp(argv[ai], "--start"))
+            rangeStart = atof(argv[ai+1]) * 48000;
+        else if (!strcmp(argv[ai], "--end"))
+            rangeEnd = atof(argv[ai+1]) * 48000;
+        else if (!strcmp(argv[ai], "--store-cap"))
+            storeCap = atol(argv[ai+1]);
+        else if (!strcmp(argv[ai], "--checkpoint"))
+            followCheckpointTime = atoi(argv[ai+1]);
+        else if (!strcmp(argv[ai], "--io")) {
+            if (oggReaderParsePolicy(argv[ai+1]) != 0)
+                usage();
+        }
+        else
+            usage();
+        ai += 2;
+    }
+
+    if (followPrefix) {
+        follow(followPrefix, followDir, flushAt);
+        return 0;
+    }
+
+    if (oggStatsOpen(&stats, "oggcorrect", statsFile) != 0) {
+        perror(statsFile);
+        exit(1);
+    }
+
+    if (ai >= argc)
+        usage();
+
+    trackAlloc = argc;
+    tracks = calloc(trackAlloc, sizeof(struct Track));
+    if (!tracks) {
+        perror("calloc");
+        exit(1);
+    }
+
+    if (!strcmp(argv[ai], "-o") || !strcmp(argv[ai], "-O")) {
+        // Multiple outputs, each to its own file
+        while (ai < argc) {
+            const char *subStreamNo = NULL;
+            if (!strcmp(argv[ai], "-O") && ai + 2 < argc) {
+                // Every subtrack, each to its own file, once we find them
+                struct Track *track = &tracks[trackCt++];
+                track->allSubtracks = 1;
+                track->outPrefix = argv[ai+1];
+                track->keepStreamNo = atoi(argv[ai+2]);
+                track->keepStreamNoSub = track->keepStreamNo | 0x80000000;
+                ai += 3;
+                continue;
+            }
+            if (strcmp(argv[ai], "-o") || ai + 2 >= argc)
+                usage();
+            if (ai + 3 < argc && strcmp(argv[ai+3], "-o") &&
+                strcmp(argv[ai+3], "-O"))
+                subStreamNo = argv[ai+3];
+            initTrack(&tracks[trackCt++], argv[ai+1], flushAt, argv[ai+2], subStreamNo);
+            ai += subStreamNo ? 4 : 3;
+        }
+
+    } else {
+        // Just one track, to stdout
+        initTrack(&tracks[trackCt++], NULL, flushAt, argv[ai], (ai + 1 < argc) ? argv[ai+1] : NULL);
+
+    }
+
+    for (ti = 0; ti < trackCt; ti++)
+        tracks[ti].storing = once;
+
+    if (indexPrefix) {
+        openIndexed(&in, indexPrefix, tracks, trackCt);
+    } else if (oggReaderOpen(&in.readers[0], 0) != 0) {
+        perror("stdin");
+        exit(1);
+    }
+
+    // First look for the header info
+    oggStatsPhase(&stats, "header");
+    while (readInput(&in, &oggHeader, &buf, &packetSize)) {
+        if (oggHeader.granulePos != 0) {
+            // Not a header
+            granuleOffset = firstGranuleOffset = oggHeader.granulePos;
+            break;
+        }
+
+        // Look for a meta track
+        if (!foundMeta && packetSize >= 8 && !memcmp(buf, "ECMETA", 6)) {
+            foundMeta = 1;
+            metaStreamNo = oggHeader.streamNo;
+        }
+
+        for (ti = 0; ti < trackCt; ti++)
+            scanHeader(&tracks[ti], &oggHeader, buf, packetSize);
+    }
+
+    // Now get the actual packet info
+    oggStatsPhase(&stats, "timing");
+    do {
+        if (oggHeader.granulePos == 0) {
+            // We've come back to the header, so break out
+            break;
+        }
+
+        // Check for pauses and adjust
+        if (foundMeta && oggHeader.streamNo == metaStreamNo)
+            checkPause(buf, packetSize, oggHeader.granulePos, &granuleOffset,
+                       &pauseTime, &pauses);
+
+        for (ti = 0; ti < trackCt; ti++) {
+            if (tracks[ti].allSubtracks)
+                findSubtrack(&tracks, &trackCt, &trackAlloc, ti, &oggHeader,
+                             buf, packetSize, flushAt);
+            else
+                scanPacket(&tracks[ti], &oggHeader, buf, packetSize, granuleOffset);
+        }
+
+    } while (readInput(&in, &oggHeader, &buf, &packetSize));
+
+    // Correct the timestamps
+    for (ti = 0; ti < trackCt; ti++)
+        correctTrack(&tracks[ti]);
+
+    oggStatsPhase(&stats, "emit");
+
+    if (once) {
+        // Everything we need was stored in the first pass
+        for (ti = 0; ti < trackCt; ti++) {
+            if (tracks[ti].allSubtracks) {
+                storeFree(&tracks[ti].store);
+                continue;
+            }
+            writeStored(&tracks[ti]);
+            finishTrack(&tracks[ti]);
+        }
+        writeStats(&in, tracks, trackCt, pauses);
+        return 0;
+    }
+
+    // Now read and pass thru the header
+    do {
+        if (oggHeader.granulePos != 0) {
+            // Passed the header
+            break;
+        }
+
+        for (ti = 0; ti < trackCt; ti++) {
+            if (!tracks[ti].allSubtracks)
+                writeHeader(&tracks[ti], &oggHeader, buf, packetSize);
+        }
+
+    } while (readInput(&in, &oggHeader, &buf, &packetSize));
+
+    for (ti = 0; ti < trackCt; ti++) {
+        if (!tracks[ti].allSubtracks)
+            writeInitialZero(&tracks[ti]);
+    }
+
+    // And finally, pass thru the data with corrected timestamps
+    granuleOffset = firstGranuleOffset;
+    pauseTime = 0;
+    do {
+        if (foundMeta && oggHeader.streamNo == metaStreamNo) {
+            uint64_t ignored = 0;
+            checkPause(buf, packetSize, oggHeader.granulePos, &granuleOffset,
+                       &pauseTime, &ignored);
+        }
+
+        for (ti = 0; ti < trackCt; ti++) {
+            if (!tracks[ti].allSubtracks)
+                writePacket(&tracks[ti], &oggHeader, buf, packetSize,
+                            granuleOffset);
+        }
+
+    } while (readInput(&in, &oggHeader, &buf, &packetSize));
+
+    for (ti = 0; ti < trackCt; ti++) {
+        if (!tracks[ti].allSubtracks)
+            finishTrack(&tracks[ti]);
     }
 
+    writeStats(&in, tracks, trackCt, pauses);
     return 0;
 }
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "oggcrc.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_CLMUL 1
+#include <immintrin.h>
+#endif
+
+/* Below this size, setting up the carry-less multiplication isn't worth it
+ * (and it needs four blocks to start with anyway) */
+#define CLMUL_MIN 64
+
+static int initialized = 0;
+static int haveClmul = 0;
+
+/* crcTable[k][b] is the CRC of the byte b followed by k zero bytes, so that we
+ * can do eight bytes at a time */
+static uint32_t crcTable[8][256];
+
+static void init(void)
+{
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t r = b << 24;
+        for (int j = 0; j < 8; j++)
+            r = (r << 1) ^ ((r & 0x80000000U) ? 0x04c11db7U : 0);
+        crcTable[0][b] = r;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (int b = 0; b < 256; b++) {
+            uint32_t r = crcTable[k-1][b];
+            crcTable[k][b] = (r << 8) ^ crcTable[0][r >> 24];
+        }
+    }
+
+#ifdef HAVE_CLMUL
+    __builtin_cpu_init();
+    haveClmul = __builtin_cpu_supports("pclmul") &&
+                __builtin_cpu_supports("ssse3");
+#endif
+
+    initialized = 1;
+}
+
+static void slice8(const unsigned char *buf, size_t size, uint32_t *crcp)
+{
+    uint32_t crc = *crcp;
+
+    while (size >= 8) {
+        uint32_t a = crc ^ (((uint32_t) buf[0] << 24) |
+                            ((uint32_t) buf[1] << 16) |
+                            ((uint32_t) buf[2] << 8) |
+                            buf[3]);
+        crc = crcTable[7][a >> 24] ^
+              crcTable[6][(a >> 16) & 0xFF] ^
+              crcTable[5][(a >> 8) & 0xFF] ^
+              crcTable[4][a & 0xFF] ^
+              crcTable[3][buf[4]] ^
+              crcTable[2][buf[5]] ^
+              crcTable[1][buf[6]] ^
+              crcTable[0][buf[7]];
+        buf += 8;
+        size -= 8;
+    }
+
+    while (size--)
+        crc = crcTable[0][(crc >> 24) ^ *buf++] ^ (crc << 8);
+
+    *crcp = crc;
+}
+
+#ifdef HAVE_CLMUL
+/* Fold a 128-bit block forward over some distance, and add the block found
+ * there. k holds x^(distance+64) mod P in its high half and x^distance mod P
+ * in its low half. */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i fold(__m128i x, __m128i k, __m128i next)
+{
+    return _mm_xor_si128(
+        _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11),
+                      _mm_clmulepi64_si128(x, k, 0x00)),
+        next);
+}
+
+/* Since the Ogg CRC isn't reflected, each block is byte-swapped so that the
+ * first bit of the input is the highest coefficient */
+__attribute__((target("pclmul,ssse3")))
+static void clmul(const unsigned char *buf, size_t size, uint32_t *crcp)
+{
+    const __m128i swap = _mm_set_epi8(
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i fold4 = _mm_set_epi64x(0x8833794c, 0xe6228b11);
+    const __m128i fold1 = _mm_set_epi64x(0xc5b9cd4c, 0xe8a45605);
+    unsigned char rest[16];
+    __m128i x0, x1, x2, x3;
+
+#define LOAD(off) _mm_shuffle_epi8( \
+    _mm_loadu_si128((const __m128i *) (buf + (off))), swap)
+
+    // The incoming CRC is added to the first four bytes
+    x0 = _mm_xor_si128(LOAD(0), _mm_set_epi32(*crcp, 0, 0, 0));
+    x1 = LOAD(16);
+    x2 = LOAD(32);
+    x3 = LOAD(48);
+    buf += 64;
+    size -= 64;
+
+    // Fold four blocks at a time
+    while (size >= 64) {
+        x0 = fold(x0, fold4, LOAD(0));
+        x1 = fold(x1, fold4, LOAD(16));
+        x2 = fold(x2, fold4, LOAD(32));
+        x3 = fold(x3, fold4, LOAD(48));
+        buf += 64;
+        size -= 64;
+    }
+
+    // Then down to one
+    x0 = fold(x0, fold1, x1);
+    x0 = fold(x0, fold1, x2);
+    x0 = fold(x0, fold1, x3);
+    while (size >= 16) {
+        x0 = fold(x0, fold1, LOAD(0));
+        buf += 16;
+        size -= 16;
+    }
+
+#undef LOAD
+
+    /* What's left is a 128-bit remainder with the same CRC as the input so
+     * far, so finish with the tables */
+    _mm_storeu_si128((__m128i *) rest, _mm_shuffle_epi8(x0, swap));
+    *crcp = 0;
+    slice8(rest, 16, crcp);
+    slice8(buf, size, crcp);
+}
+#endif
+
+void oggCRC(const void *data, size_t size, uint32_t *crc)
+{
+    if (!initialized)
+        init();
+#ifdef HAVE_CLMUL
+    if (haveClmul && size >= CLMUL_MIN) {
+        clmul((const unsigned char *) data, size, crc);
+        return;
+    }
+#endif
+    slice8((const unsigned char *) data, size, crc);
+}
+
+void oggCRCSlice8(const void *data, size_t size, uint32_t *crc)
+{
+    if (!initialized)
+        init();
+    slice8((const unsigned char *) data, size, crc);
+}
+
+int oggCRCClmul(const void *data, size_t size, uint32_t *crc)
+{
+    if (!initialized)
+        init();
+#ifdef HAVE_CLMUL
+    if (haveClmul) {
+        if (size >= CLMUL_MIN)
+            clmul((const unsigned char *) data, size, crc);
+        else
+            slice8((const unsigned char *) data, size, crc);
+        return 1;
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The Ogg CRC (polynomial 0x04c11db7, not reflected, initial value 0), chosen
+ * at runtime from the fastest implementation this CPU supports. Gives the same
+ * results as crc32() in crc32.h.
+ */
+
+#ifndef OGGCRC_H
+#define OGGCRC_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Update *crc with these bytes
+void oggCRC(const void *data, size_t size, uint32_t *crc);
+
+// The individual implementations, for testing
+void oggCRCSlice8(const void *data, size_t size, uint32_t *crc);
+
+// Returns 0 and does nothing if the CPU doesn't support it
+int oggCRCClmul(const void *data, size_t size, uint32_t *crc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -21,37 +21,14 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "oggpage.h"
+
 /* NOTE: We don't use libogg here because the behavior of this program is so
  * trivial, the added memory bandwidth of using it is just a waste of energy */
 
 /* NOTE: This program assumes little-endian for speed, it WILL NOT WORK on a
  * big-endian system */
 
-struct OggPreHeader {
-    unsigned char capturePattern[4];
-    unsigned char version;
-} __attribute__((packed));
-
-struct OggHeader {
-    unsigned char type;
-    uint64_t granulePos;
-    uint32_t streamNo;
-    uint32_t sequenceNo;
-    uint32_t crc;
-} __attribute__((packed));
-
-ssize_t readAll(int fd, void *vbuf, size_t count)
-{
-    unsigned char *buf = (unsigned char *) vbuf;
-    ssize_t rd = 0, ret;
-    while (rd < count) {
-        ret = read(fd, buf + rd, count - rd);
-        if (ret <= 0) return ret;
-        rd += ret;
-    }
-    return rd;
-}
-
 int main(int argc, char **argv)
 {
     int32_t streamNo = -1;
@@ -60,46 +37,27 @@ int main(int argc, char **argv)
     uint64_t firstGranulePos = 0, lastGranulePos = 0;
     uint64_t greatestGranulePos = 0, granuleOffset = 0;
     uint32_t packetSize;
-    unsigned char segmentCount, segmentVal;
-    unsigned char buf[1024];
-    const uint32_t bufSz = 1024;
-    struct OggPreHeader preHeader;
+    unsigned char *buf;
+    struct OggReader reader;
+    struct OggPage page;
 
     if (argc >= 2)
         streamNo = atoi(argv[1]);
 
-    while (readAll(0, &preHeader, sizeof(preHeader)) == sizeof(preHeader)) {
-        struct OggHeader oggHeader;
-        if (memcmp(preHeader.capturePattern, "OggS", 4))
-            break;
-
-        // It's an ogg header, get the header data
-        if (readAll(0, &oggHeader, sizeof(oggHeader)) != sizeof(oggHeader))
-            break;
-
-        // Get the data size
-        packetSize = 0;
-        if (readAll(0, &segmentCount, 1) != 1)
-            break;
-        for (; segmentCount; segmentCount--) {
-            if (readAll(0, &segmentVal, 1) != 1)
-                break;
-            packetSize += (uint32_t) segmentVal;
-        }
+    if (oggReaderOpen(&reader, 0) != 0) {
+        perror("stdin");
+        return 1;
+    }
+
+    while (oggReadPage(&reader, &page)) {
+        struct OggHeader oggHeader = *page.header;
+        buf = page.data;
+        packetSize = page.packetSize;
 
         // If it's zero-size, skip it entirely (timestamp reference)
         if (packetSize == 0)
             continue;
 
-        // Skip the data
-        while (packetSize > bufSz) {
-            if (readAll(0, buf, bufSz) != bufSz)
-                break;
-            packetSize -= bufSz;
-        }
-        if (readAll(0, buf, packetSize) != packetSize)
-            break;
-
         if (!firstGranulePos && oggHeader.granulePos)
             firstGranulePos = oggHeader.granulePos;
 
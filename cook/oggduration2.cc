@@ -27,6 +27,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "oggpage.h"
+
 using namespace std;
 
 /* NOTE: We don't use libogg here because the behavior of this program is so
@@ -35,49 +37,6 @@ using namespace std;
 /* NOTE: This program assumes little-endian for speed, it WILL NOT WORK on a
  * big-endian system */
 
-struct OggPreHeader {
-    unsigned char capturePattern[4];
-    unsigned char version;
-} __attribute__((packed));
-
-struct OggHeader {
-    unsigned char type;
-    uint64_t granulePos;
-    uint32_t streamNo;
-    uint32_t sequenceNo;
-    uint32_t crc;
-} __attribute__((packed));
-
-ssize_t readAll(int fd, void *vbuf, size_t count) {
-    unsigned char *buf = (unsigned char *) vbuf;
-    ssize_t rd = 0, ret;
-    while (rd < count) {
-        ret = read(fd, buf + rd, count - rd);
-        if (ret <= 0) return ret;
-        rd += ret;
-    }
-    return rd;
-}
-
-uint32_t getPacketSize(int fd) {
-    unsigned char segmentCount, segmentVal;
-    uint32_t packetSize = 0;
-    if (readAll(fd, &segmentCount, 1) != 1)
-        return 0;
-    for (; segmentCount; segmentCount--) {
-        if (readAll(fd, &segmentVal, 1) != 1)
-            return 0;
-        packetSize += (uint32_t) segmentVal;
-    }
-    return packetSize;
-}
-
-uint32_t skipData(int fd) {
-    uint32_t packetSize = getPacketSize(fd);
-    lseek(fd, packetSize, SEEK_CUR);
-    return packetSize;
-}
-
 void reportDuration(
     uint32_t track, uint64_t firstGranulePos, uint64_t lastGranulePos
 ) {
@@ -88,101 +47,69 @@ void reportDuration(
 }
 
 int main(int argc, char **argv) {
-    int fd;
-    ssize_t rd;
-    struct OggPreHeader preHeader;
-    struct stat sbuf;
+    struct OggReader reader;
+    struct OggPage page;
 
     // 1: Find every track
     int foundMeta = 0;
     uint32_t metaStreamNo = 0;
     set<uint32_t> tracks;
-    fd = open(argv[1], O_RDONLY);
-    if (fd < 0) {
+    if (oggReaderOpenFile(&reader, argv[1]) != 0) {
         perror(argv[1]);
         return 1;
     }
-    while (readAll(fd, &preHeader, sizeof(preHeader)) == sizeof(preHeader)) {
-        struct OggHeader oggHeader;
-        if (memcmp(preHeader.capturePattern, "OggS", 4))
-            break;
-        if (readAll(fd, &oggHeader, sizeof(oggHeader)) != sizeof(oggHeader))
-            break;
-
-        uint32_t packetSize = getPacketSize(fd);
+    while (oggReadPage(&reader, &page)) {
+        uint32_t packetSize = page.packetSize;
         if (packetSize == 0)
             continue;
-        if (packetSize < 4096) {
-            unsigned char buf[packetSize];
-            if (readAll(fd, buf, packetSize) != packetSize)
-                break;
-
-            // Look for a meta track
-            if (!foundMeta) {
-                if (packetSize >= 8 && !memcmp(buf, "ECMETA", 6)) {
-                    foundMeta = 1;
-                    metaStreamNo = oggHeader.streamNo;
-                }
+
+        // Look for a meta track
+        if (!foundMeta) {
+            if (packetSize >= 8 && !memcmp(page.data, "ECMETA", 6)) {
+                foundMeta = 1;
+                metaStreamNo = page.header->streamNo;
             }
-        } else {
-            lseek(fd, packetSize, SEEK_CUR);
         }
 
-        if (!foundMeta || oggHeader.streamNo != metaStreamNo)
-            tracks.insert(oggHeader.streamNo);
+        if (!foundMeta || page.header->streamNo != metaStreamNo)
+            tracks.insert(page.header->streamNo);
     }
-    close(fd);
+    oggReaderClose(&reader);
 
     // 2: Open the data
-    fd = open(argv[3], O_RDONLY);
-    if (fd < 0) {
-        perror(argv[3]);
-        return 1;
-    }
-    if (fstat(fd, &sbuf) != 0) {
+    if (oggReaderOpenFile(&reader, argv[3]) != 0) {
         perror(argv[3]);
         return 1;
     }
 
     // 3: Get the starting time
     uint64_t startTime = 0;
-    while (readAll(fd, &preHeader, sizeof(preHeader)) == sizeof(preHeader)) {
-        struct OggHeader oggHeader;
-        if (memcmp(preHeader.capturePattern, "OggS", 4))
-            break;
-        if (readAll(fd, &oggHeader, sizeof(oggHeader)) != sizeof(oggHeader))
-            break;
-        if (skipData(fd) == 0)
+    while (oggReadPage(&reader, &page)) {
+        if (page.packetSize == 0)
             continue;
-        if (oggHeader.granulePos) {
-            startTime = oggHeader.granulePos;
+        if (page.header->granulePos) {
+            startTime = page.header->granulePos;
             break;
         }
     }
 
     // 4: Search for the end of every track
     unordered_map<uint32_t, uint64_t> trackDurations;
-    set<uint32_t> resolvedTracks;
 
-    if (lseek(fd, 0, SEEK_SET) == (off_t) -1) {
+    if (oggReaderSeek(&reader, 0) != 0) {
         perror(argv[3]);
         return 1;
     }
 
     // Look for track ending durations
-    while (readAll(fd, &preHeader, sizeof(preHeader)) == sizeof(preHeader)) {
-        struct OggHeader oggHeader;
-        if (memcmp(preHeader.capturePattern, "OggS", 4))
-            break;
-        if (readAll(fd, &oggHeader, sizeof(oggHeader)) != sizeof(oggHeader))
-            break;
-        if (skipData(fd) == 0)
+    while (oggReadPage(&reader, &page)) {
+        if (page.packetSize == 0)
             continue;
-        if (!tracks.contains(oggHeader.streamNo))
+        if (tracks.find(page.header->streamNo) == tracks.end())
             continue;
-        trackDurations[oggHeader.streamNo] = oggHeader.granulePos;
+        trackDurations[page.header->streamNo] = page.header->granulePos;
     }
-    close(fd);
+    oggReaderClose(&reader);
 
     // 5: Figure out the overall duration
     uint64_t lastGranulePos = 0;
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The packet index (.ogg.idx) written by the recording server alongside the
+ * data file. It's simply one fixed-size entry per page of the data file, in
+ * the same order as the data file, so a tool can find the pages of a
+ * particular stream (or the last page of a stream) without reading all the
+ * data.
+ *
+ * The index and data are written by separate streams, so the index may be
+ * behind (or, briefly, ahead of) the data. oggIndexLoad accounts for that.
+ *
+ * A recording may instead be in the per-stream layout (written by the server
+ * with perStreamData, or converted by oggrepack), in which each stream's pages
+ * are in their own file, <data>.<stream no> (e.g. 123.ogg.data.1), and there
+ * is no <data> file at all. The index is the same, still in the order the
+ * pages were recorded, but each entry's offset is into its own stream's file.
+ * oggStreamFiles finds those files, and only opens the ones that are read.
+ */
+
+#ifndef OGGINDEX_H
+#define OGGINDEX_H 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "oggpage.h"
+
+/* NOTE: Like the rest of the cook tools, this assumes little-endian */
+
+struct OggIndexEntry {
+    uint64_t offset;
+    uint64_t granulePos;
+    uint32_t streamNo;
+    uint16_t packetSize;
+    unsigned char flags;
+    unsigned char segmentCount;
+} __attribute__((packed));
+
+// Size of the page described by this entry
+#define OGG_INDEX_PAGE_SIZE(e) (27 + (uint64_t) (e)->segmentCount + (e)->packetSize)
+
+static inline ssize_t oggIndexPreadAll(int fd, void *vbuf, size_t count, off_t offset)
+{
+    unsigned char *buf = (unsigned char *) vbuf;
+    ssize_t rd = 0, ret;
+    while ((size_t) rd < count) {
+        ret = pread(fd, buf + rd, count - rd, offset + rd);
+        if (ret <= 0) return ret;
+        rd += ret;
+    }
+    return rd;
+}
+
+/* Load the index for the given data file. Returns a malloc'd array of entries
+ * (or NULL on failure) and sets *count. Any pages in the data file that
+ * aren't yet in the index are found by scanning the data file from the end of
+ * the index. */
+static inline struct OggIndexEntry *oggIndexLoad(const char *idxFile, int dataFd, size_t *count)
+{
+    FILE *f;
+    struct stat sbuf;
+    struct OggIndexEntry *ret = NULL;
+    size_t ct = 0, sz = 0;
+    uint64_t dataSize, end = 0;
+    unsigned char page[27 + 255];
+
+    if (fstat(dataFd, &sbuf) != 0)
+        return NULL;
+    dataSize = sbuf.st_size;
+
+    f = fopen(idxFile, "rb");
+    if (!f)
+        return NULL;
+    if (fstat(fileno(f), &sbuf) == 0) {
+        sz = sbuf.st_size / sizeof(struct OggIndexEntry) + 1;
+        ret = (struct OggIndexEntry *) malloc(sz * sizeof(struct OggIndexEntry));
+        if (!ret) {
+            fclose(f);
+            return NULL;
+        }
+        ct = fread(ret, sizeof(struct OggIndexEntry), sz, f);
+    }
+    fclose(f);
+
+    // Drop anything that refers to data that isn't there yet
+    while (ct && ret[ct-1].offset + OGG_INDEX_PAGE_SIZE(&ret[ct-1]) > dataSize)
+        ct--;
+    if (ct)
+        end = ret[ct-1].offset + OGG_INDEX_PAGE_SIZE(&ret[ct-1]);
+
+    // Then find anything that isn't indexed
+    while (end + 27 <= dataSize) {
+        struct OggIndexEntry *e;
+        uint32_t packetSize = 0;
+        unsigned char segmentCount;
+
+        if (oggIndexPreadAll(dataFd, page, 27, end) != 27 ||
+            memcmp(page, "OggS", 4))
+            break;
+        segmentCount = page[26];
+        if (oggIndexPreadAll(dataFd, page + 27, segmentCount, end + 27) != segmentCount)
+            break;
+        for (int i = 0; i < segmentCount; i++)
+            packetSize += page[27 + i];
+        if (end + 27 + segmentCount + packetSize > dataSize)
+            break;
+
+        if (ct >= sz) {
+            sz = sz * 2 + 1024;
+            e = (struct OggIndexEntry *) realloc(ret, sz * sizeof(struct OggIndexEntry));
+            if (!e) {
+                free(ret);
+                return NULL;
+            }
+            ret = e;
+        }
+        e = &ret[ct++];
+        e->offset = end;
+        memcpy(&e->granulePos, page + 6, 8);
+        memcpy(&e->streamNo, page + 14, 4);
+        e->packetSize = packetSize;
+        e->flags = page[5];
+        e->segmentCount = segmentCount;
+        end += OGG_INDEX_PAGE_SIZE(e);
+    }
+
+    *count = ct;
+    return ret;
+}
+
+/* The first entry at or after this granule position, by bisection. Pages of
+ * different streams are only roughly in granule order, so callers should
+ * allow some slack. */
+static inline size_t oggIndexBisect(struct OggIndexEntry *index, size_t ct, uint64_t granulePos)
+{
+    size_t lo = 0, hi = ct;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index[mid].granulePos < granulePos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// One stream's file in the per-stream layout
+struct OggStreamFile {
+    uint32_t streamNo;
+    int64_t size; // -1 if it doesn't exist
+    int open;
+    struct OggReader reader;
+};
+
+struct OggStreamFiles {
+    char *data;
+    struct OggStreamFile *files;
+    size_t ct, alloc, last;
+};
+
+/* Prepare to read the per-stream files of this data file (e.g. 123.ogg.data).
+ * Returns 0 if the recording is in the per-stream layout, or -1 if it isn't
+ * (or on failure). */
+static inline int oggStreamFilesOpen(struct OggStreamFiles *files, const char *data)
+{
+    memset(files, 0, sizeof(*files));
+    if (access(data, F_OK) == 0)
+        return -1;
+    files->data = strdup(data);
+    if (!files->data)
+        return -1;
+    return 0;
+}
+
+// Get (but don't open) the file for this stream. Returns NULL on failure.
+static inline struct OggStreamFile *oggStreamFile(struct OggStreamFiles *files, uint32_t streamNo)
+{
+    struct OggStreamFile *file;
+    struct stat sbuf;
+    char *name;
+
+    // Usually the same stream as last time, or near it
+    if (files->last < files->ct && files->files[files->last].streamNo == streamNo)
+        return &files->files[files->last];
+    for (size_t fi = 0; fi < files->ct; fi++) {
+        if (files->files[fi].streamNo == streamNo) {
+            files->last = fi;
+            return &files->files[fi];
+        }
+    }
+
+    if (files->ct >= files->alloc) {
+        size_t alloc = files->alloc ? files->alloc * 2 : 16;
+        file = (struct OggStreamFile *) realloc(files->files, alloc * sizeof(struct OggStreamFile));
+        if (!file)
+            return NULL;
+        files->files = file;
+        files->alloc = alloc;
+    }
+
+    name = (char *) malloc(strlen(files->data) + 12);
+    if (!name)
+        return NULL;
+    sprintf(name, "%s.%u", files->data, streamNo);
+    file = &files->files[files->ct];
+    memset(file, 0, sizeof(*file));
+    file->streamNo = streamNo;
+    file->size = (stat(name, &sbuf) == 0) ? sbuf.st_size : -1;
+    free(name);
+
+    files->last = files->ct++;
+    return file;
+}
+
+/* Get a reader for this stream's file, opening it if needed. Returns NULL on
+ * failure. */
+static inline struct OggReader *oggStreamReader(struct OggStreamFiles *files, uint32_t streamNo)
+{
+    struct OggStreamFile *file = oggStreamFile(files, streamNo);
+    char *name;
+    int ret;
+
+    if (!file)
+        return NULL;
+    if (file->open)
+        return &file->reader;
+
+    name = (char *) malloc(strlen(files->data) + 12);
+    if (!name)
+        return NULL;
+    sprintf(name, "%s.%u", files->data, streamNo);
+    ret = oggReaderOpenFile(&file->reader, name);
+    free(name);
+    if (ret != 0)
+        return NULL;
+    file->open = 1;
+    return &file->reader;
+}
+
+// Close every open file
+static inline void oggStreamFilesClose(struct OggStreamFiles *files)
+{
+    for (size_t fi = 0; fi < files->ct; fi++) {
+        if (files->files[fi].open)
+            oggReaderClose(&files->files[fi].reader);
+    }
+    free(files->files);
+    free(files->data);
+    memset(files, 0, sizeof(*files));
+}
+
+/* Load the index of a recording in the per-stream layout, like oggIndexLoad.
+ * Anything that refers to data that isn't there yet is dropped. Pages that
+ * aren't yet in the index can't be found, but the server writes the index at
+ * the same time as the data, so those are only the last few of a recording
+ * in progress. */
+static inline struct OggIndexEntry *oggIndexLoadStreams(const char *idxFile,
+                                                        struct OggStreamFiles *files,
+                                                        size_t *count)
+{
+    FILE *f;
+    struct stat sbuf;
+    struct OggIndexEntry *ret = NULL;
+    size_t ct = 0, keep = 0;
+
+    f = fopen(idxFile, "rb");
+    if (!f)
+        return NULL;
+    if (fstat(fileno(f), &sbuf) != 0) {
+        fclose(f);
+        return NULL;
+    }
+    ct = sbuf.st_size / sizeof(struct OggIndexEntry);
+    ret = (struct OggIndexEntry *) malloc((ct + 1) * sizeof(struct OggIndexEntry));
+    if (!ret) {
+        fclose(f);
+        return NULL;
+    }
+    ct = fread(ret, sizeof(struct OggIndexEntry), ct, f);
+    fclose(f);
+
+    for (size_t ei = 0; ei < ct; ei++) {
+        struct OggStreamFile *file = oggStreamFile(files, ret[ei].streamNo);
+        if (!file) {
+            free(ret);
+            return NULL;
+        }
+        if (file->size < 0 ||
+            ret[ei].offset + OGG_INDEX_PAGE_SIZE(&ret[ei]) > (uint64_t) file->size)
+            continue;
+        ret[keep++] = ret[ei];
+    }
+
+    *count = keep;
+    return ret;
+}
+
+#endif
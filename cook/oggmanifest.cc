@@ -0,0 +1,431 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Everything a cook needs to know about a recording's tracks, in one JSON
+ * manifest: for each track (in the order oggtracks gives them), its stream
+ * number, codec, sample rate, channel count, VAD level, subtracks and
+ * duration, and the duration of the whole recording. Durations are the same
+ * as oggduration3's.
+ *
+ * With --cache, the manifest is kept next to the recording, as
+ * <recording>.manifest, and reused as long as the data hasn't grown.
+ *
+ * With -l, instead of the manifest, one field is written for each track, one
+ * track per line. The field "total" is the duration of the whole recording.
+ *
+ * Use: oggmanifest [--cache] [-l <field>] <recording>
+ */
+
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "oggindex.h"
+#include "oggpage.h"
+#include "oggtiming.h"
+
+using namespace std;
+
+/* NOTE: This program assumes little-endian for speed, it WILL NOT WORK on a
+ * big-endian system */
+
+struct Track {
+    uint32_t stream;
+    string codec;
+    uint32_t rate;
+    unsigned int channels;
+    unsigned int vad;
+    set<uint32_t> subtracks;
+    string duration;
+};
+
+struct Manifest {
+    uint64_t dataSize;
+    string duration;
+    vector<Track> tracks;
+};
+
+// Format a duration like oggduration3 does
+static string formatDuration(uint64_t firstGranulePos, uint64_t lastGranulePos)
+{
+    ostringstream ss;
+    if (lastGranulePos >= firstGranulePos)
+        lastGranulePos -= firstGranulePos;
+    ss << (lastGranulePos / 48000.0 + 2);
+    return ss.str();
+}
+
+// Find every track in header1, and the meta stream
+static int readHeaders(Manifest &manifest, const string &header1,
+                       bool &foundMeta, uint32_t &metaStreamNo)
+{
+    struct OggReader reader;
+    struct OggPage page;
+
+    if (oggReaderOpenFile(&reader, header1.c_str()) != 0) {
+        perror(header1.c_str());
+        return -1;
+    }
+
+    while (oggReadPage(&reader, &page)) {
+        unsigned char *buf = page.data;
+        uint32_t packetSize = page.packetSize;
+        uint32_t skip = 0;
+        Track track;
+
+        // Is it metadata?
+        if (packetSize >= 8 && !memcmp(buf, "ECMETA", 6)) {
+            foundMeta = true;
+            metaStreamNo = page.header->streamNo;
+            continue;
+        }
+
+        track.stream = page.header->streamNo;
+        track.vad = 0;
+
+        // Is it VAD data?
+        if (packetSize > 8 && !memcmp(buf, "ECVADD", 6)) {
+            skip = 8 + *((unsigned short *) (buf+6));
+            if (packetSize > 10)
+                track.vad = buf[10];
+        }
+        if (packetSize < skip + 5)
+            continue;
+
+        if (!memcmp(buf + skip, "Opus", 4)) {
+            track.codec = "opus";
+            track.rate = 48000;
+            track.channels = (packetSize > skip + 9) ? buf[skip+9] : 1;
+
+        } else if (!memcmp(buf + skip, "\x7f""FLAC", 5)) {
+            track.codec = "flac";
+            track.rate = 48000;
+            track.channels = 1;
+            if (packetSize > skip + 29) {
+                track.rate = ((uint32_t) buf[skip+27] << 12) + ((uint32_t) buf[skip+28] << 4) + ((uint32_t) buf[skip+29] >> 4);
+                track.channels = ((buf[skip+29] >> 1) & 0x7) + 1;
+            }
+
+        } else {
+            continue;
+
+        }
+
+        manifest.tracks.push_back(track);
+    }
+
+    oggReaderClose(&reader);
+    return 0;
+}
+
+// Note a subtrack, if this meta packet describes one
+static void metaPacket(Manifest &manifest, const unsigned char *buf,
+                       uint32_t packetSize)
+{
+    char json[128];
+    unsigned int id, subId;
+
+    if (packetSize >= sizeof(json) ||
+        memcmp(buf, "{\"c\":\"subtrack\"", 15))
+        return;
+    memcpy(json, buf, packetSize);
+    json[packetSize] = 0;
+    if (sscanf(json, "{\"c\":\"subtrack\",\"id\":%u,\"subId\":%u}", &id, &subId) != 2)
+        return;
+
+    for (auto &track : manifest.tracks) {
+        if (track.stream == id)
+            track.subtracks.insert(subId);
+    }
+}
+
+/* Find the subtracks, from the meta sidecar if there is one, or the meta pages
+ * in the data otherwise */
+static int readSubtracks(Manifest &manifest, const string &prefix,
+                         uint32_t metaStreamNo)
+{
+    struct OggReader reader;
+    struct OggPage page;
+    string meta = prefix + ".meta", data = prefix + ".data",
+        index = prefix + ".idx";
+
+    if (oggReaderOpenFile(&reader, meta.c_str()) == 0) {
+        while (oggReadPage(&reader, &page))
+            metaPacket(manifest, page.data, page.packetSize);
+        oggReaderClose(&reader);
+        return 0;
+    }
+
+    if (oggReaderOpenFile(&reader, data.c_str()) != 0) {
+        perror(data.c_str());
+        return -1;
+    }
+
+    if (access(index.c_str(), R_OK) == 0) {
+        size_t indexCt;
+        struct OggIndexEntry *entries =
+            oggIndexLoad(index.c_str(), reader.fd, &indexCt);
+        if (!entries) {
+            perror(index.c_str());
+            return -1;
+        }
+        for (size_t ei = 0; ei < indexCt; ei++) {
+            if (entries[ei].streamNo != metaStreamNo || !entries[ei].packetSize)
+                continue;
+            if (oggReaderSeek(&reader, entries[ei].offset) == 0 &&
+                oggReadPage(&reader, &page))
+                metaPacket(manifest, page.data, page.packetSize);
+        }
+        free(entries);
+
+    } else {
+        while (oggReadPage(&reader, &page)) {
+            if (page.header->streamNo == metaStreamNo)
+                metaPacket(manifest, page.data, page.packetSize);
+        }
+
+    }
+
+    oggReaderClose(&reader);
+    return 0;
+}
+
+static int makeManifest(Manifest &manifest, const string &prefix)
+{
+    string header1 = prefix + ".header1", data = prefix + ".data",
+        index = prefix + ".idx", meta = prefix + ".meta";
+    bool foundMeta = false;
+    uint32_t metaStreamNo = 0;
+    OggTiming timing;
+
+    if (readHeaders(manifest, header1, foundMeta, metaStreamNo) != 0)
+        return -1;
+    if (foundMeta && readSubtracks(manifest, prefix, metaStreamNo) != 0)
+        return -1;
+
+    if (access(index.c_str(), R_OK) != 0)
+        index = "";
+    if (oggTiming(timing, header1, data, index, meta) != 0)
+        return -1;
+
+    manifest.duration = formatDuration(timing.startTime, timing.lastGranulePos);
+    for (auto &track : manifest.tracks) {
+        const auto &durationIt = timing.trackDurations.find(track.stream);
+        uint64_t duration = 0;
+        if (durationIt != timing.trackDurations.end())
+            duration = durationIt->second;
+        track.duration = formatDuration(timing.startTime, duration);
+    }
+
+    return 0;
+}
+
+static void writeManifest(ostream &out, const Manifest &manifest)
+{
+    out << "{\"dataSize\":" << manifest.dataSize <<
+        ",\"duration\":" << manifest.duration << "," << endl <<
+        "\"tracks\":[" << endl;
+    for (size_t ti = 0; ti < manifest.tracks.size(); ti++) {
+        const Track &track = manifest.tracks[ti];
+        bool first = true;
+        out << (ti ? "," : "") <<
+            "{\"stream\":" << track.stream <<
+            ",\"codec\":\"" << track.codec << "\"" <<
+            ",\"rate\":" << track.rate <<
+            ",\"channels\":" << track.channels <<
+            ",\"vad\":" << track.vad <<
+            ",\"subtracks\":[";
+        for (auto subtrack : track.subtracks) {
+            out << (first ? "" : ",") << subtrack;
+            first = false;
+        }
+        out << "],\"duration\":" << track.duration << "}" << endl;
+    }
+    out << "]}" << endl;
+}
+
+// Get the value of this field from one line of a manifest we wrote
+static string field(const string &line, const string &name)
+{
+    string key = "\"" + name + "\":";
+    size_t start = line.find(key), end;
+    if (start == string::npos)
+        return "";
+    start += key.size();
+    if (line[start] == '[')
+        end = line.find(']', start) + 1;
+    else
+        end = line.find_first_of(",}", start);
+    return line.substr(start, end - start);
+}
+
+// Read a manifest we wrote before
+static bool readManifest(Manifest &manifest, istream &in)
+{
+    string line;
+    if (!getline(in, line))
+        return false;
+    manifest.dataSize = strtoull(field(line, "dataSize").c_str(), NULL, 10);
+    manifest.duration = field(line, "duration");
+
+    while (getline(in, line)) {
+        Track track;
+        string codec, subtracks;
+        if (line.find("\"stream\":") == string::npos)
+            continue;
+        track.stream = strtoul(field(line, "stream").c_str(), NULL, 10);
+        codec = field(line, "codec");
+        track.codec = codec.substr(1, codec.size() - 2);
+        track.rate = strtoul(field(line, "rate").c_str(), NULL, 10);
+        track.channels = strtoul(field(line, "channels").c_str(), NULL, 10);
+        track.vad = strtoul(field(line, "vad").c_str(), NULL, 10);
+        subtracks = field(line, "subtracks");
+        for (const char *p = subtracks.c_str(); *p; p++) {
+            if (*p >= '0' && *p <= '9') {
+                char *end;
+                track.subtracks.insert(strtoul(p, &end, 10));
+                p = end - 1;
+            }
+        }
+        track.duration = field(line, "duration");
+        manifest.tracks.push_back(track);
+    }
+    return true;
+}
+
+static void usage()
+{
+    cerr << "Use: oggmanifest [--cache] [-l <field>] <recording>" << endl;
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    bool cache = false;
+    string listField, prefix;
+    Manifest manifest;
+    bool cached = false;
+    struct stat sbuf;
+    int ai;
+
+    for (ai = 1; ai < argc && argv[ai][0] == '-'; ai++) {
+        if (!strcmp(argv[ai], "--cache")) {
+            cache = true;
+        } else if (!strcmp(argv[ai], "-l") && ai + 1 < argc) {
+            listField = argv[++ai];
+        } else {
+            usage();
+        }
+    }
+    if (ai >= argc)
+        usage();
+    prefix = argv[ai];
+
+    /* The size of the data is how we know if the recording has changed. In the
+     * per-stream layout, there's no one data file, but the index grows with
+     * it. */
+    if (stat((prefix + ".data").c_str(), &sbuf) != 0 &&
+        stat((prefix + ".idx").c_str(), &sbuf) != 0) {
+        perror((prefix + ".data").c_str());
+        return 1;
+    }
+
+    // Use the cache if it's still right
+    if (cache) {
+        FILE *f = fopen((prefix + ".manifest").c_str(), "r");
+        if (f) {
+            string contents;
+            char buf[4096];
+            size_t rd;
+            while ((rd = fread(buf, 1, sizeof(buf), f)) > 0)
+                contents.append(buf, rd);
+            fclose(f);
+
+            istringstream in(contents);
+            cached = readManifest(manifest, in) &&
+                manifest.dataSize == (uint64_t) sbuf.st_size;
+            if (!cached)
+                manifest = Manifest();
+        }
+    }
+
+    if (!cached) {
+        manifest.dataSize = sbuf.st_size;
+        if (makeManifest(manifest, prefix) != 0)
+            return 1;
+
+        if (cache) {
+            // Write it atomically, but it's fine if we can't write it at all
+            ostringstream tmpName;
+            tmpName << prefix << ".manifest.tmp" << getpid();
+            FILE *f = fopen(tmpName.str().c_str(), "w");
+            if (f) {
+                ostringstream out;
+                writeManifest(out, manifest);
+                if (fwrite(out.str().c_str(), 1, out.str().size(), f) == out.str().size() &&
+                    fclose(f) == 0)
+                    rename(tmpName.str().c_str(), (prefix + ".manifest").c_str());
+                else
+                    unlink(tmpName.str().c_str());
+            }
+        }
+    }
+
+    if (listField.empty()) {
+        writeManifest(cout, manifest);
+
+    } else if (listField == "total") {
+        cout << manifest.duration << endl;
+
+    } else {
+        for (auto &track : manifest.tracks) {
+            if (listField == "stream") {
+                cout << track.stream;
+            } else if (listField == "codec") {
+                cout << track.codec;
+            } else if (listField == "rate") {
+                cout << track.rate;
+            } else if (listField == "channels") {
+                cout << track.channels;
+            } else if (listField == "vad") {
+                cout << track.vad;
+            } else if (listField == "subtracks") {
+                bool first = true;
+                for (auto subtrack : track.subtracks) {
+                    cout << (first ? "" : " ") << subtrack;
+                    first = false;
+                }
+            } else if (listField == "duration") {
+                cout << track.duration;
+            } else {
+                usage();
+            }
+            cout << endl;
+        }
+
+    }
+
+    return 0;
+}
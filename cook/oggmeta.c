@@ -23,37 +23,14 @@
 #include <sys/select.h>
 #include <unistd.h>
 
+#include "oggpage.h"
+
 /* NOTE: We don't use libogg here because the behavior of this program is so
  * trivial, the added memory bandwidth of using it is just a waste of energy */
 
 /* NOTE: This program assumes little-endian for speed, it WILL NOT WORK on a
  * big-endian system */
 
-struct OggPreHeader {
-    unsigned char capturePattern[4];
-    unsigned char version;
-} __attribute__((packed));
-
-struct OggHeader {
-    unsigned char type;
-    uint64_t granulePos;
-    uint32_t streamNo;
-    uint32_t sequenceNo;
-    uint32_t crc;
-} __attribute__((packed));
-
-ssize_t readAll(int fd, void *vbuf, size_t count)
-{
-    unsigned char *buf = (unsigned char *) vbuf;
-    ssize_t rd = 0, ret;
-    while (rd < count) {
-        ret = read(fd, buf + rd, count - rd);
-        if (ret <= 0) return ret;
-        rd += ret;
-    }
-    return rd;
-}
-
 ssize_t writeAll(int fd, const void *vbuf, size_t count)
 {
     const unsigned char *buf = (const unsigned char *) vbuf;
@@ -79,72 +56,119 @@ ssize_t writeAll(int fd, const void *vbuf, size_t count)
     return wt;
 }
 
-int main(int argc, char **argv)
+/* Read the meta pages from this input, writing them out as JSON. If sidecar
+ * is set, the input is a .meta file, which has only meta pages (and no
+ * headers). */
+void readMeta(struct OggReader *reader, int sidecar, int *foundMeta,
+              uint32_t *keepStreamNo, uint64_t *granuleOffset)
 {
-    int foundMeta = 0;
-    uint32_t keepStreamNo;
-    uint64_t granuleOffset = 0;
     uint32_t packetSize;
-    unsigned char segmentCount, segmentVal;
-    unsigned char *buf = NULL;
-    uint32_t bufSz = 0;
-    struct OggPreHeader preHeader;
-
-    while (readAll(0, &preHeader, sizeof(preHeader)) == sizeof(preHeader)) {
-        struct OggHeader oggHeader;
-        if (memcmp(preHeader.capturePattern, "OggS", 4))
-            break;
-
-        // It's an ogg header, get the header data
-        if (readAll(0, &oggHeader, sizeof(oggHeader)) != sizeof(oggHeader))
-            break;
-
-        // Get the data size
-        packetSize = 0;
-        if (readAll(0, &segmentCount, 1) != 1)
-            break;
-        for (; segmentCount; segmentCount--) {
-            if (readAll(0, &segmentVal, 1) != 1)
-                break;
-            packetSize += (uint32_t) segmentVal;
-        }
+    unsigned char *buf;
+    struct OggPage page;
 
-        // Get the data
-        if (packetSize > bufSz) {
-            buf = realloc(buf, packetSize);
-            if (!buf)
-                break;
-            bufSz = packetSize;
-        }
-        if (readAll(0, buf, packetSize) != packetSize)
-            break;
+    while (oggReadPage(reader, &page)) {
+        struct OggHeader oggHeader = *page.header;
+        buf = page.data;
+        packetSize = page.packetSize;
 
         // Handle headers
         if (oggHeader.granulePos == 0) {
             if (packetSize >= 8 && !memcmp(buf, "ECMETA", 6)) {
                 // Found our meta track
-                foundMeta = 1;
-                keepStreamNo = oggHeader.streamNo;
+                *foundMeta = 1;
+                *keepStreamNo = oggHeader.streamNo;
             }
             continue;
         }
 
-        // Get the offset if applicable
-        if (!granuleOffset && oggHeader.granulePos)
-            granuleOffset = oggHeader.granulePos;
+        if (sidecar && !*foundMeta) {
+            // Everything in the sidecar is meta
+            *foundMeta = 1;
+            *keepStreamNo = oggHeader.streamNo;
+        }
+
+        /* Get the offset if applicable. Data is only recorded after the start
+         * is written to the meta track, so the sidecar's first page is also
+         * the data's first page. */
+        if (!*granuleOffset && oggHeader.granulePos)
+            *granuleOffset = oggHeader.granulePos;
 
         // Is this on our meta track?
-        if (!foundMeta || oggHeader.streamNo != keepStreamNo)
+        if (!*foundMeta || oggHeader.streamNo != *keepStreamNo)
             continue;
 
         // Adjust the granule pos
-        if (oggHeader.granulePos < granuleOffset)
+        if (oggHeader.granulePos < *granuleOffset)
             continue;
-        oggHeader.granulePos -= granuleOffset;
+        oggHeader.granulePos -= *granuleOffset;
 
         // Now write it out
-        printf("{\"t\":%lu,\"o\":%lu,\"d\":%.*s}\n", oggHeader.granulePos, granuleOffset, packetSize, buf);
+        printf("{\"t\":%lu,\"o\":%lu,\"d\":%.*s}\n", oggHeader.granulePos, *granuleOffset, packetSize, buf);
+    }
+}
+
+// Open a file for reading, or die
+void openOrDie(struct OggReader *reader, const char *path)
+{
+    if (oggReaderOpenFile(reader, path) != 0) {
+        perror(path);
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int foundMeta = 0;
+    uint32_t keepStreamNo = 0;
+    uint64_t granuleOffset = 0;
+    struct OggReader reader;
+
+    if (argc > 2 && !strcmp(argv[1], "--io")) {
+        // Choose how to read
+        if (oggReaderParsePolicy(argv[2]) != 0) {
+            fprintf(stderr, "Use: oggmeta [--io <map|stream|direct>[:<read-ahead>]] [recording]\n");
+            return 1;
+        }
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (argc > 1) {
+        // Read the recording's files directly
+        const char *prefix = argv[1];
+        char *path = malloc(strlen(prefix) + 9);
+        if (!path) {
+            perror("malloc");
+            return 1;
+        }
+
+        sprintf(path, "%s.meta", prefix);
+        if (access(path, R_OK) == 0) {
+            // There's a sidecar, so we don't need the data at all
+            openOrDie(&reader, path);
+            readMeta(&reader, 1, &foundMeta, &keepStreamNo, &granuleOffset);
+            oggReaderClose(&reader);
+
+        } else {
+            static const char *footers[] = {"header1", "header2", "data"};
+            for (int fi = 0; fi < 3; fi++) {
+                sprintf(path, "%s.%s", prefix, footers[fi]);
+                openOrDie(&reader, path);
+                readMeta(&reader, 0, &foundMeta, &keepStreamNo, &granuleOffset);
+                oggReaderClose(&reader);
+            }
+
+        }
+
+        free(path);
+        return 0;
+    }
+
+    if (oggReaderOpen(&reader, 0) != 0) {
+        perror("stdin");
+        return 1;
     }
+    readMeta(&reader, 0, &foundMeta, &keepStreamNo, &granuleOffset);
 
     return 0;
 }
@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "oggpage.h"
+
+/* Size of our buffer when we can't map the input. Must be comfortably larger
+ * than the largest possible page (27 + 255 + 255*255 bytes). */
+#define READ_BUF_SIZE (1024*1024)
+
+// The smallest buffer we'll use, whatever read-ahead is asked for
+#define MIN_READ_BUF_SIZE (256*1024)
+
+// Alignment of buffers and offsets for O_DIRECT
+#define DIRECT_ALIGN 4096
+
+// The policy for files opened from now on
+static enum OggReaderPolicy readPolicy = OGG_READ_MAP;
+static size_t readAheadSize = READ_BUF_SIZE;
+
+void oggReaderSetPolicy(enum OggReaderPolicy policy, size_t readAhead)
+{
+    readPolicy = policy;
+    readAheadSize = readAhead ? readAhead : READ_BUF_SIZE;
+    if (readAheadSize < MIN_READ_BUF_SIZE)
+        readAheadSize = MIN_READ_BUF_SIZE;
+}
+
+int oggReaderParsePolicy(const char *arg)
+{
+    enum OggReaderPolicy policy;
+    size_t len = strcspn(arg, ":");
+    unsigned long long readAhead = 0;
+
+    if (len == 3 && !strncmp(arg, "map", len))
+        policy = OGG_READ_MAP;
+    else if (len == 6 && !strncmp(arg, "stream", len))
+        policy = OGG_READ_STREAM;
+    else if (len == 6 && !strncmp(arg, "direct", len))
+        policy = OGG_READ_DIRECT;
+    else
+        return -1;
+
+    if (arg[len] == ':') {
+        char *end;
+        readAhead = strtoull(arg + len + 1, &end, 10);
+        if (*end == 'K' || *end == 'k') {
+            readAhead *= 1024;
+            end++;
+        } else if (*end == 'M' || *end == 'm') {
+            readAhead *= 1024*1024;
+            end++;
+        }
+        if (*end || !readAhead)
+            return -1;
+    }
+
+    oggReaderSetPolicy(policy, readAhead);
+    return 0;
+}
+
+/* Set up a regular file to be read according to the policy, rather than
+ * mapped. Returns the buffer size to use. */
+static size_t openPolicy(struct OggReader *reader)
+{
+    int flags;
+
+    reader->policy = OGG_READ_STREAM;
+    reader->dropFrom = reader->offset;
+    posix_fadvise(reader->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    reader->syscalls++;
+
+    if (readPolicy == OGG_READ_DIRECT) {
+        void *directBuf;
+        size_t size = (readAheadSize + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+        flags = fcntl(reader->fd, F_GETFL);
+        if (flags >= 0 && posix_memalign(&directBuf, DIRECT_ALIGN, size) == 0) {
+            if (fcntl(reader->fd, F_SETFL, flags | O_DIRECT) == 0) {
+                reader->policy = OGG_READ_DIRECT;
+                reader->directBuf = (unsigned char *) directBuf;
+                reader->directBufSize = size;
+            } else {
+                free(directBuf);
+            }
+        }
+    }
+
+    return readAheadSize;
+}
+
+int oggReaderOpen(struct OggReader *reader, int fd)
+{
+    struct stat sbuf;
+    off_t start;
+    size_t bufSize = READ_BUF_SIZE;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+
+    // Start wherever the file descriptor was
+    start = lseek(fd, 0, SEEK_CUR);
+    if (start > 0)
+        reader->offset = start;
+
+    if (fstat(fd, &sbuf) == 0 && S_ISREG(sbuf.st_mode)) {
+        if (readPolicy != OGG_READ_MAP) {
+            // Read it according to the policy
+            bufSize = openPolicy(reader);
+
+        } else if (sbuf.st_size > 0) {
+            // Map it if we can
+            void *map = mmap(NULL, sbuf.st_size, PROT_READ|PROT_WRITE,
+                             MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                reader->map = (unsigned char *) map;
+                reader->mapSize = sbuf.st_size;
+                return 0;
+            }
+
+        }
+    }
+
+    // Otherwise, buffer it
+    reader->buf = (unsigned char *) malloc(bufSize);
+    if (!reader->buf)
+        return -1;
+    reader->bufSize = bufSize;
+    return 0;
+}
+
+int oggReaderOpenGrowing(struct OggReader *reader, int fd)
+{
+    off_t start;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+    start = lseek(fd, 0, SEEK_CUR);
+    if (start > 0)
+        reader->offset = start;
+
+    reader->buf = (unsigned char *) malloc(READ_BUF_SIZE);
+    if (!reader->buf)
+        return -1;
+    reader->bufSize = READ_BUF_SIZE;
+    return 0;
+}
+
+int oggReaderOpenFile(struct OggReader *reader, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (oggReaderOpen(reader, fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    reader->ownFd = 1;
+    return 0;
+}
+
+/* Drop what we've read, up to this offset, from the page cache, once there's
+ * enough of it to be worth a syscall (or regardless, if force is set) */
+static void dropRead(struct OggReader *reader, uint64_t to, int force)
+{
+    if (reader->policy != OGG_READ_STREAM || to <= reader->dropFrom)
+        return;
+    if (!force && to - reader->dropFrom < reader->bufSize / 2)
+        return;
+    posix_fadvise(reader->fd, reader->dropFrom, to - reader->dropFrom,
+                  POSIX_FADV_DONTNEED);
+    reader->syscalls++;
+    reader->dropFrom = to;
+}
+
+/* Read up to count bytes at this offset with O_DIRECT, through the aligned
+ * buffer. What's left in the aligned buffer from the last read is used first,
+ * so reading a file in order reads each block of it once. Returns the amount
+ * read, which is less at the end of the file, or -1 on error. */
+static ssize_t directRead(struct OggReader *reader, unsigned char *dst,
+                          size_t count, uint64_t from)
+{
+    size_t done = 0;
+    while (done < count) {
+        uint64_t pos = from + done;
+        size_t skip, part;
+
+        if (pos < reader->directOffset ||
+            pos >= reader->directOffset + reader->directLen) {
+            // Not in the buffer, so read the aligned block it's in
+            uint64_t aligned = pos & ~((uint64_t) DIRECT_ALIGN - 1);
+            ssize_t rd = pread(reader->fd, reader->directBuf,
+                               reader->directBufSize, aligned);
+            reader->syscalls++;
+            if (rd < 0 && errno == EINTR)
+                continue;
+            if (rd < 0)
+                return done ? (ssize_t) done : -1;
+            reader->directOffset = aligned;
+            reader->directLen = rd;
+            if (pos >= aligned + rd)
+                break;
+        }
+
+        skip = pos - reader->directOffset;
+        part = reader->directLen - skip;
+        if (part > count - done)
+            part = count - done;
+        memcpy(dst + done, reader->directBuf + skip, part);
+        done += part;
+
+        // A short read means the end of the file
+        if (reader->directLen < reader->directBufSize)
+            break;
+    }
+    return done;
+}
+
+void oggReaderClose(struct OggReader *reader)
+{
+    if (reader->map)
+        munmap(reader->map, reader->mapSize);
+    dropRead(reader, reader->offset + (reader->bufEnd - reader->bufStart), 1);
+    if (reader->policy == OGG_READ_DIRECT && !reader->ownFd)
+        fcntl(reader->fd, F_SETFL, fcntl(reader->fd, F_GETFL) & ~O_DIRECT);
+    free(reader->directBuf);
+    free(reader->buf);
+    if (reader->ownFd)
+        close(reader->fd);
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = -1;
+}
+
+int64_t oggReaderSize(struct OggReader *reader)
+{
+    struct stat sbuf;
+    if (reader->map)
+        return reader->mapSize;
+    if (fstat(reader->fd, &sbuf) != 0 || !S_ISREG(sbuf.st_mode))
+        return -1;
+    return sbuf.st_size;
+}
+
+int oggReaderSeek(struct OggReader *reader, uint64_t offset)
+{
+    if (reader->map) {
+        if (offset > reader->mapSize)
+            return -1;
+        reader->offset = offset;
+        return 0;
+    }
+
+    // Maybe it's already in our buffer
+    if (offset >= reader->offset - reader->bufStart &&
+        offset <= reader->offset + (reader->bufEnd - reader->bufStart)) {
+        reader->bufStart = offset - (reader->offset - reader->bufStart);
+        reader->offset = offset;
+        return 0;
+    }
+
+    // We're done with what we read
+    dropRead(reader, reader->offset + (reader->bufEnd - reader->bufStart), 1);
+    reader->dropFrom = offset;
+
+    reader->syscalls++;
+    if (lseek(reader->fd, offset, SEEK_SET) == (off_t) -1)
+        return -1;
+    reader->bufStart = reader->bufEnd = 0;
+    reader->offset = offset;
+    return 0;
+}
+
+/* Get a pointer to the next count bytes of input, or NULL if there aren't
+ * that many */
+static unsigned char *peek(struct OggReader *reader, size_t count)
+{
+    if (reader->map) {
+        if (reader->offset + count > reader->mapSize)
+            return NULL;
+        return reader->map + reader->offset;
+    }
+
+    if (reader->bufEnd - reader->bufStart < count) {
+        // Everything before here has been read
+        dropRead(reader, reader->offset, 0);
+
+        // Move what we have to the start of the buffer, then fill it
+        if (reader->bufStart) {
+            memmove(reader->buf, reader->buf + reader->bufStart,
+                    reader->bufEnd - reader->bufStart);
+            reader->bufEnd -= reader->bufStart;
+            reader->bufStart = 0;
+        }
+
+        while (reader->bufEnd < count) {
+            ssize_t rd;
+            if (reader->policy == OGG_READ_DIRECT) {
+                rd = directRead(reader, reader->buf + reader->bufEnd,
+                                reader->bufSize - reader->bufEnd,
+                                reader->offset + reader->bufEnd);
+            } else {
+                rd = read(reader->fd, reader->buf + reader->bufEnd,
+                          reader->bufSize - reader->bufEnd);
+                reader->syscalls++;
+            }
+            if (rd < 0 && errno == EINTR)
+                continue;
+            if (rd <= 0)
+                return NULL;
+            reader->bufEnd += rd;
+        }
+    }
+
+    return reader->buf + reader->bufStart;
+}
+
+int oggReadPage(struct OggReader *reader, struct OggPage *page)
+{
+    unsigned char *p;
+    uint32_t packetSize = 0;
+    unsigned char segmentCount;
+
+    // Check the pre-header and get the segment count
+    p = peek(reader, 27);
+    if (!p || memcmp(p, "OggS", 4))
+        return 0;
+    segmentCount = p[26];
+
+    // Get the data size
+    p = peek(reader, 27 + segmentCount);
+    if (!p)
+        return 0;
+    for (int i = 0; i < segmentCount; i++)
+        packetSize += p[27 + i];
+
+    // And the data itself
+    p = peek(reader, 27 + segmentCount + packetSize);
+    if (!p)
+        return 0;
+
+    page->offset = reader->offset;
+    page->header = (struct OggHeader *) (p + sizeof(struct OggPreHeader));
+    page->segmentCount = segmentCount;
+    page->segments = p + 27;
+    page->data = p + 27 + segmentCount;
+    page->packetSize = packetSize;
+    page->pageSize = 27 + segmentCount + packetSize;
+
+    reader->offset += page->pageSize;
+    reader->pagesRead++;
+    reader->bytesRead += page->pageSize;
+    if (!reader->map)
+        reader->bufStart += page->pageSize;
+    return 1;
+}
+
+int64_t oggReaderFindPage(struct OggReader *reader, uint64_t from, uint64_t to)
+{
+    int64_t size = oggReaderSize(reader);
+    if (size < 0)
+        return -1;
+    if (to > (uint64_t) size)
+        to = size;
+
+    while (from + 4 <= to) {
+        const unsigned char *base, *cur, *end;
+        uint64_t baseOffset = from;
+
+        if (reader->map) {
+            base = reader->map + from;
+            end = reader->map + to;
+
+        } else {
+            // Read a chunk to search through
+            size_t count = to - from;
+            ssize_t rd;
+            if (count > reader->bufSize)
+                count = reader->bufSize;
+            // (directRead counts its own reads)
+            if (reader->policy == OGG_READ_DIRECT) {
+                rd = directRead(reader, reader->buf, count, from);
+            } else {
+                rd = pread(reader->fd, reader->buf, count, from);
+                reader->syscalls++;
+            }
+            if (rd < 4)
+                return -1;
+            base = reader->buf;
+            end = reader->buf + rd;
+
+            // Our buffer no longer has what it had
+            reader->bufStart = reader->bufEnd = 0;
+            lseek(reader->fd, reader->offset, SEEK_SET);
+            reader->syscalls++;
+
+        }
+
+        // Look for the pattern
+        cur = base;
+        while (cur + 4 <= end) {
+            cur = (const unsigned char *) memchr(cur, 'O', end - cur - 3);
+            if (!cur)
+                break;
+            if (!memcmp(cur, "OggS", 4))
+                return baseOffset + (cur - base);
+            cur++;
+        }
+
+        // Not in this chunk. Overlap by three in case it crosses chunks.
+        from = baseOffset + (end - base) - 3;
+        if (end - base <= 3)
+            break;
+    }
+
+    return -1;
+}
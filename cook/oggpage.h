@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Ogg page reading shared by the cook tools. Regular files are memory-mapped;
+ * anything else (i.e., pipes) is read in large chunks. Either way, pages are
+ * returned as views of the underlying memory, so reading a page doesn't cost
+ * any syscalls of its own.
+ *
+ * Since the recording hosts cook while they're recording, a reading policy can
+ * be chosen (see oggReaderSetPolicy) so that a big cook doesn't push what the
+ * live recordings need out of the page cache.
+ */
+
+#ifndef OGGPAGE_H
+#define OGGPAGE_H 1
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* NOTE: We don't use libogg here because the behavior of these programs is so
+ * trivial, the added memory bandwidth of using it is just a waste of energy */
+
+/* NOTE: This assumes little-endian for speed, it WILL NOT WORK on a
+ * big-endian system */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct OggPreHeader {
+    unsigned char capturePattern[4];
+    unsigned char version;
+} __attribute__((packed));
+
+struct OggHeader {
+    unsigned char type;
+    uint64_t granulePos;
+    uint32_t streamNo;
+    uint32_t sequenceNo;
+    uint32_t crc;
+} __attribute__((packed));
+
+/* A page, as read. The pointers are into the reader's memory, and are only
+ * valid until the next read from the same reader. The data may be modified in
+ * place (it never modifies the underlying file). */
+struct OggPage {
+    // Offset of this page in the input
+    uint64_t offset;
+
+    struct OggHeader *header;
+    unsigned char segmentCount;
+    const unsigned char *segments;
+    unsigned char *data;
+    uint32_t packetSize;
+
+    // Total size of the page, including headers
+    uint32_t pageSize;
+};
+
+struct OggReader {
+    int fd;
+    int ownFd;
+
+    // If the input is memory-mapped
+    unsigned char *map;
+    uint64_t mapSize;
+
+    // If it isn't, our buffer
+    unsigned char *buf;
+    size_t bufSize, bufStart, bufEnd;
+
+    // Offset of the next page in the input
+    uint64_t offset;
+
+    // What we've read, for statistics
+    uint64_t pagesRead, bytesRead, syscalls;
+
+    /* The policy this reader was opened with (an OggReaderPolicy), and, if
+     * it's dropping what it reads from the page cache, where what it's read
+     * but not yet dropped starts */
+    int policy;
+    uint64_t dropFrom;
+
+    /* With OGG_READ_DIRECT, an aligned buffer for the actual reads, and the
+     * aligned offset and amount of the file last read into it */
+    unsigned char *directBuf;
+    size_t directBufSize, directLen;
+    uint64_t directOffset;
+};
+
+enum OggReaderPolicy {
+    // Map regular files (the default)
+    OGG_READ_MAP = 0,
+
+    /* Read regular files in chunks, telling the kernel it's sequential, and
+     * dropping each chunk from the page cache once we've read past it */
+    OGG_READ_STREAM,
+
+    /* Read regular files in chunks with O_DIRECT, so they never go through the
+     * page cache at all. Falls back to OGG_READ_STREAM where that's not
+     * supported. */
+    OGG_READ_DIRECT
+};
+
+/* Use this policy for files opened from now on, reading readAhead bytes at a
+ * time when not mapping (or the default, 1MB, if 0). Less than 256K is taken
+ * as 256K, since the buffer must hold any page. */
+void oggReaderSetPolicy(enum OggReaderPolicy policy, size_t readAhead);
+
+/* Set the policy from an option: "map", "stream" or "direct", optionally
+ * followed by ":<read-ahead>", in bytes, or with a K or M suffix. As with
+ * oggReaderSetPolicy, the read-ahead is at least 256K. Returns 0 on success,
+ * -1 if it's invalid. */
+int oggReaderParsePolicy(const char *arg);
+
+// Prepare to read from this file descriptor. Returns 0 on success.
+int oggReaderOpen(struct OggReader *reader, int fd);
+
+// Prepare to read from this file. Returns 0 on success.
+int oggReaderOpenFile(struct OggReader *reader, const char *path);
+
+/* Prepare to read from this file descriptor, which is still being written to,
+ * so must not be mapped. A page that isn't completely written yet reads as the
+ * end of input, and can be read once it is. Returns 0 on success. */
+int oggReaderOpenGrowing(struct OggReader *reader, int fd);
+
+void oggReaderClose(struct OggReader *reader);
+
+// Size of the input, or -1 if that's unknowable (i.e., pipes)
+int64_t oggReaderSize(struct OggReader *reader);
+
+/* Move to this offset in the input. Returns 0 on success, or -1 if the input
+ * isn't seekable. */
+int oggReaderSeek(struct OggReader *reader, uint64_t offset);
+
+// Read the next page. Returns 1 if a page was read, 0 at the end of input.
+int oggReadPage(struct OggReader *reader, struct OggPage *page);
+
+/* Find the first capture pattern ("OggS") at or after from and before to.
+ * Returns its offset, or -1 if there is none. Only for seekable inputs. */
+int64_t oggReaderFindPage(struct OggReader *reader, uint64_t from, uint64_t to);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
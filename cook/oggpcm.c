@@ -0,0 +1,486 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Decode a single corrected track (as written by oggcorrect) straight to 24-bit
+ * WAV, padded with silence to the given duration. This does the job of ffmpeg
+ * and wavduration for tracks that don't need any filtering. The zero packets
+ * that oggcorrect uses to fill gaps are written out as silence without being
+ * decoded.
+ *
+ * Use: oggpcm [duration] < track.ogg > track.wav
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <FLAC/stream_decoder.h>
+#include <opus/opus.h>
+
+#include "oggpage.h"
+#include "oggwrite.h"
+#include "oggzero.h"
+
+/* NOTE: This program assumes little-endian for speed. It WILL NOT WORK on a
+ * big-endian system */
+
+// Output buffer size
+#define OUT_BUF_SIZE (1024*1024)
+
+// Largest Opus frame (120ms at 48k)
+#define OPUS_MAX_FRAME 5760
+
+struct Decoder {
+    // 0 for Opus, otherwise the FLAC sample rate
+    uint32_t flacRate;
+    unsigned char channels;
+
+    // Opus
+    OpusDecoder *opus;
+    float *pcm;
+    uint32_t preSkip;
+
+    // FLAC, and the data we're currently feeding it
+    FLAC__StreamDecoder *flac;
+    unsigned char *flacHeaders;
+    size_t flacHeadersSize;
+    const unsigned char *flacIn;
+    size_t flacInSize;
+
+    // Silence, for recognizing gaps
+    const unsigned char *zeroPacket;
+    uint32_t zeroPacketSz;
+    int zeroRun;
+
+    // Output
+    unsigned char *out;
+    size_t outUsed;
+    uint64_t written;
+};
+
+static void flushOut(struct Decoder *dec)
+{
+    if (dec->outUsed &&
+        oggWriteAll(1, dec->out, dec->outUsed) != dec->outUsed)
+        exit(1);
+    dec->outUsed = 0;
+}
+
+// Make room for this many bytes of output
+static unsigned char *reserveOut(struct Decoder *dec, size_t bytes)
+{
+    if (dec->outUsed + bytes > OUT_BUF_SIZE)
+        flushOut(dec);
+    dec->written += bytes;
+    dec->outUsed += bytes;
+    return dec->out + dec->outUsed - bytes;
+}
+
+static inline void putSample(unsigned char *out, int32_t sample)
+{
+    out[0] = sample;
+    out[1] = sample >> 8;
+    out[2] = sample >> 16;
+}
+
+// Write this many frames of silence
+static void writeSilence(struct Decoder *dec, uint64_t frames)
+{
+    uint64_t bytes = frames * dec->channels * 3;
+    while (bytes) {
+        size_t part = (bytes > OUT_BUF_SIZE) ? OUT_BUF_SIZE : bytes;
+        memset(reserveOut(dec, part), 0, part);
+        bytes -= part;
+    }
+}
+
+/* Convert float samples to 24-bit, by scaling to 32-bit with rounding, then
+ * dropping the low 8 bits */
+static void writeFloat(struct Decoder *dec, const float *pcm, int frames)
+{
+    size_t samples = (size_t) frames * dec->channels;
+    unsigned char *out = reserveOut(dec, samples * 3);
+    for (size_t i = 0; i < samples; i++) {
+        long long v = llrintf(pcm[i] * 2147483648.0f);
+        if (v > INT32_MAX)
+            v = INT32_MAX;
+        else if (v < INT32_MIN)
+            v = INT32_MIN;
+        putSample(out + i * 3, (int32_t) v >> 8);
+    }
+}
+
+static FLAC__StreamDecoderReadStatus flacRead(
+    const FLAC__StreamDecoder *flac, FLAC__byte buffer[], size_t *bytes,
+    void *vdec)
+{
+    struct Decoder *dec = (struct Decoder *) vdec;
+    if (!dec->flacInSize) {
+        *bytes = 0;
+        return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+    }
+    if (*bytes > dec->flacInSize)
+        *bytes = dec->flacInSize;
+    memcpy(buffer, dec->flacIn, *bytes);
+    dec->flacIn += *bytes;
+    dec->flacInSize -= *bytes;
+    return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+static FLAC__StreamDecoderWriteStatus flacWrite(
+    const FLAC__StreamDecoder *flac, const FLAC__Frame *frame,
+    const FLAC__int32 *const buffer[], void *vdec)
+{
+    struct Decoder *dec = (struct Decoder *) vdec;
+    uint32_t frames = frame->header.blocksize;
+    uint32_t frameChannels = frame->header.channels;
+    int shift = 24 - (int) frame->header.bits_per_sample;
+    unsigned char *out = reserveOut(dec, (size_t) frames * dec->channels * 3);
+
+    for (uint32_t i = 0; i < frames; i++) {
+        for (uint32_t c = 0; c < dec->channels; c++) {
+            const FLAC__int32 *chan =
+                buffer[(c < frameChannels) ? c : frameChannels - 1];
+            int32_t v = (shift >= 0) ? (chan[i] << shift) : (chan[i] >> -shift);
+            putSample(out, v);
+            out += 3;
+        }
+    }
+
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void flacError(const FLAC__StreamDecoder *flac,
+                      FLAC__StreamDecoderErrorStatus status, void *vdec)
+{
+    // Damaged frames are simply skipped
+}
+
+// Handle a header packet
+static void readHeader(struct Decoder *dec, unsigned char *buf,
+                       uint32_t packetSize)
+{
+    if (packetSize >= 19 && !memcmp(buf, "OpusHead", 8)) {
+        int err;
+        dec->flacRate = 0;
+        dec->channels = buf[9] ? buf[9] : 1;
+        if (dec->channels > 2)
+            dec->channels = 2;
+        dec->preSkip = buf[10] | ((uint32_t) buf[11] << 8);
+        dec->opus = opus_decoder_create(48000, dec->channels, &err);
+        dec->pcm = malloc(OPUS_MAX_FRAME * dec->channels * sizeof(float));
+        if (!dec->opus || !dec->pcm) {
+            fprintf(stderr, "Failed to create Opus decoder\n");
+            exit(1);
+        }
+
+    } else if (packetSize > 29 && !memcmp(buf, "\x7f""FLAC", 5) &&
+               !memcmp(buf + 9, "fLaC", 4)) {
+        // Sample rate and channels from the STREAMINFO
+        dec->flacRate = ((uint32_t) buf[27] << 12) + ((uint32_t) buf[28] << 4) + ((uint32_t) buf[29] >> 4);
+        dec->channels = ((buf[29] >> 1) & 0x7) + 1;
+
+        // The native FLAC stream starts with the fLaC marker
+        dec->flacHeaders = malloc(packetSize - 9);
+        if (!dec->flacHeaders) {
+            perror("malloc");
+            exit(1);
+        }
+        memcpy(dec->flacHeaders, buf + 9, packetSize - 9);
+        dec->flacHeadersSize = packetSize - 9;
+
+    } else if (dec->flacHeaders && packetSize >= 4) {
+        // Another FLAC metadata block
+        dec->flacHeaders = realloc(dec->flacHeaders, dec->flacHeadersSize + packetSize);
+        if (!dec->flacHeaders) {
+            perror("realloc");
+            exit(1);
+        }
+        memcpy(dec->flacHeaders + dec->flacHeadersSize, buf, packetSize);
+        dec->flacHeadersSize += packetSize;
+
+    }
+}
+
+// Start the FLAC decoder, once we have all the headers
+static void startFLAC(struct Decoder *dec)
+{
+    dec->flac = FLAC__stream_decoder_new();
+    if (!dec->flac ||
+        FLAC__stream_decoder_init_stream(dec->flac, flacRead, NULL, NULL,
+            NULL, NULL, flacWrite, NULL, flacError, dec) !=
+        FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+        fprintf(stderr, "Failed to create FLAC decoder\n");
+        exit(1);
+    }
+
+    dec->flacIn = dec->flacHeaders;
+    dec->flacInSize = dec->flacHeadersSize;
+    FLAC__stream_decoder_process_until_end_of_metadata(dec->flac);
+    FLAC__stream_decoder_flush(dec->flac);
+    free(dec->flacHeaders);
+    dec->flacHeaders = NULL;
+}
+
+/* Is this packet (the packetNo'th of the stream) a header? The first is always
+ * the identification header. With Opus, the second is the comments. With FLAC,
+ * it's followed by metadata blocks, which can be told from frames by their lack
+ * of a frame sync code. */
+static int isHeader(struct Decoder *dec, const unsigned char *buf,
+                    uint32_t packetSize, uint64_t packetNo)
+{
+    if (packetNo == 0)
+        return 1;
+    if (dec->flacRate)
+        return !(packetSize >= 2 && buf[0] == 0xFF && (buf[1] & 0xFE) == 0xF8);
+    return (packetNo == 1 && packetSize >= 8 && !memcmp(buf, "OpusTags", 8));
+}
+
+// Decode (or skip) a data packet
+static void readPacket(struct Decoder *dec, unsigned char *buf,
+                       uint32_t packetSize)
+{
+    int zero = (packetSize == dec->zeroPacketSz &&
+                !memcmp(buf, dec->zeroPacket, packetSize));
+
+    if (dec->flacRate) {
+        if (zero) {
+            // FLAC frames are independent, so this is exactly silence
+            writeSilence(dec, (dec->flacRate == 44100) ? 882 : 960);
+            return;
+        }
+
+        if (!dec->flac)
+            startFLAC(dec);
+        dec->flacIn = buf;
+        dec->flacInSize = packetSize;
+        FLAC__stream_decoder_process_single(dec->flac);
+        if (FLAC__stream_decoder_get_state(dec->flac) !=
+            FLAC__STREAM_DECODER_SEARCH_FOR_FRAME_SYNC)
+            FLAC__stream_decoder_flush(dec->flac);
+
+    } else {
+        int frames;
+        float *pcm = dec->pcm;
+
+        if (zero && dec->zeroRun++ && !dec->preSkip) {
+            /* The first zero packet in a run is decoded, to finish off the
+             * audio before it. After that, the decoder's state doesn't change,
+             * so we can just write silence. */
+            writeSilence(dec, 960);
+            return;
+        }
+        if (!zero)
+            dec->zeroRun = 0;
+
+        frames = opus_decode_float(dec->opus, buf, packetSize, pcm,
+                                   OPUS_MAX_FRAME, 0);
+        if (frames <= 0)
+            return;
+
+        if (dec->preSkip) {
+            uint32_t skip = (dec->preSkip > frames) ? frames : dec->preSkip;
+            dec->preSkip -= skip;
+            pcm += skip * dec->channels;
+            frames -= skip;
+        }
+
+        writeFloat(dec, pcm, frames);
+
+    }
+}
+
+// Write a WAV header for this much data
+static void writeWavHeader(struct Decoder *dec, uint64_t bytes)
+{
+    uint32_t sampleRate = dec->flacRate ? dec->flacRate : 48000;
+    unsigned char *out = reserveOut(dec, bytes >= ((uint64_t) 1 << 32) - 36 ? 80 : 44);
+    unsigned char *p = out;
+
+#define PUT(data, size) do { memcpy(p, data, size); p += size; } while (0)
+#define PUT16(v) do { uint16_t x = (v); PUT(&x, 2); } while (0)
+#define PUT32(v) do { uint32_t x = (v); PUT(&x, 4); } while (0)
+#define PUT64(v) do { uint64_t x = (v); PUT(&x, 8); } while (0)
+
+    if (bytes >= ((uint64_t) 1 << 32) - 36) {
+        // Too big for RIFF
+        PUT("RF64", 4);
+        PUT32(-1);
+        PUT("WAVE", 4);
+        PUT("ds64", 4);
+        PUT32(28);
+        PUT64(bytes + 72);
+        PUT64(bytes);
+        PUT64(bytes / 3 / dec->channels);
+        PUT32(0);
+    } else {
+        PUT("RIFF", 4);
+        PUT32(bytes + 36);
+        PUT("WAVE", 4);
+    }
+
+    PUT("fmt ", 4);
+    PUT32(16);
+    PUT16(1);
+    PUT16(dec->channels);
+    PUT32(sampleRate);
+    PUT32(sampleRate * dec->channels * 3);
+    PUT16(dec->channels * 3);
+    PUT16(24);
+
+    PUT("data", 4);
+    PUT32((bytes >= ((uint64_t) 1 << 32) - 36) ? (uint32_t) -1 : (uint32_t) bytes);
+
+#undef PUT
+#undef PUT16
+#undef PUT32
+#undef PUT64
+
+    // The header doesn't count as data
+    dec->written -= p - out;
+}
+
+int main(int argc, char **argv)
+{
+    struct OggReader reader;
+    struct OggPage page;
+    struct Decoder dec = {0};
+    double duration = 6.0*60*60;
+    uint32_t streamNo = 0;
+    int foundStream = 0, started = 0;
+    uint64_t frames, packetNo = 0;
+
+    // A packet that continues onto the next page, as far as we have it
+    unsigned char *partial = NULL;
+    size_t partialSize = 0, partialAlloc = 0;
+
+    if (argc > 1)
+        duration = atof(argv[1]);
+
+    dec.channels = 1;
+    dec.out = malloc(OUT_BUF_SIZE);
+    if (!dec.out) {
+        perror("malloc");
+        return 1;
+    }
+
+    if (oggReaderOpen(&reader, 0) != 0) {
+        perror("stdin");
+        return 1;
+    }
+
+    while (oggReadPage(&reader, &page)) {
+        if (!foundStream) {
+            streamNo = page.header->streamNo;
+            foundStream = 1;
+        } else if (page.header->streamNo != streamNo) {
+            continue;
+        }
+
+        // Anything left over wasn't continued onto this page, so is lost
+        if (!(page.header->type & 1))
+            partialSize = 0;
+
+        /* A page (e.g., packed by oggcorrect) can have several packets, and a
+         * packet can continue onto the next page */
+        for (uint32_t si = 0, start = 0, end = 0; si < page.segmentCount; si++) {
+            unsigned char *buf;
+            uint32_t packetSize;
+
+            end += page.segments[si];
+            if (page.segments[si] == 255) {
+                if (si < page.segmentCount - 1)
+                    continue;
+
+                // Continues onto the next page
+                if (partialSize + (end - start) > partialAlloc) {
+                    partialAlloc = (partialSize + (end - start)) * 2;
+                    partial = realloc(partial, partialAlloc);
+                    if (!partial) {
+                        perror("realloc");
+                        return 1;
+                    }
+                }
+                memcpy(partial + partialSize, page.data + start, end - start);
+                partialSize += end - start;
+                break;
+            }
+
+            buf = page.data + start;
+            packetSize = end - start;
+            start = end;
+            if (partialSize) {
+                // The end of a packet from an earlier page
+                if (partialSize + packetSize > partialAlloc) {
+                    partialAlloc = partialSize + packetSize;
+                    partial = realloc(partial, partialAlloc);
+                    if (!partial) {
+                        perror("realloc");
+                        return 1;
+                    }
+                }
+                memcpy(partial + partialSize, buf, packetSize);
+                buf = partial;
+                packetSize += partialSize;
+                partialSize = 0;
+            }
+
+            if (!started) {
+                if (isHeader(&dec, buf, packetSize, packetNo++)) {
+                    readHeader(&dec, buf, packetSize);
+                    continue;
+                }
+                if (!dec.opus && !dec.flacRate) {
+                    fprintf(stderr, "Unrecognized codec\n");
+                    return 1;
+                }
+
+                // Now we know the format, so we know what a gap looks like
+                dec.zeroPacket = oggZeroPacket(dec.flacRate, dec.channels,
+                                               &dec.zeroPacketSz);
+                frames = duration * (dec.flacRate ? dec.flacRate : 48000);
+                writeWavHeader(&dec, frames * dec.channels * 3);
+                started = 1;
+            }
+
+            readPacket(&dec, buf, packetSize);
+        }
+    }
+    free(partial);
+
+    if (!started) {
+        fprintf(stderr, "No audio found\n");
+        return 1;
+    }
+
+    // Pad to the duration
+    if (dec.written < frames * dec.channels * 3)
+        writeSilence(&dec, frames - dec.written / 3 / dec.channels);
+
+    flushOut(&dec);
+
+    if (dec.opus)
+        opus_decoder_destroy(dec.opus);
+    if (dec.flac)
+        FLAC__stream_decoder_delete(dec.flac);
+    oggReaderClose(&reader);
+    return 0;
+}
@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Convert a finished recording from the interleaved layout (every stream's
+ * pages in <recording>.data) to the per-stream layout described in
+ * oggindex.h, so that cooking one track only reads that track. The pages
+ * themselves are copied as they are. The index is rewritten for the new
+ * layout, and the meta sidecar is written if the recording predates it.
+ *
+ * With --cat, instead write the recording as it would be read by
+ * cat <recording>.header1 <recording>.header2 <recording>.data, from either
+ * layout, for tools that read from stdin.
+ *
+ * This must not be run on a recording that's still being recorded or cooked.
+ * It refuses a recording that it can tell is still being recorded, and leaves
+ * the recording as it was if its data can't all be read.
+ *
+ * Use: oggrepack [--cat] <recording>
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "oggindex.h"
+#include "oggpage.h"
+#include "oggwrite.h"
+
+/* NOTE: This program assumes little-endian for speed, it WILL NOT WORK on a
+ * big-endian system */
+
+// Output buffer size for each stream
+#define STREAM_BUFFER_SIZE 65536
+
+// A stream's file being written
+struct StreamOut {
+    uint32_t streamNo;
+    FILE *f;
+    uint64_t offset;
+};
+
+struct StreamOut *streams = NULL;
+size_t streamCt = 0, streamAlloc = 0;
+
+const char *prefix;
+
+// Allocate a "<prefix><footer>" name, or die trying
+char *fileName(const char *footer)
+{
+    char *name = malloc(strlen(prefix) + strlen(footer) + 1);
+    if (!name) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(name, "%s%s", prefix, footer);
+    return name;
+}
+
+// Open an input file, or die trying
+void openOrDie(struct OggReader *reader, const char *footer)
+{
+    char *name = fileName(footer);
+    if (oggReaderOpenFile(reader, name) != 0) {
+        perror(name);
+        exit(1);
+    }
+    free(name);
+}
+
+// Open an output file, or die trying
+FILE *createOrDie(const char *name)
+{
+    FILE *f = fopen(name, "wb");
+    if (!f) {
+        perror(name);
+        exit(1);
+    }
+    setvbuf(f, NULL, _IOFBF, STREAM_BUFFER_SIZE);
+    return f;
+}
+
+// Write to an output file, or die trying
+void writeOrDie(FILE *f, const void *buf, size_t size)
+{
+    if (fwrite(buf, 1, size, f) != size) {
+        perror("fwrite");
+        exit(1);
+    }
+}
+
+// Close an output file, or die trying
+void closeOrDie(FILE *f)
+{
+    if (fclose(f) != 0) {
+        perror("fclose");
+        exit(1);
+    }
+}
+
+// Rename <prefix><footer>.tmp to <prefix><footer>, or die trying
+void commit(const char *footer)
+{
+    char *name = fileName(footer);
+    char *tmpName = malloc(strlen(name) + 5);
+    if (!tmpName) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(tmpName, "%s.tmp", name);
+    if (rename(tmpName, name) != 0) {
+        perror(name);
+        exit(1);
+    }
+    free(tmpName);
+    free(name);
+}
+
+// Remove <prefix><footer>.tmp
+void discard(const char *footer)
+{
+    char *name = fileName(footer);
+    char *tmpName = malloc(strlen(name) + 5);
+    if (!tmpName) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(tmpName, "%s.tmp", name);
+    unlink(tmpName);
+    free(tmpName);
+    free(name);
+}
+
+/* Is this recording still being recorded? If it was followed, the follower
+ * writes <prefix>.follow/complete when it's over. Otherwise, a read lease
+ * can't be taken on the data while anything (i.e., the recording server) has
+ * it open for writing. If we can't tell, assume it is. */
+int stillRecording(void)
+{
+    char *name;
+    int fd, ret;
+
+    name = fileName(".follow/complete");
+    ret = access(name, F_OK);
+    free(name);
+    if (ret == 0)
+        return 0;
+    name = fileName(".follow");
+    ret = access(name, F_OK);
+    free(name);
+    if (ret == 0)
+        return 1;
+
+    name = fileName(".data");
+    fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        perror(name);
+        exit(1);
+    }
+    free(name);
+    ret = fcntl(fd, F_SETLEASE, F_RDLCK);
+    if (ret == 0)
+        fcntl(fd, F_SETLEASE, F_UNLCK);
+    close(fd);
+    return (ret != 0);
+}
+
+// Get the output for this stream, creating it if needed
+struct StreamOut *getStream(uint32_t streamNo)
+{
+    struct StreamOut *stream;
+    char footer[32];
+    char *name;
+
+    for (size_t si = 0; si < streamCt; si++) {
+        if (streams[si].streamNo == streamNo)
+            return &streams[si];
+    }
+
+    if (streamCt >= streamAlloc) {
+        streamAlloc = streamAlloc ? streamAlloc * 2 : 16;
+        streams = realloc(streams, streamAlloc * sizeof(struct StreamOut));
+        if (!streams) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    stream = &streams[streamCt++];
+    stream->streamNo = streamNo;
+    stream->offset = 0;
+    sprintf(footer, ".data.%u.tmp", streamNo);
+    name = fileName(footer);
+    stream->f = createOrDie(name);
+    free(name);
+    return stream;
+}
+
+// Find the meta stream, from header1
+int findMeta(uint32_t *metaStreamNo)
+{
+    struct OggReader reader;
+    struct OggPage page;
+    int found = 0;
+
+    openOrDie(&reader, ".header1");
+    while (oggReadPage(&reader, &page)) {
+        if (page.packetSize >= 8 && !memcmp(page.data, "ECMETA", 6)) {
+            *metaStreamNo = page.header->streamNo;
+            found = 1;
+            break;
+        }
+    }
+    oggReaderClose(&reader);
+    return found;
+}
+
+// Convert to the per-stream layout
+int repack(void)
+{
+    struct OggReader reader;
+    struct OggPage page;
+    struct OggStreamFiles check;
+    FILE *idx, *meta = NULL;
+    char *name;
+    uint32_t metaStreamNo = 0;
+    int foundMeta;
+
+    name = fileName(".data");
+    if (oggStreamFilesOpen(&check, name) == 0) {
+        fprintf(stderr, "%s: Already in the per-stream layout\n", prefix);
+        return 1;
+    }
+    free(name);
+
+    if (stillRecording()) {
+        fprintf(stderr, "%s: Still being recorded (or can't tell that it isn't)\n",
+                prefix);
+        return 1;
+    }
+
+    foundMeta = findMeta(&metaStreamNo);
+
+    // Only write the sidecar if there isn't one already
+    name = fileName(".meta");
+    if (foundMeta && access(name, F_OK) != 0) {
+        free(name);
+        name = fileName(".meta.tmp");
+        meta = createOrDie(name);
+    }
+    free(name);
+
+    name = fileName(".idx.tmp");
+    idx = createOrDie(name);
+    free(name);
+
+    openOrDie(&reader, ".data");
+    while (oggReadPage(&reader, &page)) {
+        struct StreamOut *stream = getStream(page.header->streamNo);
+        const unsigned char *raw =
+            (const unsigned char *) page.header - sizeof(struct OggPreHeader);
+        struct OggIndexEntry entry;
+
+        entry.offset = stream->offset;
+        entry.granulePos = page.header->granulePos;
+        entry.streamNo = page.header->streamNo;
+        entry.packetSize = page.packetSize;
+        entry.flags = page.header->type;
+        entry.segmentCount = page.segmentCount;
+        writeOrDie(idx, &entry, sizeof(entry));
+
+        writeOrDie(stream->f, raw, page.pageSize);
+        stream->offset += page.pageSize;
+
+        if (meta && page.header->streamNo == metaStreamNo)
+            writeOrDie(meta, raw, page.pageSize);
+    }
+    /* A bad page stops the reading, and everything after it would be lost,
+     * so only carry on if we read it all */
+    if (oggReaderSize(&reader) != (int64_t) reader.offset) {
+        fprintf(stderr, "%s.data: Unreadable at offset %llu, leaving it as it is\n",
+                prefix, (unsigned long long) reader.offset);
+        for (size_t si = 0; si < streamCt; si++) {
+            char footer[32];
+            fclose(streams[si].f);
+            sprintf(footer, ".data.%u", streams[si].streamNo);
+            discard(footer);
+        }
+        if (meta) {
+            fclose(meta);
+            discard(".meta");
+        }
+        fclose(idx);
+        discard(".idx");
+        return 1;
+    }
+    oggReaderClose(&reader);
+
+    // Everything's written, so put it in place, and only then remove the data
+    for (size_t si = 0; si < streamCt; si++) {
+        char footer[32];
+        closeOrDie(streams[si].f);
+        sprintf(footer, ".data.%u", streams[si].streamNo);
+        commit(footer);
+    }
+    if (meta) {
+        closeOrDie(meta);
+        commit(".meta");
+    }
+    closeOrDie(idx);
+    commit(".idx");
+
+    name = fileName(".data");
+    if (unlink(name) != 0) {
+        perror(name);
+        return 1;
+    }
+    free(name);
+
+    return 0;
+}
+
+// Write out a whole file, or die trying
+void catFile(const char *footer)
+{
+    struct OggReader reader;
+    struct OggPage page;
+
+    openOrDie(&reader, footer);
+    while (oggReadPage(&reader, &page)) {
+        if (oggWriteAll(1, (unsigned char *) page.header - sizeof(struct OggPreHeader),
+                        page.pageSize) != page.pageSize)
+            exit(1);
+    }
+    oggReaderClose(&reader);
+}
+
+// Write out the recording as if it were interleaved
+int cat(void)
+{
+    struct OggStreamFiles files;
+    struct OggIndexEntry *index;
+    size_t indexCt;
+    char *name;
+
+    catFile(".header1");
+    catFile(".header2");
+
+    name = fileName(".data");
+    if (oggStreamFilesOpen(&files, name) != 0) {
+        catFile(".data");
+        free(name);
+        return 0;
+    }
+    free(name);
+
+    name = fileName(".idx");
+    index = oggIndexLoadStreams(name, &files, &indexCt);
+    if (!index) {
+        perror(name);
+        return 1;
+    }
+    free(name);
+
+    for (size_t ei = 0; ei < indexCt; ei++) {
+        struct OggReader *reader = oggStreamReader(&files, index[ei].streamNo);
+        struct OggPage page;
+        if (!reader ||
+            oggReaderSeek(reader, index[ei].offset) != 0 ||
+            !oggReadPage(reader, &page)) {
+            fprintf(stderr, "%s: Missing data for stream %u\n", prefix,
+                    index[ei].streamNo);
+            return 1;
+        }
+        if (oggWriteAll(1, (unsigned char *) page.header - sizeof(struct OggPreHeader),
+                        page.pageSize) != page.pageSize)
+            return 1;
+    }
+
+    free(index);
+    oggStreamFilesClose(&files);
+    return 0;
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Use: oggrepack [--cat] <recording>\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3 && !strcmp(argv[1], "--cat")) {
+        prefix = argv[2];
+        return cat();
+    } else if (argc == 2 && argv[1][0] != '-') {
+        prefix = argv[1];
+        return repack();
+    }
+    usage();
+    return 1;
+}
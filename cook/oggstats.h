@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Statistics for the cook tools' --stats=<file> option: wall time per phase,
+ * and named counters, written as a single line of JSON when the tool is done,
+ * e.g.:
+ *
+ * {"tool":"oggcorrect","time":1.5,"phases":{"header":0.01,...},
+ *  "counters":{"bytesRead":123,...}}
+ *
+ * Everything's a no-op if stats weren't asked for, and the tools keep their
+ * own counts regardless, so this costs nothing in the hot paths.
+ */
+
+#ifndef OGGSTATS_H
+#define OGGSTATS_H 1
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "oggpage.h"
+#include "oggwrite.h"
+
+#define OGG_STATS_MAX 32
+
+struct OggStats {
+    // Where we're writing them, or NULL if we're not
+    FILE *out;
+    const char *tool;
+    double start;
+
+    // The current phase
+    int phase;
+    double phaseStart;
+
+    const char *phaseNames[OGG_STATS_MAX];
+    double phaseTimes[OGG_STATS_MAX];
+    int phaseCt;
+
+    const char *counterNames[OGG_STATS_MAX];
+    uint64_t counters[OGG_STATS_MAX];
+    int counterCt;
+};
+
+static double oggStatsNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* Start collecting stats, to be written to this file (or not at all, if it's
+ * NULL). Returns 0 on success. */
+static int oggStatsOpen(struct OggStats *stats, const char *tool, const char *path)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->phase = -1;
+    if (!path)
+        return 0;
+    stats->out = fopen(path, "w");
+    if (!stats->out)
+        return -1;
+    stats->tool = tool;
+    stats->start = oggStatsNow();
+    return 0;
+}
+
+// End the current phase (if any), and start this one (if not NULL)
+static void oggStatsPhase(struct OggStats *stats, const char *name)
+{
+    double now;
+    int i;
+
+    if (!stats->out)
+        return;
+    now = oggStatsNow();
+    if (stats->phase >= 0)
+        stats->phaseTimes[stats->phase] += now - stats->phaseStart;
+    stats->phase = -1;
+    if (!name)
+        return;
+
+    for (i = 0; i < stats->phaseCt; i++) {
+        if (!strcmp(stats->phaseNames[i], name))
+            break;
+    }
+    if (i == stats->phaseCt) {
+        if (i >= OGG_STATS_MAX)
+            return;
+        stats->phaseNames[stats->phaseCt] = name;
+        stats->phaseTimes[stats->phaseCt++] = 0;
+    }
+    stats->phase = i;
+    stats->phaseStart = now;
+}
+
+// Add to a counter
+static void oggStatsAdd(struct OggStats *stats, const char *name, uint64_t value)
+{
+    int i;
+
+    if (!stats->out)
+        return;
+    for (i = 0; i < stats->counterCt; i++) {
+        if (!strcmp(stats->counterNames[i], name)) {
+            stats->counters[i] += value;
+            return;
+        }
+    }
+    if (stats->counterCt >= OGG_STATS_MAX)
+        return;
+    stats->counterNames[stats->counterCt] = name;
+    stats->counters[stats->counterCt++] = value;
+}
+
+// Count everything read by this reader
+static void oggStatsReader(struct OggStats *stats, struct OggReader *reader)
+{
+    oggStatsAdd(stats, "pagesRead", reader->pagesRead);
+    oggStatsAdd(stats, "bytesRead", reader->bytesRead);
+    oggStatsAdd(stats, "readSyscalls", reader->syscalls);
+}
+
+// Count everything written by this writer
+static void oggStatsWriter(struct OggStats *stats, struct OggWriter *writer)
+{
+    oggStatsAdd(stats, "pagesWritten", writer->pagesWritten);
+    oggStatsAdd(stats, "bytesWritten", writer->bytesWritten);
+    oggStatsAdd(stats, "writeSyscalls", writer->syscalls);
+}
+
+// End any phase, and write out the stats
+static void oggStatsClose(struct OggStats *stats)
+{
+    int i;
+
+    if (!stats->out)
+        return;
+    oggStatsPhase(stats, NULL);
+
+    fprintf(stats->out, "{\"tool\":\"%s\",\"time\":%.6f,\"phases\":{",
+            stats->tool, oggStatsNow() - stats->start);
+    for (i = 0; i < stats->phaseCt; i++) {
+        fprintf(stats->out, "%s\"%s\":%.6f", i ? "," : "",
+                stats->phaseNames[i], stats->phaseTimes[i]);
+    }
+    fprintf(stats->out, "},\"counters\":{");
+    for (i = 0; i < stats->counterCt; i++) {
+        fprintf(stats->out, "%s\"%s\":%" PRIu64, i ? "," : "",
+                stats->counterNames[i], stats->counters[i]);
+    }
+    fprintf(stats->out, "}}\n");
+
+    if (fclose(stats->out) != 0)
+        perror("stats");
+    stats->out = NULL;
+}
+
+#endif
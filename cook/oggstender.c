@@ -20,10 +20,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
-#include <sys/select.h>
 #include <unistd.h>
 
-#include "crc32.h"
+#include "oggindex.h"
+#include "oggpage.h"
+#include "oggstats.h"
+#include "oggwrite.h"
 
 /* NOTE: We don't use libogg here because the behavior of this program is so
  * trivial, the added memory bandwidth of using it is just a waste of energy */
@@ -31,19 +33,6 @@
 /* NOTE: This program assumes little-endian for speed, it WILL NOT WORK on a
  * big-endian system */
 
-struct OggPreHeader {
-    unsigned char capturePattern[4];
-    unsigned char version;
-} __attribute__((packed));
-
-struct OggHeader {
-    unsigned char type;
-    uint64_t granulePos;
-    uint32_t streamNo;
-    uint32_t sequenceNo;
-    uint32_t crc;
-} __attribute__((packed));
-
 // The encoding for a packet with only zeroes
 const unsigned char zeroPacket[] = { 0xF8, 0xFF, 0xFE };
 const uint32_t packetTime = 960;
@@ -56,77 +45,188 @@ const unsigned char zeroPacketFLAC48k[] = { 0xFF, 0xF8, 0x7A, 0x0C, 0x00, 0x03,
 const unsigned char zeroPacketFLAC44k[] = { 0xFF, 0xF8, 0x79, 0x0C, 0x00, 0x03,
     0x71, 0x56, 0x00, 0x00, 0x00, 0x00, 0x63, 0xC5 };
 
-ssize_t readAll(int fd, void *vbuf, size_t count)
+/* Pages of different streams arrive out of order by up to this much (in 48k
+ * samples), so we stop reading this long after the end of the range */
+#define RANGE_SLACK (48000*30)
+
+/* With --index, the recording (e.g. 123.ogg) is read through its index (see
+ * oggindex.h) instead of from stdin, and only the pages we need are read: the
+ * first data page (for the granule offset), the meta track (for pauses) and
+ * our own track, only from near the start of the range to near its end. */
+struct Input {
+    int indexed, perStream;
+    struct OggReader readers[3]; // header1, header2, data (or just stdin)
+    struct OggStreamFiles streams;
+    int file, foundMeta, foundFirst;
+    uint32_t keepStreamNo, metaStreamNo;
+    struct OggIndexEntry *index;
+    size_t indexCt, indexCur, indexLo, indexHi;
+};
+
+// Read an Ogg page
+int readInput(struct Input *in, struct OggPage *page,
+              uint64_t *greatestGranulePos)
 {
-    unsigned char *buf = (unsigned char *) vbuf;
-    ssize_t rd = 0, ret;
-    while (rd < count) {
-        ret = read(fd, buf + rd, count - rd);
-        if (ret <= 0) return ret;
-        rd += ret;
+    if (!in->indexed)
+        return oggReadPage(&in->readers[0], page);
+
+    // The header files come first
+    while (in->file < 2) {
+        if (oggReadPage(&in->readers[in->file], page))
+            return 1;
+        in->file++;
+    }
+
+    while (in->indexCur < in->indexHi) {
+        struct OggIndexEntry *entry = &in->index[in->indexCur++];
+        struct OggReader *reader = &in->readers[2];
+
+        if (!in->foundFirst || entry->granulePos == 0) {
+            if (entry->granulePos)
+                in->foundFirst = 1;
+        } else if (!(in->foundMeta && entry->streamNo == in->metaStreamNo) &&
+                   !(entry->streamNo == in->keepStreamNo &&
+                     in->indexCur > in->indexLo)) {
+            /* We don't need this page, but how far the recording has gotten
+             * is how long pauses are */
+            if (entry->granulePos > *greatestGranulePos)
+                *greatestGranulePos = entry->granulePos;
+            continue;
+        }
+
+        if (in->perStream &&
+            !(reader = oggStreamReader(&in->streams, entry->streamNo)))
+            return 0;
+        if (oggReaderSeek(reader, entry->offset) != 0)
+            return 0;
+        return oggReadPage(reader, page);
     }
-    return rd;
+
+    return 0;
 }
 
-ssize_t writeAll(int fd, const void *vbuf, size_t count)
+void openOrDie(struct OggReader *reader, const char *prefix, const char *suffix)
 {
-    const unsigned char *buf = (const unsigned char *) vbuf;
-    ssize_t wt = 0, ret;
-    while (wt < count) {
-        ret = write(fd, buf + wt, count - wt);
-
-        if (ret <= 0) {
-            if (ret < 0 && errno == EAGAIN) {
-                // Wait 'til we can write again
-                fd_set wfds;
-                FD_ZERO(&wfds);
-                FD_SET(fd, &wfds);
-                select(fd + 1, NULL, &wfds, NULL, NULL);
-                continue;
-            }
+    char *name = malloc(strlen(prefix) + strlen(suffix) + 1);
+    if (!name) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(name, "%s%s", prefix, suffix);
+    if (oggReaderOpenFile(reader, name) != 0) {
+        perror(name);
+        exit(1);
+    }
+    free(name);
+}
+
+/* Find the part of the index (from in->indexLo to in->indexHi) covering the
+ * range. The range doesn't count pauses, so the meta track's pages are read
+ * up to it to find them. */
+void indexRange(struct Input *in, uint64_t rangeStart, uint64_t rangeEnd)
+{
+    uint64_t granuleOffset = 0, greatestGranulePos = 0;
+    uint64_t rawStart = 0, rawEnd = 0;
+    int foundStart = 0, foundEnd = (rangeEnd == (uint64_t) -1);
+
+    for (size_t ei = 0;
+         ei < in->indexCt && !(foundStart && foundEnd);
+         ei++) {
+        struct OggIndexEntry *entry = &in->index[ei];
+        struct OggReader *reader = &in->readers[2];
+        struct OggPage page;
+
+        if (!granuleOffset)
+            granuleOffset = entry->granulePos;
+        if (entry->granulePos <= greatestGranulePos)
+            continue;
+
+        if (in->foundMeta && entry->streamNo == in->metaStreamNo) {
+            if (in->perStream &&
+                !(reader = oggStreamReader(&in->streams, entry->streamNo)))
+                break;
+            if (oggReaderSeek(reader, entry->offset) != 0 ||
+                !oggReadPage(reader, &page))
+                break;
 
-            perror("write");
-            return ret;
+            if (!strncmp((char *) page.data, "{\"c\":\"resume\"}",
+                         page.packetSize)) {
+                // Everything before this pause is at a known offset
+                if (!foundStart &&
+                    greatestGranulePos - granuleOffset >= rangeStart) {
+                    rawStart = rangeStart + granuleOffset;
+                    foundStart = 1;
+                }
+                if (!foundEnd &&
+                    greatestGranulePos - granuleOffset >= rangeEnd) {
+                    rawEnd = rangeEnd + granuleOffset;
+                    foundEnd = 1;
+                }
+                granuleOffset += entry->granulePos - greatestGranulePos;
+            }
         }
-        wt += ret;
+        greatestGranulePos = entry->granulePos;
     }
-    return wt;
+    if (!foundStart)
+        rawStart = rangeStart + granuleOffset;
+    if (!foundEnd)
+        rawEnd = rangeEnd + granuleOffset;
+
+    in->indexLo = oggIndexBisect(in->index, in->indexCt,
+                                 (rawStart > RANGE_SLACK) ? rawStart - RANGE_SLACK : 0);
+    if (rangeEnd != (uint64_t) -1)
+        in->indexHi = oggIndexBisect(in->index, in->indexCt, rawEnd + RANGE_SLACK);
 }
 
-void writeOgg(struct OggHeader *header, const unsigned char *data, uint32_t size)
+/* Open the recording with the given prefix (e.g. 123.ogg) for indexed reading
+ * of the given track */
+void openIndexed(struct Input *in, const char *prefix, uint32_t keepStreamNo,
+                 uint64_t rangeStart, uint64_t rangeEnd)
 {
-    static unsigned char seqBuf[256];
-    uint32_t seqCt = 0;
-    uint32_t sizeMod;
-    uint32_t crc;
-
-    // Calculate the sequence info
-    seqBuf[seqCt++] = (size+255)/255;
-    sizeMod = size;
-    while (sizeMod >= 255) {
-        seqBuf[seqCt++] = 255;
-        sizeMod -= 255;
+    struct OggPage page;
+    char *name;
+
+    in->indexed = 1;
+    in->keepStreamNo = keepStreamNo;
+    openOrDie(&in->readers[0], prefix, ".header1");
+    openOrDie(&in->readers[1], prefix, ".header2");
+
+    name = malloc(strlen(prefix) + 6);
+    if (!name) {
+        perror("malloc");
+        exit(1);
     }
-    seqBuf[seqCt++] = sizeMod;
-
-    // Calculate the CRC
-    header->crc = 0;
-    crc = 0xf07159ba; // crc32("OggS\0", 5, &crc);
-    crc32(header, sizeof(*header), &crc);
-    crc32(seqBuf, seqCt, &crc);
-    crc32(data, size, &crc);
-    header->crc = crc;
-
-    // Write the header
-    if (writeAll(1, "OggS\0", 5) != 5 ||
-        writeAll(1, header, sizeof(*header)) != sizeof(*header))
+    sprintf(name, "%s.data", prefix);
+    in->perStream = (oggStreamFilesOpen(&in->streams, name) == 0);
+    if (!in->perStream)
+        openOrDie(&in->readers[2], prefix, ".data");
+
+    sprintf(name, "%s.idx", prefix);
+    if (in->perStream)
+        in->index = oggIndexLoadStreams(name, &in->streams, &in->indexCt);
+    else
+        in->index = oggIndexLoad(name, in->readers[2].fd, &in->indexCt);
+    if (!in->index) {
+        perror(name);
         exit(1);
+    }
+    free(name);
+    in->indexHi = in->indexCt;
+
+    // Find the meta track, which we need for pauses
+    for (int fi = 0; fi < 2 && !in->foundMeta; fi++) {
+        while (oggReadPage(&in->readers[fi], &page)) {
+            if (page.packetSize >= 8 && !memcmp(page.data, "ECMETA", 6)) {
+                in->foundMeta = 1;
+                in->metaStreamNo = page.header->streamNo;
+                break;
+            }
+        }
+        oggReaderSeek(&in->readers[fi], 0);
+    }
 
-    // Write the sequence info
-    if (writeAll(1, seqBuf, seqCt) != seqCt) exit(1);
-
-    // Then write the data
-    if (writeAll(1, data, size) != size) exit(1);
+    if (rangeStart || rangeEnd != (uint64_t) -1)
+        indexRange(in, rangeStart, rangeEnd);
 }
 
 int main(int argc, char **argv)
@@ -153,13 +253,11 @@ int main(int argc, char **argv)
     // Size of our packet and how many bytes to skip
     uint32_t packetSize, skip;
 
-    // Buffer info
-    unsigned char segmentCount, segmentVal;
-    unsigned char *buf = NULL;
-    uint32_t bufSz = 0;
-
-    // Header
-    struct OggPreHeader preHeader;
+    // Input
+    struct Input in;
+    const char *indexPrefix = NULL;
+    struct OggPage page;
+    unsigned char *buf;
 
     // VAD and correction
     unsigned char vadLevel = 0, correctTimestampsUp = 0,
@@ -168,44 +266,103 @@ int main(int argc, char **argv)
     // Sample rate if we're doing FLAC
     uint32_t flacRate = 0;
 
+    // Output
+    struct OggWriter out;
+    size_t flushAt = 0;
+
+    /* The range to extract (in 48k samples, not counting pauses), from --start
+     * and --end. The output starts at its start. */
+    uint64_t rangeStart = 0, rangeEnd = (uint64_t) -1;
+
+    // Packing of packets into pages, if asked for (in bytes and milliseconds)
+    int pack = 0;
+    size_t packSize = 0;
+    uint64_t packTime = 0;
+
+    /* Statistics, if asked for. The timing model is built as we go, so there's
+     * no separate phase for it. */
+    struct OggStats stats;
+    const char *statsFile = NULL;
+    uint64_t gapPackets = 0, droppedPackets = 0, silenceTrimmed = 0,
+        correctedUp = 0, correctedDown = 0, pauses = 0;
+
+    while (argc > 1 && !strncmp(argv[1], "--", 2)) {
+        if (!strncmp(argv[1], "--stats=", 8)) {
+            statsFile = argv[1] + 8;
+            argv++;
+            argc--;
+        } else if (argc > 2 && !strcmp(argv[1], "--flush")) {
+            flushAt = atol(argv[2]);
+            argv += 2;
+            argc -= 2;
+        } else if (argc > 2 && !strcmp(argv[1], "--pack")) {
+            pack = 1;
+            packSize = atol(argv[2]);
+            argv += 2;
+            argc -= 2;
+        } else if (argc > 2 && !strcmp(argv[1], "--pack-time")) {
+            pack = 1;
+            packTime = atol(argv[2]);
+            argv += 2;
+            argc -= 2;
+        } else if (argc > 2 && !strcmp(argv[1], "--index")) {
+            indexPrefix = argv[2];
+            argv += 2;
+            argc -= 2;
+        } else if (argc > 2 && !strcmp(argv[1], "--start")) {
+            rangeStart = atof(argv[2]) * 48000;
+            argv += 2;
+            argc -= 2;
+        } else if (argc > 2 && !strcmp(argv[1], "--end")) {
+            rangeEnd = atof(argv[2]) * 48000;
+            argv += 2;
+            argc -= 2;
+        } else break;
+    }
     if (argc != 2) {
-        fprintf(stderr, "Use: oggstender <track no>\n");
+        fprintf(stderr,
+            "Use: oggstender [--flush <bytes>] [--pack <bytes>] [--pack-time <ms>]\n"
+            "                [--start <secs>] [--end <secs>] [--stats=<file>]\n"
+            "                [--index <recording, e.g. 123.ogg>]\n"
+            "                <track no>\n");
         exit(1);
     }
     keepStreamNo = atoi(argv[1]);
 
-    while (readAll(0, &preHeader, sizeof(preHeader)) == sizeof(preHeader)) {
-        struct OggHeader oggHeader;
-        if (memcmp(preHeader.capturePattern, "OggS", 4))
-            break;
-
-        // It's an ogg header, get the header data
-        if (readAll(0, &oggHeader, sizeof(oggHeader)) != sizeof(oggHeader))
-            break;
-
-        // Get the data size
-        packetSize = 0;
-        if (readAll(0, &segmentCount, 1) != 1)
-            break;
-        for (; segmentCount; segmentCount--) {
-            if (readAll(0, &segmentVal, 1) != 1)
-                break;
-            packetSize += (uint32_t) segmentVal;
-        }
+    if (oggStatsOpen(&stats, "oggstender", statsFile) != 0) {
+        perror(statsFile);
+        exit(1);
+    }
+    oggStatsPhase(&stats, "header");
 
-        // Get the data
-        if (packetSize > bufSz) {
-            buf = realloc(buf, packetSize);
-            if (!buf)
-                break;
-            bufSz = packetSize;
-        }
-        if (readAll(0, buf, packetSize) != packetSize)
-            break;
+    if (oggWriterOpen(&out, 1, flushAt) != 0) {
+        perror("malloc");
+        exit(1);
+    }
+    if (pack) {
+        // Until we know otherwise from a FLAC header, it's 48k
+        oggWriterSetPacking(&out, packSize, 0);
+        oggWriterSetPackTime(&out, packTime, 48000);
+    }
+
+    memset(&in, 0, sizeof(in));
+    if (indexPrefix) {
+        openIndexed(&in, indexPrefix, keepStreamNo, rangeStart, rangeEnd);
+    } else if (oggReaderOpen(&in.readers[0], 0) != 0) {
+        perror("stdin");
+        exit(1);
+    }
+
+    while (readInput(&in, &page, &greatestGranulePos)) {
+        struct OggHeader oggHeader = *page.header;
+        buf = page.data;
+        packetSize = page.packetSize;
 
         // Get the offset if applicable
-        if (!granuleOffset && oggHeader.granulePos)
+        if (!granuleOffset && oggHeader.granulePos) {
             granuleOffset = oggHeader.granulePos;
+            oggStatsPhase(&stats, "emit");
+        }
 
         // Look for a meta track
         if (!foundMeta && oggHeader.granulePos == 0) {
@@ -220,6 +377,7 @@ int main(int argc, char **argv)
             if (foundMeta && oggHeader.streamNo == metaStreamNo &&
                 !strncmp((char *) buf, "{\"c\":\"resume\"}", packetSize)) {
                 granuleOffset += oggHeader.granulePos - greatestGranulePos;
+                pauses++;
             }
             greatestGranulePos = oggHeader.granulePos;
         }
@@ -250,10 +408,12 @@ int main(int argc, char **argv)
             if (packetSize > skip + 29 && !memcmp(buf + skip, "\x7f""FLAC", 5)) {
                 // Get our sample rate
                 flacRate = ((uint32_t) buf[skip+27] << 12) + ((uint32_t) buf[skip+28] << 4) + ((uint32_t) buf[skip+29] >> 4);
+                if (pack && flacRate)
+                    oggWriterSetPackTime(&out, packTime, flacRate);
             }
 
             // Pass through the normal header
-            writeOgg(&oggHeader, buf + skip, packetSize - skip);
+            oggWritePage(&out, &oggHeader, buf + skip, packetSize - skip);
             continue;
         }
 
@@ -262,10 +422,22 @@ int main(int argc, char **argv)
             continue;
 
         // Adjust the granule pos
-        if (oggHeader.granulePos < granuleOffset)
+        if (oggHeader.granulePos < granuleOffset) {
+            droppedPackets++;
             continue;
+        }
         oggHeader.granulePos -= granuleOffset;
 
+        // Only the range we want
+        if (oggHeader.granulePos < rangeStart)
+            continue;
+        if (oggHeader.granulePos >= rangeEnd) {
+            if (oggHeader.granulePos - rangeEnd >= RANGE_SLACK)
+                break;
+            continue;
+        }
+        oggHeader.granulePos -= rangeStart;
+
         // Account for VAD
         skip = 0;
         if (vadLevel)
@@ -291,21 +463,24 @@ int main(int argc, char **argv)
                     gapHeader.crc = 0;
                     switch (flacRate) {
                         case 0: // Opus
-                            writeOgg(&gapHeader, zeroPacket, sizeof(zeroPacket));
+                            oggWritePage(&out, &gapHeader, zeroPacket, sizeof(zeroPacket));
                             break;
                         case 44100:
-                            writeOgg(&gapHeader, zeroPacketFLAC44k, sizeof(zeroPacketFLAC44k));
+                            oggWritePage(&out, &gapHeader, zeroPacketFLAC44k, sizeof(zeroPacketFLAC44k));
                             break;
                         default:
-                            writeOgg(&gapHeader, zeroPacketFLAC48k, sizeof(zeroPacketFLAC48k));
+                            oggWritePage(&out, &gapHeader, zeroPacketFLAC48k, sizeof(zeroPacketFLAC48k));
                     }
                     trueGranulePos += packetTime;
                     gapTime -= packetTime;
+                    gapPackets++;
                 }
                 correctTimestampsUp = 0;
 
             } else {
                 // No real gap, just adjust timestamps a bit and fix the audio in post
+                if (!correctTimestampsUp)
+                    correctedUp++;
                 correctTimestampsUp = 1;
 
             }
@@ -318,8 +493,11 @@ int main(int argc, char **argv)
             if (vadLevel && buf[0] < vadLevel) {
                 // It's just silence. We can skip it.
                 correctTimestampsDown = 0;
+                silenceTrimmed++;
                 continue;
             } else {
+                if (!correctTimestampsDown)
+                    correctedDown++;
                 correctTimestampsDown = 1;
             }
         }
@@ -369,7 +547,7 @@ int main(int argc, char **argv)
         oggHeader.sequenceNo = lastSequenceNo++;
         if (flacRate == 44100)
             oggHeader.granulePos = oggHeader.granulePos * 147 / 160;
-        writeOgg(&oggHeader, buf + skip, packetSize - skip);
+        oggWritePage(&out, &oggHeader, buf + skip, packetSize - skip);
     }
 
     if (lastSequenceNo <= 2) {
@@ -379,15 +557,32 @@ int main(int argc, char **argv)
         oggHeader.sequenceNo = lastSequenceNo++;
         switch (flacRate) {
             case 0: // Ogg
-                writeOgg(&oggHeader, zeroPacket, sizeof(zeroPacket));
+                oggWritePage(&out, &oggHeader, zeroPacket, sizeof(zeroPacket));
                 break;
             case 44100:
-                writeOgg(&oggHeader, zeroPacketFLAC44k, sizeof(zeroPacketFLAC44k));
+                oggWritePage(&out, &oggHeader, zeroPacketFLAC44k, sizeof(zeroPacketFLAC44k));
                 break;
             default:
-                writeOgg(&oggHeader, zeroPacketFLAC48k, sizeof(zeroPacketFLAC48k));
+                oggWritePage(&out, &oggHeader, zeroPacketFLAC48k, sizeof(zeroPacketFLAC48k));
         }
     }
 
+    oggWriterClose(&out);
+
+    for (int fi = 0; fi < 3; fi++)
+        oggStatsReader(&stats, &in.readers[fi]);
+    for (size_t si = 0; si < in.streams.ct; si++) {
+        if (in.streams.files[si].open)
+            oggStatsReader(&stats, &in.streams.files[si].reader);
+    }
+    oggStatsWriter(&stats, &out);
+    oggStatsAdd(&stats, "pauses", pauses);
+    oggStatsAdd(&stats, "tracks", 1);
+    oggStatsAdd(&stats, "gapPackets", gapPackets);
+    oggStatsAdd(&stats, "droppedPackets", droppedPackets);
+    oggStatsAdd(&stats, "silenceTrimmed", silenceTrimmed);
+    oggStatsAdd(&stats, "correctTimestampsUp", correctedUp);
+    oggStatsAdd(&stats, "correctTimestampsDown", correctedDown);
+    oggStatsClose(&stats);
     return 0;
 }
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2017-2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The timing of a recording: where every track ends, less the time skipped by
+ * pauses. Gives the same durations as oggduration, but only looks at the end
+ * of each track, and at the meta stream for pauses. With an index, that never
+ * requires reading most of the data. Shared by oggduration3 and oggmanifest.
+ */
+
+#ifndef OGGTIMING_H
+#define OGGTIMING_H 1
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "oggindex.h"
+#include "oggpage.h"
+
+/* NOTE: This assumes little-endian for speed, it WILL NOT WORK on a
+ * big-endian system */
+
+/* A resume from pause, and the time it skips. Offsets here are only for
+ * ordering, so with an index they're the index entry number instead, which
+ * works for either layout. */
+struct Resume {
+    uint64_t offset;
+    uint64_t skipped;
+};
+
+// The last page of a track
+struct TrackEnd {
+    uint64_t offset;
+    uint64_t granulePos;
+};
+
+/* Pausing is handled like oggduration: a resume that jumps past every
+ * timestamp seen so far skips that much time, for everything after it in the
+ * file. The jump only counts if it's beyond the greatest timestamp before it,
+ * over every stream. */
+struct PauseTracker {
+    uint64_t greatestGranulePos;
+    std::vector<Resume> resumes;
+
+    PauseTracker() : greatestGranulePos(0) {}
+
+    // See a page. isResume is only checked if it could matter.
+    template <typename F>
+    void page(uint64_t offset, uint64_t granulePos, bool isMeta, F isResume) {
+        if (granulePos <= greatestGranulePos)
+            return;
+        if (isMeta && isResume())
+            resumes.push_back({offset, granulePos - greatestGranulePos});
+        greatestGranulePos = granulePos;
+    }
+
+    // Total time skipped by pauses before this offset
+    uint64_t skippedBefore(uint64_t offset) const {
+        uint64_t ret = 0;
+        for (auto &resume : resumes) {
+            if (resume.offset >= offset)
+                break;
+            ret += resume.skipped;
+        }
+        return ret;
+    }
+};
+
+static inline bool isResume(const unsigned char *buf, uint32_t packetSize) {
+    return !strncmp((const char *) buf, "{\"c\":\"resume\"}", packetSize);
+}
+
+struct OggTiming {
+    // Every track (but not the meta track), by stream number
+    std::set<uint32_t> tracks;
+
+    // The first timestamp in the recording
+    uint64_t startTime;
+
+    // The last timestamp of each track, and of all of them, less pauses
+    std::unordered_map<uint32_t, uint64_t> trackDurations;
+    uint64_t lastGranulePos;
+
+    OggTiming() : startTime(0), lastGranulePos(0) {}
+};
+
+/* Get the timing of a recording from its header1 and data files. index and
+ * meta (the sidecar) are optional, and may be empty. Returns 0 on success, or
+ * -1 on failure, having reported the error. */
+static int oggTiming(OggTiming &timing, const std::string &header1,
+                     const std::string &data, const std::string &index,
+                     const std::string &meta)
+{
+    struct OggReader reader;
+    struct OggPage page;
+
+    // 1: Find every track
+    int foundMeta = 0;
+    uint32_t metaStreamNo = 0;
+    std::set<uint32_t> &tracks = timing.tracks;
+    if (oggReaderOpenFile(&reader, header1.c_str()) != 0) {
+        perror(header1.c_str());
+        return -1;
+    }
+    while (oggReadPage(&reader, &page)) {
+        uint32_t packetSize = page.packetSize;
+        if (packetSize == 0)
+            continue;
+
+        // Look for a meta track
+        if (!foundMeta) {
+            if (packetSize >= 8 && !memcmp(page.data, "ECMETA", 6)) {
+                foundMeta = 1;
+                metaStreamNo = page.header->streamNo;
+            }
+        }
+
+        if (!foundMeta || page.header->streamNo != metaStreamNo)
+            tracks.insert(page.header->streamNo);
+    }
+    oggReaderClose(&reader);
+
+    /* If there's a meta sidecar and it has no resumes, there were no pauses,
+     * so we don't need to look for them */
+    bool pausable = foundMeta;
+    if (pausable && meta.size() &&
+        oggReaderOpenFile(&reader, meta.c_str()) == 0) {
+        bool resumed = false;
+        while (!resumed && oggReadPage(&reader, &page))
+            resumed = isResume(page.data, page.packetSize);
+        oggReaderClose(&reader);
+        if (!resumed)
+            pausable = false;
+    }
+
+    // 2: Open the data (or, in the per-stream layout, get ready to)
+    struct OggStreamFiles streams;
+    bool perStream = index.size() &&
+        oggStreamFilesOpen(&streams, data.c_str()) == 0;
+    if (!perStream && oggReaderOpenFile(&reader, data.c_str()) != 0) {
+        perror(data.c_str());
+        return -1;
+    }
+
+    uint64_t &startTime = timing.startTime;
+    std::unordered_map<uint32_t, TrackEnd> trackEnds;
+    std::set<uint32_t> unresolvedTracks;
+    PauseTracker pauses;
+    for (auto track : tracks)
+        unresolvedTracks.insert(track);
+
+    if (index.size()) {
+        size_t indexCt, ei;
+        struct OggIndexEntry *entries = perStream ?
+            oggIndexLoadStreams(index.c_str(), &streams, &indexCt) :
+            oggIndexLoad(index.c_str(), reader.fd, &indexCt);
+        if (!entries) {
+            perror(index.c_str());
+            return -1;
+        }
+
+        // 3: Get the starting time
+        for (ei = 0; ei < indexCt; ei++) {
+            if (entries[ei].packetSize && entries[ei].granulePos) {
+                startTime = entries[ei].granulePos;
+                break;
+            }
+        }
+
+        // 4: Find pauses, reading only the meta stream
+        if (pausable) {
+            for (ei = 0; ei < indexCt; ei++) {
+                struct OggIndexEntry *entry = &entries[ei];
+                if (!entry->packetSize)
+                    continue;
+                pauses.page(ei, entry->granulePos,
+                    entry->streamNo == metaStreamNo, [&]() {
+                        struct OggReader *metaReader = perStream ?
+                            oggStreamReader(&streams, metaStreamNo) : &reader;
+                        if (!metaReader ||
+                            oggReaderSeek(metaReader, entry->offset) != 0 ||
+                            !oggReadPage(metaReader, &page))
+                            return false;
+                        return isResume(page.data, page.packetSize);
+                    });
+            }
+        }
+
+        // 5: Look backwards for the end of every track
+        for (ei = indexCt; ei > 0 && !unresolvedTracks.empty(); ei--) {
+            struct OggIndexEntry *entry = &entries[ei-1];
+            if (!entry->packetSize)
+                continue;
+            if (unresolvedTracks.erase(entry->streamNo))
+                trackEnds[entry->streamNo] = {ei - 1, entry->granulePos};
+        }
+
+        free(entries);
+        if (perStream)
+            oggStreamFilesClose(&streams);
+
+    } else if (pausable) {
+        /* 3-5: Without an index, finding pauses means looking at every page
+         * header, so get everything else from the same pass */
+        while (oggReadPage(&reader, &page)) {
+            struct OggHeader *oggHeader = page.header;
+            if (page.packetSize == 0)
+                continue;
+            if (!startTime && oggHeader->granulePos)
+                startTime = oggHeader->granulePos;
+            pauses.page(page.offset, oggHeader->granulePos,
+                oggHeader->streamNo == metaStreamNo, [&]() {
+                    return isResume(page.data, page.packetSize);
+                });
+            if (tracks.find(oggHeader->streamNo) != tracks.end())
+                trackEnds[oggHeader->streamNo] = {page.offset, oggHeader->granulePos};
+        }
+
+    } else {
+        // 3: Get the starting time
+        while (oggReadPage(&reader, &page)) {
+            if (page.packetSize == 0)
+                continue;
+            if (page.header->granulePos) {
+                startTime = page.header->granulePos;
+                break;
+            }
+        }
+
+        // 4: No meta stream, so no pauses. Search for the end of every track.
+        int64_t size = oggReaderSize(&reader);
+        uint64_t searched = size;
+        for (int64_t offset = 4; (offset>>1) < size; offset *= 2) {
+            int64_t start = (offset >= size) ? 0 : size - offset;
+            int64_t found = oggReaderFindPage(&reader, start, searched + 3);
+            if (found < 0 || (uint64_t) found >= searched)
+                continue;
+            if (oggReaderSeek(&reader, found) != 0) {
+                perror(data.c_str());
+                return -1;
+            }
+
+            /* Look for track ending durations, up to what we've already
+             * searched. Anything we found there is later than anything here,
+             * so it takes precedence. */
+            std::unordered_map<uint32_t, TrackEnd> foundEnds;
+            while (oggReadPage(&reader, &page) && page.offset < searched) {
+                if (page.packetSize == 0)
+                    continue;
+                if (tracks.find(page.header->streamNo) == tracks.end())
+                    continue;
+                foundEnds[page.header->streamNo] = {page.offset, page.header->granulePos};
+            }
+            for (auto &end : foundEnds) {
+                if (unresolvedTracks.erase(end.first))
+                    trackEnds[end.first] = end.second;
+            }
+            searched = found;
+
+            // Check if there's work left to be done
+            if (unresolvedTracks.empty())
+                break;
+        }
+    }
+
+    oggReaderClose(&reader);
+
+    // Account for pauses
+    std::unordered_map<uint32_t, uint64_t> &trackDurations = timing.trackDurations;
+    for (auto &end : trackEnds) {
+        uint64_t granulePos = end.second.granulePos;
+        uint64_t skipped = pauses.skippedBefore(end.second.offset);
+        if (granulePos >= skipped)
+            granulePos -= skipped;
+        trackDurations[end.first] = granulePos;
+    }
+
+    // 6: Figure out the overall duration
+    uint64_t &lastGranulePos = timing.lastGranulePos;
+    for (auto &duration : trackDurations) {
+        if (duration.second > lastGranulePos)
+            lastGranulePos = duration.second;
+    }
+
+    return 0;
+}
+
+#endif
@@ -21,6 +21,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "oggpage.h"
+
 /* NOTE: We don't use libogg here because the behavior of this program is so
  * trivial, the added memory bandwidth of using it is just a waste of energy */
 
@@ -29,31 +31,6 @@
 
 static unsigned char outTrackNum = 0;
 
-struct OggPreHeader {
-    unsigned char capturePattern[4];
-    unsigned char version;
-} __attribute__((packed));
-
-struct OggHeader {
-    unsigned char type;
-    uint64_t granulePos;
-    uint32_t streamNo;
-    uint32_t sequenceNo;
-    uint32_t crc;
-} __attribute__((packed));
-
-static ssize_t readAll(int fd, void *vbuf, size_t count)
-{
-    unsigned char *buf = (unsigned char *) vbuf;
-    ssize_t rd = 0, ret;
-    while (rd < count) {
-        ret = read(fd, buf + rd, count - rd);
-        if (ret <= 0) return ret;
-        rd += ret;
-    }
-    return rd;
-}
-
 static void out(struct OggHeader *header, const char *type)
 {
     if (outTrackNum)
@@ -66,42 +43,22 @@ int main(int argc, char **argv)
 {
     uint32_t packetSize;
     uint32_t skip;
-    unsigned char segmentCount, segmentVal;
-    unsigned char *buf = NULL;
-    uint32_t bufSz = 0;
-    struct OggPreHeader preHeader;
+    unsigned char *buf;
+    struct OggReader reader;
+    struct OggPage page;
 
     if (argc > 1 && !strcmp(argv[1], "-n"))
         outTrackNum = 1;
 
-    while (readAll(0, &preHeader, sizeof(preHeader)) == sizeof(preHeader)) {
-        struct OggHeader oggHeader;
-        if (memcmp(preHeader.capturePattern, "OggS", 4))
-            break;
-
-        // It's an ogg header, get the header data
-        if (readAll(0, &oggHeader, sizeof(oggHeader)) != sizeof(oggHeader))
-            break;
-
-        // Get the data size
-        packetSize = 0;
-        if (readAll(0, &segmentCount, 1) != 1)
-            break;
-        for (; segmentCount; segmentCount--) {
-            if (readAll(0, &segmentVal, 1) != 1)
-                break;
-            packetSize += (uint32_t) segmentVal;
-        }
+    if (oggReaderOpen(&reader, 0) != 0) {
+        perror("stdin");
+        return 1;
+    }
 
-        // Get the data
-        if (packetSize > bufSz) {
-            buf = realloc(buf, packetSize);
-            if (!buf)
-                break;
-            bufSz = packetSize;
-        }
-        if (readAll(0, buf, packetSize) != packetSize)
-            break;
+    while (oggReadPage(&reader, &page)) {
+        struct OggHeader oggHeader = *page.header;
+        buf = page.data;
+        packetSize = page.packetSize;
 
         // Is it metadata?
         if (packetSize >= 8 && !memcmp(buf, "ECMETA", 6))
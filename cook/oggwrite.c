@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "oggcrc.h"
+#include "oggwrite.h"
+
+// The most page header (including lacing) we can need
+#define MAX_PAGE_HEADER (27 + 256)
+
+// Wait 'til we can write again
+static void waitWritable(int fd)
+{
+    fd_set wfds;
+    FD_ZERO(&wfds);
+    FD_SET(fd, &wfds);
+    select(fd + 1, NULL, &wfds, NULL, NULL);
+}
+
+/* Write all of this data, counting the write calls in *syscalls if it's
+ * non-NULL */
+static ssize_t writeAll(int fd, const void *vbuf, size_t count, uint64_t *syscalls)
+{
+    const unsigned char *buf = (const unsigned char *) vbuf;
+    ssize_t wt = 0, ret;
+    while (wt < count) {
+        ret = write(fd, buf + wt, count - wt);
+        if (syscalls)
+            (*syscalls)++;
+
+        if (ret <= 0) {
+            if (ret < 0 && errno == EAGAIN) {
+                waitWritable(fd);
+                continue;
+            }
+
+            perror("write");
+            return ret;
+        }
+        wt += ret;
+    }
+    return wt;
+}
+
+ssize_t oggWriteAll(int fd, const void *buf, size_t count)
+{
+    return writeAll(fd, buf, count, NULL);
+}
+
+// Like oggWriteAll, but gathering. Returns 0 on success.
+static int writevAll(int fd, struct iovec *iov, int iovcnt, uint64_t *syscalls)
+{
+    while (iovcnt) {
+        ssize_t ret = writev(fd, iov, iovcnt);
+        (*syscalls)++;
+
+        if (ret <= 0) {
+            if (ret < 0 && errno == EAGAIN) {
+                waitWritable(fd);
+                continue;
+            }
+
+            perror("write");
+            return -1;
+        }
+
+        // Skip whatever was written
+        while (iovcnt && (size_t) ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt) {
+            iov->iov_base = (unsigned char *) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return 0;
+}
+
+int oggWriterOpen(struct OggWriter *writer, int fd, size_t flushAt)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = fd;
+    writer->flushAt = flushAt ? flushAt : OGG_WRITER_FLUSH_DEFAULT;
+
+    /* Once we're below the threshold, there's always room for at least a page
+     * header */
+    writer->bufSize = writer->flushAt + MAX_PAGE_HEADER;
+    writer->buf = (unsigned char *) malloc(writer->bufSize);
+    if (!writer->buf)
+        return -1;
+    return 0;
+}
+
+void oggWriterSetPacking(struct OggWriter *writer, size_t size, uint64_t time)
+{
+    writer->packSize = size ? size : OGG_WRITER_PACK_SIZE_DEFAULT;
+    writer->packTime = time ? time : OGG_WRITER_PACK_TIME_DEFAULT;
+    writer->packAlloc = writer->packSize;
+    writer->pack = (unsigned char *) malloc(writer->packAlloc);
+    if (!writer->pack) {
+        perror("malloc");
+        exit(1);
+    }
+}
+
+void oggWriterSetPackTime(struct OggWriter *writer, uint64_t ms, uint32_t rate)
+{
+    writer->packTime = (ms ? ms : 1000) * rate / 1000;
+}
+
+/* Finish a page, the header and lacing of which (headerSize bytes) have been
+ * assembled at the end of the buffer */
+static void finishPage(struct OggWriter *writer, struct OggHeader *header,
+                       uint32_t headerSize, const unsigned char *data,
+                       uint32_t size)
+{
+    unsigned char *page = writer->buf + writer->bufUsed;
+    uint32_t crc;
+
+    // CRC
+    crc = 0;
+    oggCRC(page, headerSize, &crc);
+    oggCRC(data, size, &crc);
+    header->crc = crc;
+    memcpy(page + 22, &crc, 4);
+    writer->bufUsed += headerSize;
+    writer->pagesWritten++;
+    writer->bytesWritten += headerSize + size;
+
+    if (size <= writer->bufSize - writer->bufUsed) {
+        // Room to buffer it
+        memcpy(writer->buf + writer->bufUsed, data, size);
+        writer->bufUsed += size;
+
+    } else {
+        // Too big, so write it all out with the buffer
+        struct iovec iov[2];
+        iov[0].iov_base = writer->buf;
+        iov[0].iov_len = writer->bufUsed;
+        iov[1].iov_base = (void *) data;
+        iov[1].iov_len = size;
+        if (writevAll(writer->fd, iov, 2, &writer->syscalls) != 0)
+            exit(1);
+        writer->bufUsed = 0;
+
+    }
+
+    if (writer->bufUsed >= writer->flushAt)
+        oggWriterFlush(writer);
+}
+
+// Write out the page we've been packing, if any
+static void finishPack(struct OggWriter *writer)
+{
+    unsigned char *page = writer->buf + writer->bufUsed;
+
+    if (!writer->packPackets)
+        return;
+
+    writer->packHeader.sequenceNo = writer->packSequenceNo++;
+    writer->packHeader.crc = 0;
+    memcpy(page, "OggS\0", 5);
+    memcpy(page + 5, &writer->packHeader, sizeof(writer->packHeader));
+    page[5 + sizeof(writer->packHeader)] = writer->packSegments;
+    memcpy(page + 6 + sizeof(writer->packHeader), writer->packLacing,
+           writer->packSegments);
+    finishPage(writer, &writer->packHeader,
+               6 + sizeof(writer->packHeader) + writer->packSegments,
+               writer->pack, writer->packUsed);
+
+    writer->packSegments = writer->packPackets = 0;
+    writer->packUsed = 0;
+}
+
+// Add a packet to the page we're packing, finishing it first if it's full
+static void packPacket(struct OggWriter *writer, struct OggHeader *header,
+                       const unsigned char *data, uint32_t size)
+{
+    int segments = size / 255 + 1;
+
+    if (writer->packPackets &&
+        (header->streamNo != writer->packHeader.streamNo ||
+         writer->packSegments + segments > 255 ||
+         writer->packUsed + size > writer->packSize ||
+         header->granulePos > writer->packFirstGranulePos + writer->packTime ||
+         header->granulePos < writer->packFirstGranulePos))
+        finishPack(writer);
+
+    if (!writer->packPackets)
+        writer->packFirstGranulePos = header->granulePos;
+    writer->packHeader = *header;
+    writer->packPackets++;
+
+    // Lacing
+    while (segments > 1) {
+        writer->packLacing[writer->packSegments++] = 255;
+        segments--;
+    }
+    writer->packLacing[writer->packSegments++] = size % 255;
+
+    // Data (a lone packet may be bigger than a page would otherwise be)
+    if (writer->packUsed + size > writer->packAlloc) {
+        unsigned char *pack = (unsigned char *) realloc(writer->pack, writer->packUsed + size);
+        if (!pack) {
+            perror("realloc");
+            exit(1);
+        }
+        writer->pack = pack;
+        writer->packAlloc = writer->packUsed + size;
+    }
+    memcpy(writer->pack + writer->packUsed, data, size);
+    writer->packUsed += size;
+}
+
+void oggWritePage(struct OggWriter *writer, struct OggHeader *header,
+                  const unsigned char *data, uint32_t size)
+{
+    unsigned char *page;
+    uint32_t sizeMod;
+    unsigned char *seq;
+
+    if (writer->packSize) {
+        if (header->type == 0 && header->granulePos != 0 &&
+            size / 255 + 1 <= 255) {
+            packPacket(writer, header, data, size);
+            return;
+        }
+
+        // Can't pack this, so it goes on its own page
+        finishPack(writer);
+        header->sequenceNo = writer->packSequenceNo++;
+    }
+
+    // Header
+    page = writer->buf + writer->bufUsed;
+    memcpy(page, "OggS\0", 5);
+    header->crc = 0;
+    memcpy(page + 5, header, sizeof(*header));
+
+    // Sequence info
+    seq = page + 5 + sizeof(*header);
+    *seq++ = (size+255)/255;
+    sizeMod = size;
+    while (sizeMod >= 255) {
+        *seq++ = 255;
+        sizeMod -= 255;
+    }
+    *seq++ = sizeMod;
+
+    finishPage(writer, header, seq - page, data, size);
+}
+
+void oggWriterFlush(struct OggWriter *writer)
+{
+    if (!writer->bufUsed)
+        return;
+    if (writeAll(writer->fd, writer->buf, writer->bufUsed, &writer->syscalls) != writer->bufUsed)
+        exit(1);
+    writer->bufUsed = 0;
+}
+
+void oggWriterClose(struct OggWriter *writer)
+{
+    finishPack(writer);
+    oggWriterFlush(writer);
+    free(writer->buf);
+    writer->buf = NULL;
+    writer->bufSize = 0;
+    free(writer->pack);
+    writer->pack = NULL;
+    writer->packSize = writer->packAlloc = 0;
+}
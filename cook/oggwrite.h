@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Buffered Ogg page writing shared by the cook tools. Pages are assembled in
+ * one buffer and written out once it reaches the flush threshold, so that a
+ * stream of tiny pages doesn't cost several syscalls each.
+ *
+ * Normally, every packet is its own page. Optionally, consecutive data packets
+ * can be packed into pages, which for long runs of tiny (e.g. gap) packets
+ * makes for far less overhead, both here and for whatever reads the output.
+ */
+
+#ifndef OGGWRITE_H
+#define OGGWRITE_H 1
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "oggpage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Default flush threshold, in bytes
+#define OGG_WRITER_FLUSH_DEFAULT (64*1024)
+
+// Default limits on packed pages, in bytes and granules (one second at 48k)
+#define OGG_WRITER_PACK_SIZE_DEFAULT 4096
+#define OGG_WRITER_PACK_TIME_DEFAULT 48000
+
+struct OggWriter {
+    int fd;
+
+    // Buffered output
+    unsigned char *buf;
+    size_t bufSize, bufUsed;
+
+    // Write it out once we have this much
+    size_t flushAt;
+
+    // What we've written, for statistics
+    uint64_t pagesWritten, bytesWritten, syscalls;
+
+    /* If we're packing, the most data and time (in granules, from the first
+     * packet to the last) to pack into a page */
+    size_t packSize;
+    uint64_t packTime;
+
+    /* The page being packed: its header (with the latest packet's granule
+     * position), lacing values, and data */
+    struct OggHeader packHeader;
+    unsigned char packLacing[255];
+    int packSegments, packPackets;
+    uint64_t packFirstGranulePos;
+    unsigned char *pack;
+    size_t packUsed, packAlloc;
+
+    // Pages are numbered by us when packing
+    uint32_t packSequenceNo;
+};
+
+/* Write all of this data, waiting if the output is non-blocking. Returns the
+ * amount written, or <= 0 on error. */
+ssize_t oggWriteAll(int fd, const void *buf, size_t count);
+
+/* Prepare to write to this file descriptor, flushing every flushAt bytes (or
+ * OGG_WRITER_FLUSH_DEFAULT if 0). Returns 0 on success. */
+int oggWriterOpen(struct OggWriter *writer, int fd, size_t flushAt);
+
+/* Pack consecutive data packets into pages of at most size bytes (or
+ * OGG_WRITER_PACK_SIZE_DEFAULT if 0) and time granules (or
+ * OGG_WRITER_PACK_TIME_DEFAULT if 0). Headers (pages with a granule position
+ * of 0) and pages with any flags set are never packed. The writer numbers the
+ * pages itself, ignoring the given sequence numbers. Exits on failure. */
+void oggWriterSetPacking(struct OggWriter *writer, size_t size, uint64_t time);
+
+/* Set the most time to pack into a page in milliseconds (or one second if 0),
+ * for a stream with this many granules per second */
+void oggWriterSetPackTime(struct OggWriter *writer, uint64_t ms, uint32_t rate);
+
+/* Write a page with this header and a single packet of data. Sets the CRC in
+ * the header, unless the packet is being packed. Exits on failure. */
+void oggWritePage(struct OggWriter *writer, struct OggHeader *header,
+                  const unsigned char *data, uint32_t size);
+
+/* Write out anything buffered, except a page that's still being packed. Exits
+ * on failure. */
+void oggWriterFlush(struct OggWriter *writer);
+
+/* Finish any packed page, flush and free the writer. Does not close the file
+ * descriptor. */
+void oggWriterClose(struct OggWriter *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Ogg packets containing only silence, as used by oggcorrect to fill gaps,
+ * and recognized by oggpcm so that it can skip decoding them.
+ */
+
+#ifndef OGGZERO_H
+#define OGGZERO_H 1
+
+#include <stdint.h>
+
+/* The encoding for an Opus packet with only zeroes. This is mono, 48k, but
+ * that doesn't matter for the Ogg container. */
+static const unsigned char zeroPacketOpus[] = { 0xF8, 0xFF, 0xFE };
+
+/* The encoding for a FLAC packet with only zeroes, 48k. Number of channels
+ * counts, so we have one for each channel count. Note that this data is
+ * generated by flac-zero/flac-zero.sh */
+static const unsigned char zeroPacketFLAC48k[][0x2B] = {
+    { 0x0E, 0xFF, 0xF8, 0x7A, 0x0C, 0x00, 0x03, 0xBF, 0x94, 0x00, 0x00, 0x00, 0x00, 0xB1, 0xCA },
+    { 0x12, 0xFF, 0xF8, 0x7A, 0x1C, 0x00, 0x03, 0xBF, 0xF3, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x64, 0x8A },
+    { 0x16, 0xFF, 0xF8, 0x7A, 0x2C, 0x00, 0x03, 0xBF, 0x5A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4A, 0x73 },
+    { 0x1A, 0xFF, 0xF8, 0x7A, 0x3C, 0x00, 0x03, 0xBF, 0x3D, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4A, 0x1A },
+    { 0x1E, 0xFF, 0xF8, 0x7A, 0x4C, 0x00, 0x03, 0xBF, 0x0F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xE2, 0x7D },
+    { 0x22, 0xFF, 0xF8, 0x7A, 0x5C, 0x00, 0x03, 0xBF, 0x68, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1B, 0x3A },
+    { 0x26, 0xFF, 0xF8, 0x7A, 0x6C, 0x00, 0x03, 0xBF, 0xC1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x57, 0x52 },
+    { 0x2A, 0xFF, 0xF8, 0x7A, 0x7C, 0x00, 0x03, 0xBF, 0xA6, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC8, 0xF7 }
+};
+
+// The encodings for a FLAC packet with only zeroes, 44.1k
+static const unsigned char zeroPacketFLAC44k[][0x2B] = {
+    { 0x0E, 0xFF, 0xF8, 0x79, 0x0C, 0x00, 0x03, 0x71, 0x56, 0x00, 0x00, 0x00, 0x00, 0x63, 0xC5 },
+    { 0x12, 0xFF, 0xF8, 0x79, 0x1C, 0x00, 0x03, 0x71, 0x31, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x8C, 0x61 },
+    { 0x16, 0xFF, 0xF8, 0x79, 0x2C, 0x00, 0x03, 0x71, 0x98, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xE7, 0x42 },
+    { 0x1A, 0xFF, 0xF8, 0x79, 0x3C, 0x00, 0x03, 0x71, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xAD, 0xFD },
+    { 0x1E, 0xFF, 0xF8, 0x79, 0x4C, 0x00, 0x03, 0x71, 0xCD, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x83, 0xBC },
+    { 0x22, 0xFF, 0xF8, 0x79, 0x5C, 0x00, 0x03, 0x71, 0xAA, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3F },
+    { 0x26, 0xFF, 0xF8, 0x79, 0x6C, 0x00, 0x03, 0x71, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0B, 0x13 },
+    { 0x2A, 0xFF, 0xF8, 0x79, 0x7C, 0x00, 0x03, 0x71, 0x64, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFD, 0xF8 }
+};
+
+/* Get the zero packet for this format (flacRate 0 for Opus) and number of
+ * channels, setting its size */
+static const unsigned char *oggZeroPacket(uint32_t flacRate,
+                                          unsigned char channels,
+                                          uint32_t *size)
+{
+    const unsigned char *packet;
+
+    switch (flacRate) {
+        case 0: // Opus
+            *size = sizeof(zeroPacketOpus);
+            return zeroPacketOpus;
+
+        case 44100:
+            packet = zeroPacketFLAC44k[channels - 1];
+            break;
+
+        default: // FLAC 48k
+            packet = zeroPacketFLAC48k[channels - 1];
+            break;
+    }
+
+    *size = packet[0];
+    return packet + 1;
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Corrected audio (from oggcorrect or oggstender) doesn't include the time the
+ * recording was paused, and nor does a range given with --start and --end, but
+ * times in the metadata do. Given the metadata (as parsed lines from oggmeta),
+ * this returns a function to convert a time in the metadata (in seconds) to a
+ * time in the audio. Anything during a pause is at the time the pause started.
+ */
+module.exports = function(meta) {
+    const pauses = [];
+    let pauseTime = null;
+    for (const c of meta) {
+        if (!c || !c.d)
+            continue;
+        if (c.d.c === "pause") {
+            pauseTime = c.t / 48000;
+        } else if (c.d.c === "resume" && pauseTime !== null) {
+            pauses.push([pauseTime, c.t / 48000]);
+            pauseTime = null;
+        }
+    }
+
+    return function(time) {
+        let paused = 0;
+        for (const [start, end] of pauses) {
+            if (time < start)
+                break;
+            if (time < end)
+                return start - paused;
+            paused += end - start;
+        }
+        return time - paused;
+    };
+};
@@ -52,11 +52,35 @@ then
     done
 fi
 
-# Output each requested component
+# Correct every requested component in one pass
+tmpdir="$(mktemp -d)"
+[ "$tmpdir" -a -d "$tmpdir" ] || exit 1
+CORRECT_ARGS=""
 for c in $STREAMS
 do
-    timeout $DEF_TIMEOUT cat \
-        $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data \
-        $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
-        timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggcorrect" $c
+    CORRECT_ARGS="$CORRECT_ARGS -o $tmpdir/$c.ogg $c"
 done
+(
+    if [ -e $ID.ogg.idx ]
+    then
+        timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggcorrect" --index $ID.ogg --once $CORRECT_ARGS
+    else
+        timeout $DEF_TIMEOUT cat $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
+            timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/oggcorrect" --once $CORRECT_ARGS
+    fi
+    : > "$tmpdir/corrected"
+) &
+
+# Then output each requested component, as soon as it's complete (oggcorrect
+# only puts it in place then)
+for c in $STREAMS
+do
+    while [ ! -e "$tmpdir/$c.ogg" -a ! -e "$tmpdir/corrected" ]
+    do
+        sleep 1
+    done
+    cat "$tmpdir/$c.ogg"
+done
+wait
+
+rm -rf "$tmpdir"
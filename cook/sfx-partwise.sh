@@ -56,8 +56,7 @@ NICE="nice -n10 ionice -c3 chrt -i 0"
 if [ ! "$STREAMS" ]
 then
     # then just calculate how many we need
-    timeout $DEF_TIMEOUT cat $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
-        timeout $DEF_TIMEOUT "$SCRIPTBASE/oggmeta" |
+    timeout $DEF_TIMEOUT "$SCRIPTBASE/oggmeta" $ID.ogg |
         timeout $DEF_TIMEOUT "$SCRIPTBASE/sfx.js" -i "$ID.ogg.info"
     exit 0
 fi
@@ -65,8 +64,7 @@ fi
 # Output each requested component
 for c in $STREAMS
 do
-    LFILTER="$(timeout $DEF_TIMEOUT cat $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
-               timeout $DEF_TIMEOUT "$SCRIPTBASE/oggmeta" |
+    LFILTER="$(timeout $DEF_TIMEOUT "$SCRIPTBASE/oggmeta" $ID.ogg |
                timeout $DEF_TIMEOUT "$SCRIPTBASE/sfx.js" -i "$ID.ogg.info" $DURATION $((c-1)))"
     if [ "$DURATION" ]
     then
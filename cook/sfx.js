@@ -19,16 +19,22 @@ const fs = require("fs");
 
 const config = require("../config.js");
 const db = require("../db.js").db;
+const pauses = require("./pauses.js");
 
 let duration = false;
 let trackNo = -1;
 let infoFile = null;
+let rangeStart = 0, rangeEnd = null;
 for (let ai = 2; ai < process.argv.length; ai++) {
     const arg = process.argv[ai];
     if (arg === "-i") {
         infoFile = process.argv[++ai];
     } else if (arg === "-d") {
         duration = true;
+    } else if (arg === "--start") {
+        rangeStart = +process.argv[++ai];
+    } else if (arg === "--end") {
+        rangeEnd = +process.argv[++ai];
     } else if (arg[0] === "-") {
         console.error("Unrecognized argument " + arg);
         process.exit(1);
@@ -53,6 +59,19 @@ const info = JSON.parse(fs.readFileSync(infoFile, "utf8"));
 
     meta = meta.trim().split("\n");
 
+    /* With a range, which doesn't count pauses, times are in the audio, which
+     * doesn't either */
+    let audioTime = x => x;
+    if (rangeStart || rangeEnd !== null) {
+        audioTime = pauses(meta.map(line => {
+            try {
+                return JSON.parse(line);
+            } catch (ex) {
+                return null;
+            }
+        }));
+    }
+
     let sounds = {};
 
     // Then make the tracks
@@ -61,7 +80,7 @@ const info = JSON.parse(fs.readFileSync(infoFile, "utf8"));
     for (let line of meta) {
         if (line === "") continue;
         let c = JSON.parse(line);
-        let t = c.t / 48000;
+        let t = audioTime(c.t / 48000);
         c = c.d;
         if (c.c !== "sound")
             continue;
@@ -153,8 +172,14 @@ const info = JSON.parse(fs.readFileSync(infoFile, "utf8"));
 
         let track = tracks[trackNo];
         if (duration) {
-            // Just give the duration
-            process.stdout.write((track[track.length-1].end + 2) + "\n");
+            // Just give the duration, of only the range if asked
+            let d = track[track.length-1].end + 2;
+            if (rangeEnd !== null && d > rangeEnd + 2)
+                d = rangeEnd + 2;
+            d -= rangeStart;
+            if (d < 2)
+                d = 2;
+            process.stdout.write(d + "\n");
             return;
         }
         for (let ti = 0; ti < track.length; ti++) {
@@ -174,7 +199,15 @@ const info = JSON.parse(fs.readFileSync(infoFile, "utf8"));
                     "[aud][step]concat=v=0:a=1[aud];\n");
             }
         }
-        process.stdout.write("[aud]anull[aud]\n");
+        if (rangeStart || rangeEnd !== null) {
+            // Only the range
+            process.stdout.write(
+                "[aud]atrim=start=" + rangeStart +
+                (rangeEnd !== null ? ":end=" + rangeEnd : "") +
+                ",asetpts=PTS-STARTPTS[aud]\n");
+        } else {
+            process.stdout.write("[aud]anull[aud]\n");
+        }
 
     }
 })();
@@ -17,10 +17,14 @@
 
 const fs = require("fs");
 
+const pauses = require("./pauses.js");
+
 let users = null;
 let trackNo = -1;
 let transcriptOnly = false;
 let outputVosk = false;
+let rangeStart = 0, rangeEnd = Infinity;
+let pauseFile = null;
 for (let ai = 2; ai < process.argv.length; ai++) {
     const arg = process.argv[ai];
     if (arg === "-u") {
@@ -29,6 +33,13 @@ for (let ai = 2; ai < process.argv.length; ai++) {
         transcriptOnly = true;
     } else if (arg === "-v") {
         outputVosk = true;
+    } else if (arg === "--start") {
+        rangeStart = +process.argv[++ai];
+    } else if (arg === "--end") {
+        rangeEnd = +process.argv[++ai];
+    } else if (arg === "--pauses") {
+        // Metadata with the pauses in it, if it's not what we're reading
+        pauseFile = process.argv[++ai];
     } else if (arg === "-f" || arg === "--format") {
         const format = process.argv[++ai];
         switch (format) {
@@ -88,6 +99,21 @@ function toStamp(time) {
 
     meta = meta.trim().split("\n");
 
+    /* The range doesn't count pauses, so to find what's in it, nor can the
+     * times we compare to it */
+    let audioTime = x => x;
+    if (rangeStart || rangeEnd !== Infinity) {
+        const pauseMeta = pauseFile ?
+            fs.readFileSync(pauseFile, "utf8").trim().split("\n") : meta;
+        audioTime = pauses(pauseMeta.map(line => {
+            try {
+                return JSON.parse(line);
+            } catch (ex) {
+                return null;
+            }
+        }));
+    }
+
     if (outputVosk)
         process.stdout.write("\"captions\":[\n");
     else if (!transcriptOnly)
@@ -109,8 +135,18 @@ function toStamp(time) {
         // Adjust the times
         const offset = (line.o / 48) || 0;
         for (const word of data.caption) {
-            word.start = (word.start - offset) / 1000;
-            word.end = (word.end - offset) / 1000;
+            word.start = audioTime((word.start - offset) / 1000);
+            word.end = audioTime((word.end - offset) / 1000);
+        }
+
+        // Only the words in the range, relative to its start
+        data.caption = data.caption.filter(word =>
+            word.start >= rangeStart && word.start < rangeEnd);
+        if (!data.caption.length)
+            continue;
+        for (const word of data.caption) {
+            word.start -= rangeStart;
+            word.end = Math.min(word.end, rangeEnd) - rangeStart;
         }
 
         meta2.push(line);
@@ -14,16 +14,25 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 /* NOTE: This program assumes little-endian for speed. It WILL NOT WORK on a
  * big-endian system */
 
+// How much we try to move at once (and the pipe size we ask for)
+#define CHUNK_SIZE (1024*1024)
+
 struct WavHeader {
     // RIFF header:
     unsigned char magic[4];
@@ -64,6 +73,87 @@ ssize_t readAll(int fd, void *vbuf, size_t count)
     return rd;
 }
 
+ssize_t writeAll(int fd, const void *vbuf, size_t count)
+{
+    const unsigned char *buf = (const unsigned char *) vbuf;
+    ssize_t wt = 0, ret;
+    while (wt < count) {
+        ret = write(fd, buf + wt, count - wt);
+        if (ret <= 0) return ret;
+        wt += ret;
+    }
+    return wt;
+}
+
+/* Copy the rest of the input to the output. Returns the number of bytes
+ * copied, or -1 on error. */
+int64_t copyRest(void)
+{
+    static unsigned char buf[65536];
+    int64_t total = 0;
+    ssize_t ret;
+
+    // If either side is a pipe, this can be done entirely in the kernel
+    while ((ret = splice(0, NULL, 1, NULL, CHUNK_SIZE, SPLICE_F_MOVE|SPLICE_F_MORE)) > 0)
+        total += ret;
+    if (ret == 0)
+        return total;
+    if (errno != EINVAL)
+        return -1;
+
+    // Neither is, so do it ourselves
+    while ((ret = read(0, buf, sizeof(buf))) > 0) {
+        if (writeAll(1, buf, ret) != ret)
+            return -1;
+        total += ret;
+    }
+    return (ret < 0) ? -1 : total;
+}
+
+/* Write this many zeroes. Returns 0 on success. The zeroes come from an
+ * untouched anonymous mapping, which is backed by the kernel's zero page, so
+ * if the output is a pipe, they can be spliced in without copying. */
+int writeZeroes(uint64_t bytes)
+{
+    unsigned char *zeroes;
+    int useVmsplice = 1;
+
+    if (!bytes)
+        return 0;
+
+    zeroes = mmap(NULL, CHUNK_SIZE, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (zeroes == MAP_FAILED)
+        return -1;
+
+    while (bytes) {
+        size_t part = (bytes > CHUNK_SIZE) ? CHUNK_SIZE : bytes;
+        ssize_t ret;
+
+        if (useVmsplice) {
+            struct iovec iov;
+            iov.iov_base = zeroes;
+            iov.iov_len = part;
+            ret = vmsplice(1, &iov, 1, 0);
+            if (ret < 0 && (errno == EBADF || errno == EINVAL)) {
+                // Not a pipe
+                useVmsplice = 0;
+                continue;
+            }
+
+        } else {
+            ret = write(1, zeroes, part);
+
+        }
+
+        if (ret <= 0)
+            break;
+        bytes -= ret;
+    }
+
+    munmap(zeroes, CHUNK_SIZE);
+    return bytes ? -1 : 0;
+}
+
 int main(int argc, char **argv)
 {
     unsigned char buf[4096];
@@ -77,7 +167,11 @@ int main(int argc, char **argv)
     struct WavDS64Header ds64Header;
     int needDS64Header = 0;
     uint64_t bytes;
-    unsigned int extra;
+    int64_t copied;
+
+    // Bigger pipes mean fewer trips through the kernel
+    fcntl(0, F_SETPIPE_SZ, CHUNK_SIZE);
+    fcntl(1, F_SETPIPE_SZ, CHUNK_SIZE);
 
     // Read the header
     bufUsed = readAll(0, &wavHeader, sizeof(struct WavHeader));
@@ -181,25 +275,13 @@ int main(int argc, char **argv)
     }
 
     // Then write out the rest
-    while ((bufUsed = read(0, buf, bufSz)) > 0) {
-        if (bytes > bufUsed)
-            bytes -= bufUsed;
-        else
-            bytes = 0;
-        write(1, buf, bufUsed);
-    }
+    copied = copyRest();
+    if (copied < 0)
+        return 1;
 
     // And 0s for leftover bytes
-    memset(buf, 0, bufSz);
-    while (bytes) {
-        if (bytes > bufSz) {
-            write(1, buf, bufSz);
-            bytes -= bufSz;
-        } else {
-            write(1, buf, bytes);
-            bytes = 0;
-        }
-    }
+    if (bytes > copied && writeZeroes(bytes - copied) != 0)
+        return 1;
 
-    return (bufUsed<0);
+    return 0;
 }
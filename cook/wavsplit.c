@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Split a WAV file (of known length, as written by wavduration or oggpcm) into
+ * segments, so that they can be encoded in parallel and stitched back
+ * together by encstitch. Each cut is at the quietest point near where an even
+ * split would cut. In corrected tracks, that's normally a silent block, since
+ * those decode to digital silence, so the seams are inaudible.
+ *
+ * Cuts are at multiples of the alignment (-a), less the offset (-o), so that
+ * the encoders' frames line up with them (e.g., Opus's frames are offset by its
+ * pre-skip). Every segment but the first also starts with this many
+ * samples of lead-in (-l) from before its cut, which encstitch drops again, so
+ * that an encoder that needs to prime itself (i.e., Opus) can.
+ *
+ * Segments are written to <prefix>-000.wav, <prefix>-001.wav, etc., and each
+ * one's name is written to stdout as soon as it's complete. Whatever encodes a
+ * segment should delete it when it's done, and with -w, no new segment is
+ * started while that many are still there, so that we don't fill the disk
+ * with PCM faster than the encoders can take it.
+ *
+ * Use: wavsplit [-a alignment] [-o offset] [-l lead-in] [-w waiting]
+ *               <segments> <prefix> < in.wav
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+/* NOTE: This program assumes little-endian for speed. It WILL NOT WORK on a
+ * big-endian system */
+
+// How much we move at once
+#define CHUNK_SIZE (1024*1024)
+
+// No segment is shorter than this many seconds
+#define MIN_SEGMENT_TIME 60
+
+// Or longer than this many bytes, to keep them within plain RIFF
+#define MAX_SEGMENT_BYTES ((uint64_t) 1 << 31)
+
+// Cuts are searched for this far (in seconds) either side of the even split
+#define MAX_WINDOW_TIME 30
+
+struct WavHeader {
+    unsigned char magic[4];
+    uint32_t fileSize;
+    unsigned char format[4];
+} __attribute__((packed));
+
+struct WavSectHeader {
+    unsigned char magic[4];
+    uint32_t sectSize;
+} __attribute__((packed));
+
+struct WavFmtHeader {
+    uint16_t type;
+    uint16_t channels;
+    uint32_t sampleRate;
+    uint32_t byteRate;
+    uint16_t blockAlign;
+    uint16_t bitsPerSample;
+} __attribute__((packed));
+
+struct WavDS64Header {
+    uint64_t fileSize;
+    uint64_t dataSize;
+    uint64_t sampleCount;
+    uint32_t zero;
+} __attribute__((packed));
+
+// The input format
+struct WavFmtHeader fmt;
+unsigned char fmtExtra[4096];
+size_t fmtExtraSz = 0;
+
+// How often to check whether the encoders have caught up, in milliseconds
+#define WAIT_INTERVAL 100
+
+// The segment being written
+const char *prefix;
+int segmentNo = -1, segmentFd = -1;
+char *segmentName;
+uint64_t segmentBytes;
+
+// The most segments that may be waiting to be encoded, or 0 for no limit
+int maxWaiting = 0;
+
+ssize_t readAll(int fd, void *vbuf, size_t count)
+{
+    unsigned char *buf = (unsigned char *) vbuf;
+    ssize_t rd = 0, ret;
+    while (rd < count) {
+        ret = read(fd, buf + rd, count - rd);
+        if (ret < 0) return ret;
+        if (ret == 0) break;
+        rd += ret;
+    }
+    return rd;
+}
+
+ssize_t writeAll(int fd, const void *vbuf, size_t count)
+{
+    const unsigned char *buf = (const unsigned char *) vbuf;
+    ssize_t wt = 0, ret;
+    while (wt < count) {
+        ret = write(fd, buf + wt, count - wt);
+        if (ret <= 0) return ret;
+        wt += ret;
+    }
+    return wt;
+}
+
+/* Read the WAV header, up to the start of the data. Returns the size of the
+ * data, or 0 if it's unknown. Exits on failure. */
+uint64_t readHeader(void)
+{
+    struct WavHeader wavHeader;
+    struct WavSectHeader sectHeader;
+    struct WavDS64Header ds64Header;
+    unsigned char buf[4096];
+    int foundFmt = 0, foundDS64 = 0;
+
+    if (readAll(0, &wavHeader, sizeof(wavHeader)) != sizeof(wavHeader) ||
+        (memcmp(wavHeader.magic, "RIFF", 4) && memcmp(wavHeader.magic, "RF64", 4))) {
+        fprintf(stderr, "wavsplit: Input is not a WAV file\n");
+        exit(1);
+    }
+
+    while (1) {
+        if (readAll(0, &sectHeader, sizeof(sectHeader)) != sizeof(sectHeader)) {
+            fprintf(stderr, "wavsplit: No data in WAV file\n");
+            exit(1);
+        }
+
+        if (!memcmp(sectHeader.magic, "fmt ", 4) &&
+            sectHeader.sectSize >= sizeof(fmt)) {
+            if (readAll(0, &fmt, sizeof(fmt)) != sizeof(fmt))
+                exit(1);
+            fmtExtraSz = sectHeader.sectSize - sizeof(fmt);
+            if (fmtExtraSz > sizeof(fmtExtra)) {
+                fprintf(stderr, "wavsplit: fmt header too large\n");
+                exit(1);
+            }
+            if (readAll(0, fmtExtra, fmtExtraSz) != fmtExtraSz)
+                exit(1);
+            foundFmt = 1;
+            continue;
+
+        } else if (!memcmp(sectHeader.magic, "ds64", 4) &&
+                   sectHeader.sectSize >= sizeof(ds64Header)) {
+            if (readAll(0, &ds64Header, sizeof(ds64Header)) != sizeof(ds64Header))
+                exit(1);
+            sectHeader.sectSize -= sizeof(ds64Header);
+            foundDS64 = 1;
+
+        } else if (!memcmp(sectHeader.magic, "data", 4)) {
+            break;
+
+        }
+
+        // Skip the rest of this section
+        while (sectHeader.sectSize > 0) {
+            size_t part = sectHeader.sectSize > sizeof(buf) ? sizeof(buf) : sectHeader.sectSize;
+            if (readAll(0, buf, part) != part)
+                exit(1);
+            sectHeader.sectSize -= part;
+        }
+    }
+
+    if (!foundFmt || !fmt.blockAlign) {
+        fprintf(stderr, "wavsplit: No format in WAV file\n");
+        exit(1);
+    }
+
+    if (sectHeader.sectSize == (uint32_t) -1)
+        return foundDS64 ? ds64Header.dataSize : 0;
+    return sectHeader.sectSize;
+}
+
+// Write the header of the current segment, for this much data
+void writeSegmentHeader(uint64_t dataSize)
+{
+    struct WavHeader wavHeader;
+    struct WavSectHeader sectHeader;
+
+    memcpy(wavHeader.magic, "RIFF", 4);
+    wavHeader.fileSize = 4 + sizeof(sectHeader) + sizeof(fmt) + fmtExtraSz +
+        sizeof(sectHeader) + dataSize;
+    memcpy(wavHeader.format, "WAVE", 4);
+    if (pwrite(segmentFd, &wavHeader, sizeof(wavHeader), 0) != sizeof(wavHeader))
+        goto fail;
+
+    memcpy(sectHeader.magic, "fmt ", 4);
+    sectHeader.sectSize = sizeof(fmt) + fmtExtraSz;
+    if (pwrite(segmentFd, &sectHeader, sizeof(sectHeader), 12) != sizeof(sectHeader) ||
+        pwrite(segmentFd, &fmt, sizeof(fmt), 20) != sizeof(fmt) ||
+        pwrite(segmentFd, fmtExtra, fmtExtraSz, 20 + sizeof(fmt)) != fmtExtraSz)
+        goto fail;
+
+    memcpy(sectHeader.magic, "data", 4);
+    sectHeader.sectSize = dataSize;
+    if (pwrite(segmentFd, &sectHeader, sizeof(sectHeader),
+               20 + sizeof(fmt) + fmtExtraSz) != sizeof(sectHeader))
+        goto fail;
+    return;
+
+fail:
+    perror(segmentName);
+    exit(1);
+}
+
+// Finish the current segment and announce it
+void closeSegment(void)
+{
+    writeSegmentHeader(segmentBytes);
+    if (close(segmentFd) != 0) {
+        perror(segmentName);
+        exit(1);
+    }
+    printf("%s\n", segmentName);
+    fflush(stdout);
+    free(segmentName);
+    segmentFd = -1;
+}
+
+// Wait until fewer than maxWaiting of the segments so far haven't been encoded
+void waitForEncoders(void)
+{
+    struct timespec interval = {0, WAIT_INTERVAL * 1000000L};
+
+    while (1) {
+        int waiting = 0;
+        for (int si = 0; si < segmentNo; si++) {
+            sprintf(segmentName, "%s-%03d.wav", prefix, si);
+            if (access(segmentName, F_OK) == 0)
+                waiting++;
+        }
+        if (waiting < maxWaiting)
+            break;
+        nanosleep(&interval, NULL);
+    }
+}
+
+// Start the next segment
+void openSegment(void)
+{
+    segmentNo++;
+    segmentName = malloc(strlen(prefix) + 16);
+    if (!segmentName) {
+        perror("malloc");
+        exit(1);
+    }
+    if (maxWaiting && segmentNo >= maxWaiting)
+        waitForEncoders();
+    sprintf(segmentName, "%s-%03d.wav", prefix, segmentNo);
+    segmentFd = open(segmentName, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (segmentFd < 0) {
+        perror(segmentName);
+        exit(1);
+    }
+    segmentBytes = 0;
+    writeSegmentHeader(0);
+    if (lseek(segmentFd, 28 + sizeof(fmt) + fmtExtraSz, SEEK_SET) < 0) {
+        perror(segmentName);
+        exit(1);
+    }
+}
+
+void writeSegment(const unsigned char *buf, size_t size)
+{
+    if (writeAll(segmentFd, buf, size) != size) {
+        perror(segmentName);
+        exit(1);
+    }
+    segmentBytes += size;
+}
+
+/* Copy this much from the input to the current segment. Returns the amount
+ * copied, which is less at the end of the input. */
+uint64_t copyToSegment(uint64_t bytes)
+{
+    static unsigned char buf[CHUNK_SIZE];
+    uint64_t copied = 0;
+    while (copied < bytes) {
+        size_t part = (bytes - copied > CHUNK_SIZE) ? CHUNK_SIZE : bytes - copied;
+        ssize_t rd = readAll(0, buf, part);
+        if (rd < 0) {
+            perror("read");
+            exit(1);
+        }
+        writeSegment(buf, rd);
+        copied += rd;
+        if (rd < part)
+            break;
+    }
+    return copied;
+}
+
+// The loudness of one sample frame, for finding quiet places to cut
+uint64_t frameEnergy(const unsigned char *frame)
+{
+    uint64_t ret = 0;
+    int bytes = fmt.bitsPerSample / 8;
+
+    for (int ci = 0; ci < fmt.channels; ci++, frame += bytes) {
+        int64_t sample = 0;
+        if (fmt.type == 3 && bytes == 4) {
+            float f;
+            memcpy(&f, frame, 4);
+            sample = f * 8388608.0f;
+        } else if (bytes == 2) {
+            int16_t s;
+            memcpy(&s, frame, 2);
+            sample = s;
+        } else if (bytes == 3) {
+            sample = (int32_t) (((uint32_t) frame[0] << 8) |
+                                ((uint32_t) frame[1] << 16) |
+                                ((uint32_t) frame[2] << 24)) >> 8;
+        } else if (bytes == 4) {
+            int32_t s;
+            memcpy(&s, frame, 4);
+            sample = s;
+        }
+        ret += (sample < 0) ? -sample : sample;
+    }
+    return ret;
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Use: wavsplit [-a alignment] [-o offset] [-l lead-in] [-w waiting]\n"
+                    "               <segments> <prefix> < in.wav\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t align = 1, offset = 0, leadIn = 0, segments, dataSize, frameSize;
+    uint64_t total, segmentLen, window, pos;
+    unsigned char *buf = NULL;
+    uint64_t *blockEnergy = NULL;
+    ssize_t rd;
+    int ai;
+
+    for (ai = 1; ai < argc && argv[ai][0] == '-'; ai++) {
+        if (!strcmp(argv[ai], "-a") && ai + 1 < argc) {
+            align = strtoull(argv[++ai], NULL, 0);
+        } else if (!strcmp(argv[ai], "-o") && ai + 1 < argc) {
+            offset = strtoull(argv[++ai], NULL, 0);
+        } else if (!strcmp(argv[ai], "-l") && ai + 1 < argc) {
+            leadIn = strtoull(argv[++ai], NULL, 0);
+        } else if (!strcmp(argv[ai], "-w") && ai + 1 < argc) {
+            maxWaiting = atoi(argv[++ai]);
+        } else {
+            usage();
+        }
+    }
+    if (ai + 2 != argc || !align)
+        usage();
+    offset %= align;
+    segments = strtoull(argv[ai], NULL, 0);
+    prefix = argv[ai+1];
+    if (!segments)
+        segments = 1;
+
+    fcntl(0, F_SETPIPE_SZ, CHUNK_SIZE);
+
+    dataSize = readHeader();
+    frameSize = fmt.blockAlign;
+    total = dataSize / frameSize;
+
+    // Don't make segments too long or too short
+    if (dataSize / MAX_SEGMENT_BYTES + 1 > segments)
+        segments = dataSize / MAX_SEGMENT_BYTES + 1;
+    if (segments > total / ((uint64_t) MIN_SEGMENT_TIME * fmt.sampleRate))
+        segments = total / ((uint64_t) MIN_SEGMENT_TIME * fmt.sampleRate);
+    if (segments < 1)
+        segments = 1;
+
+    segmentLen = (total / segments + align - 1) / align * align;
+    window = segmentLen / 4;
+    if (window > (uint64_t) MAX_WINDOW_TIME * fmt.sampleRate)
+        window = (uint64_t) MAX_WINDOW_TIME * fmt.sampleRate;
+    window = window / align * align;
+
+    openSegment();
+    pos = 0;
+
+    for (uint64_t si = 1; si < segments; si++) {
+        uint64_t target = si * segmentLen - offset;
+        uint64_t lo, hi, bufStart, bufEnd, best, bestEnergy = (uint64_t) -1;
+        uint64_t firstBlock, blockCt;
+
+        if (target >= total)
+            break;
+        lo = target - window;
+        hi = target + window;
+        if (hi >= total)
+            hi = (total - 1 + offset) / align * align - offset;
+
+        // Copy up to what we need to look at
+        bufStart = lo - align - leadIn;
+        if (bufStart < pos)
+            bufStart = pos;
+        if (copyToSegment((bufStart - pos) * frameSize) != (bufStart - pos) * frameSize)
+            break;
+        pos = bufStart;
+
+        // Read in the window
+        bufEnd = hi + align;
+        if (bufEnd > total)
+            bufEnd = total;
+        buf = realloc(buf, (bufEnd - bufStart) * frameSize);
+        if (!buf) {
+            perror("realloc");
+            return 1;
+        }
+        rd = readAll(0, buf, (bufEnd - bufStart) * frameSize);
+        if (rd < 0) {
+            perror("read");
+            return 1;
+        }
+        bufEnd = bufStart + rd / frameSize;
+        pos = bufEnd;
+
+        // Measure each aligned block
+        firstBlock = (bufStart + offset) / align;
+        blockCt = (bufEnd + offset + align - 1) / align - firstBlock;
+        blockEnergy = realloc(blockEnergy, blockCt * sizeof(uint64_t));
+        if (!blockEnergy) {
+            perror("realloc");
+            return 1;
+        }
+        memset(blockEnergy, 0, blockCt * sizeof(uint64_t));
+        for (uint64_t fi = bufStart; fi < bufEnd; fi++)
+            blockEnergy[(fi + offset) / align - firstBlock] += frameEnergy(buf + (fi - bufStart) * frameSize);
+
+        /* Cut at the quietest point, by the blocks either side of it, preferring
+         * the closest to the target */
+        best = target;
+        for (uint64_t di = 0; di <= window; di += align) {
+            for (int side = 0; side < 2; side++) {
+                uint64_t cand = side ? target - di : target + di;
+                uint64_t block = (cand + offset) / align - firstBlock, energy;
+                if ((side && !di) || cand < lo || cand > hi || cand >= bufEnd ||
+                    block < 1)
+                    continue;
+                energy = blockEnergy[block - 1] + blockEnergy[block];
+                if (energy < bestEnergy) {
+                    best = cand;
+                    bestEnergy = energy;
+                }
+            }
+        }
+        if (best >= bufEnd) {
+            // Ran out of input
+            writeSegment(buf, (bufEnd - bufStart) * frameSize);
+            break;
+        }
+
+        // Finish this segment, and start the next with its lead-in
+        writeSegment(buf, (best - bufStart) * frameSize);
+        closeSegment();
+        openSegment();
+        writeSegment(buf + (best - leadIn - bufStart) * frameSize,
+                     (bufEnd - best + leadIn) * frameSize);
+    }
+
+    // Then the rest goes in the last segment
+    while (copyToSegment(CHUNK_SIZE) == CHUNK_SIZE);
+    closeSegment();
+
+    free(buf);
+    free(blockEnergy);
+    return 0;
+}
@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Write a store-only ZIP64 of the given files (usually FIFOs) to stdout, as a
+ * stream. Unlike zip, every input is drained at once: whatever isn't the entry
+ * currently being written is spooled, in memory up to a limit, then in
+ * temporary files, so that none of the programs writing to the FIFOs has to
+ * wait for the ones before it. Entries use data descriptors, so nothing needs
+ * to be known in advance.
+ *
+ * Spooling is bounded (by default to 1GB in all, or as set by -s, with 0 for no
+ * limit): once that much is spooled, only the entry being written is read, and
+ * the programs writing the rest wait, as they would for zip. The entry being
+ * written is always read, so this can't deadlock, as long as its writer isn't
+ * waiting on a later one.
+ *
+ * Use: zipstream [-m <memory bytes>] [-s <spool bytes>] [-t <tmpdir>] files...
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+/* NOTE: This program assumes little-endian for speed. It WILL NOT WORK on a
+ * big-endian system */
+
+#define BUF_SIZE (1024*1024)
+
+// ZIP64, data descriptor, UTF-8 names
+#define ZIP_VERSION     45
+#define ZIP_FLAGS       0x0808
+
+struct Entry {
+    const char *name;
+    int fd;
+    int fifo, eof;
+
+    // Spooled data, first in memory, then in a temporary file
+    unsigned char *mem;
+    size_t memSize, memAlloc;
+    int spill;
+    uint64_t spillSize;
+
+    uint32_t crc;
+    uint64_t size;
+
+    // Where its local header is in the output
+    uint64_t offset;
+    uint16_t dosTime, dosDate;
+};
+
+static struct Entry *entries;
+static int entryCt;
+
+// Where we are in the output
+static uint64_t outOffset = 0;
+
+// Spooling limits and use
+static size_t memCap = 64*1024*1024;
+static uint64_t spoolCap = 1024*1024*1024;
+static size_t memTotal = 0;
+static uint64_t spoolTotal = 0;
+static const char *tmpDir;
+
+static unsigned char buf[BUF_SIZE];
+
+static void writeOut(const void *vdata, size_t count)
+{
+    const unsigned char *data = (const unsigned char *) vdata;
+    size_t wt = 0;
+    while (wt < count) {
+        ssize_t ret = write(1, data + wt, count - wt);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR)
+                continue;
+            perror("write");
+            exit(1);
+        }
+        wt += ret;
+    }
+    outOffset += count;
+}
+
+// Little-endian writing into a header
+#define PUT16(p, v) do { uint16_t x_ = (v); memcpy(p, &x_, 2); p += 2; } while (0)
+#define PUT32(p, v) do { uint32_t x_ = (v); memcpy(p, &x_, 4); p += 4; } while (0)
+#define PUT64(p, v) do { uint64_t x_ = (v); memcpy(p, &x_, 8); p += 8; } while (0)
+
+static void writeLocalHeader(struct Entry *entry)
+{
+    size_t nameLen = strlen(entry->name);
+    unsigned char header[30 + 20];
+    unsigned char *p = header;
+    time_t now = time(NULL);
+    struct tm *tm = localtime(&now);
+
+    entry->dosTime = (tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec / 2);
+    entry->dosDate = ((tm->tm_year - 80) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday;
+    entry->offset = outOffset;
+
+    PUT32(p, 0x04034b50);
+    PUT16(p, ZIP_VERSION);
+    PUT16(p, ZIP_FLAGS);
+    PUT16(p, 0); // stored
+    PUT16(p, entry->dosTime);
+    PUT16(p, entry->dosDate);
+    PUT32(p, 0); // CRC, in the data descriptor
+    PUT32(p, 0xFFFFFFFF); // sizes, in ZIP64 and the data descriptor
+    PUT32(p, 0xFFFFFFFF);
+    PUT16(p, nameLen);
+    PUT16(p, 20);
+
+    writeOut(header, 30);
+    writeOut(entry->name, nameLen);
+
+    // ZIP64 extra field
+    p = header;
+    PUT16(p, 0x0001);
+    PUT16(p, 16);
+    PUT64(p, 0);
+    PUT64(p, 0);
+    writeOut(header, 20);
+}
+
+static void writeDataDescriptor(struct Entry *entry)
+{
+    unsigned char desc[24];
+    unsigned char *p = desc;
+    PUT32(p, 0x08074b50);
+    PUT32(p, entry->crc);
+    PUT64(p, entry->size);
+    PUT64(p, entry->size);
+    writeOut(desc, sizeof(desc));
+}
+
+static void writeCentralDirectory(void)
+{
+    uint64_t cdOffset = outOffset, cdSize;
+    unsigned char header[56];
+    unsigned char *p;
+
+    for (int i = 0; i < entryCt; i++) {
+        struct Entry *entry = &entries[i];
+        size_t nameLen = strlen(entry->name);
+
+        p = header;
+        PUT32(p, 0x02014b50);
+        PUT16(p, (3 << 8) | ZIP_VERSION); // Made by Unix
+        PUT16(p, ZIP_VERSION);
+        PUT16(p, ZIP_FLAGS);
+        PUT16(p, 0);
+        PUT16(p, entry->dosTime);
+        PUT16(p, entry->dosDate);
+        PUT32(p, entry->crc);
+        PUT32(p, 0xFFFFFFFF);
+        PUT32(p, 0xFFFFFFFF);
+        PUT16(p, nameLen);
+        PUT16(p, 28);
+        PUT16(p, 0); // comment
+        PUT16(p, 0); // disk
+        PUT16(p, 0); // internal attributes
+        PUT32(p, 0100644 << 16); // external attributes
+        PUT32(p, 0xFFFFFFFF);
+        writeOut(header, 46);
+        writeOut(entry->name, nameLen);
+
+        p = header;
+        PUT16(p, 0x0001);
+        PUT16(p, 24);
+        PUT64(p, entry->size);
+        PUT64(p, entry->size);
+        PUT64(p, entry->offset);
+        writeOut(header, 28);
+    }
+    cdSize = outOffset - cdOffset;
+
+    // ZIP64 end of central directory
+    p = header;
+    PUT32(p, 0x06064b50);
+    PUT64(p, 44);
+    PUT16(p, (3 << 8) | ZIP_VERSION);
+    PUT16(p, ZIP_VERSION);
+    PUT32(p, 0);
+    PUT32(p, 0);
+    PUT64(p, entryCt);
+    PUT64(p, entryCt);
+    PUT64(p, cdSize);
+    PUT64(p, cdOffset);
+    {
+        uint64_t eocd64Offset = outOffset;
+        writeOut(header, 56);
+
+        // Its locator
+        p = header;
+        PUT32(p, 0x07064b50);
+        PUT32(p, 0);
+        PUT64(p, eocd64Offset);
+        PUT32(p, 1);
+        writeOut(header, 20);
+    }
+
+    // And the classic end of central directory, pointing at ZIP64
+    p = header;
+    PUT32(p, 0x06054b50);
+    PUT16(p, 0);
+    PUT16(p, 0);
+    PUT16(p, 0xFFFF);
+    PUT16(p, 0xFFFF);
+    PUT32(p, 0xFFFFFFFF);
+    PUT32(p, 0xFFFFFFFF);
+    PUT16(p, 0);
+    writeOut(header, 22);
+}
+
+// Spool data for an entry that isn't being written yet
+static void spool(struct Entry *entry, const unsigned char *data, size_t size)
+{
+    spoolTotal += size;
+
+    if (entry->spill < 0 && memTotal + size <= memCap) {
+        // Keep it in memory
+        if (entry->memSize + size > entry->memAlloc) {
+            size_t alloc = entry->memAlloc ? entry->memAlloc : 65536;
+            while (alloc < entry->memSize + size)
+                alloc *= 2;
+            entry->mem = realloc(entry->mem, alloc);
+            if (!entry->mem) {
+                perror("realloc");
+                exit(1);
+            }
+            entry->memAlloc = alloc;
+        }
+        memcpy(entry->mem + entry->memSize, data, size);
+        entry->memSize += size;
+        memTotal += size;
+        return;
+    }
+
+    // Spill it to disk
+    if (entry->spill < 0) {
+        char *name = malloc(strlen(tmpDir) + 20);
+        if (!name) {
+            perror("malloc");
+            exit(1);
+        }
+        sprintf(name, "%s/zipstreamXXXXXX", tmpDir);
+        entry->spill = mkstemp(name);
+        if (entry->spill < 0) {
+            perror(name);
+            exit(1);
+        }
+        unlink(name);
+        free(name);
+    }
+    while (size) {
+        ssize_t ret = write(entry->spill, data, size);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR)
+                continue;
+            perror("write");
+            exit(1);
+        }
+        data += ret;
+        size -= ret;
+        entry->spillSize += ret;
+    }
+}
+
+// Write out everything spooled for this entry, and free it
+static void unspool(struct Entry *entry)
+{
+    if (entry->memSize) {
+        writeOut(entry->mem, entry->memSize);
+        memTotal -= entry->memSize;
+        spoolTotal -= entry->memSize;
+    }
+    free(entry->mem);
+    entry->mem = NULL;
+    entry->memSize = entry->memAlloc = 0;
+
+    if (entry->spill >= 0) {
+        ssize_t ret;
+        lseek(entry->spill, 0, SEEK_SET);
+        while ((ret = read(entry->spill, buf, BUF_SIZE)) > 0)
+            writeOut(buf, ret);
+        if (ret < 0) {
+            perror("read");
+            exit(1);
+        }
+        close(entry->spill);
+        entry->spill = -1;
+        spoolTotal -= entry->spillSize;
+        entry->spillSize = 0;
+    }
+}
+
+/* Read what's available from this entry. If it's current, write it out,
+ * otherwise spool it. */
+static void readEntry(struct Entry *entry, int current)
+{
+    ssize_t ret = read(entry->fd, buf, BUF_SIZE);
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return;
+        // A truncated entry would look fine, so fail instead
+        perror(entry->name);
+        exit(1);
+    }
+
+    if (ret == 0) {
+        entry->eof = 1;
+        close(entry->fd);
+        entry->fd = -1;
+        return;
+    }
+
+    entry->crc = crc32(entry->crc, buf, ret);
+    entry->size += ret;
+    if (current)
+        writeOut(buf, ret);
+    else
+        spool(entry, buf, ret);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "Use: zipstream [-m <memory bytes>] [-s <spool bytes>] [-t <tmpdir>] files...\n"
+        "  -m: Spool at most this much in memory (default 64MB)\n"
+        "  -s: Spool at most this much in all (default 1GB, 0 for no limit)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct pollfd *pfds;
+    int *pfdEntries;
+    int cur = 0;
+    int opt;
+
+    tmpDir = getenv("TMPDIR");
+    if (!tmpDir || !tmpDir[0])
+        tmpDir = "/tmp";
+
+    while ((opt = getopt(argc, argv, "m:s:t:")) != -1) {
+        switch (opt) {
+            case 'm':
+                memCap = atol(optarg);
+                break;
+
+            case 's':
+                spoolCap = atoll(optarg);
+                break;
+
+            case 't':
+                tmpDir = optarg;
+                break;
+
+            default:
+                usage();
+        }
+    }
+    if (optind >= argc)
+        usage();
+
+    entryCt = argc - optind;
+    entries = calloc(entryCt, sizeof(struct Entry));
+    pfds = calloc(entryCt, sizeof(struct pollfd));
+    pfdEntries = calloc(entryCt, sizeof(int));
+    if (!entries || !pfds || !pfdEntries) {
+        perror("calloc");
+        return 1;
+    }
+
+    /* Open everything at once. FIFOs are opened non-blocking, so that we don't
+     * wait for their writers here. */
+    for (int i = 0; i < entryCt; i++) {
+        struct Entry *entry = &entries[i];
+        struct stat sbuf;
+
+        entry->name = argv[optind + i];
+        entry->spill = -1;
+        entry->fd = open(entry->name, O_RDONLY|O_NONBLOCK);
+        if (entry->fd < 0 || fstat(entry->fd, &sbuf) != 0) {
+            perror(entry->name);
+            return 1;
+        }
+        entry->fifo = S_ISFIFO(sbuf.st_mode);
+        if (!entry->fifo)
+            fcntl(entry->fd, F_SETFL, fcntl(entry->fd, F_GETFL) & ~O_NONBLOCK);
+
+        // Like zip, don't store absolute paths
+        while (entry->name[0] == '/')
+            entry->name++;
+    }
+
+    writeLocalHeader(&entries[0]);
+
+    while (cur < entryCt) {
+        struct Entry *entry = &entries[cur];
+        int pfdCt = 0;
+
+        // Move on from finished entries
+        if (entry->eof) {
+            writeDataDescriptor(entry);
+            if (++cur < entryCt) {
+                writeLocalHeader(&entries[cur]);
+                unspool(&entries[cur]);
+            }
+            continue;
+        }
+
+        // Regular files can just be read through
+        if (!entry->fifo) {
+            readEntry(entry, 1);
+            continue;
+        }
+
+        /* Wait for any FIFO. Others are only drained while there's room to
+         * spool them. Note that a FIFO which has never had a writer doesn't
+         * poll as hung up, so we don't mistake not-yet-started for done. */
+        for (int i = cur; i < entryCt; i++) {
+            if (entries[i].eof || !entries[i].fifo)
+                continue;
+            if (i != cur && spoolCap && spoolTotal >= spoolCap)
+                continue;
+            pfds[pfdCt].fd = entries[i].fd;
+            pfds[pfdCt].events = POLLIN;
+            pfdEntries[pfdCt] = i;
+            pfdCt++;
+        }
+
+        if (poll(pfds, pfdCt, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return 1;
+        }
+
+        for (int pi = 0; pi < pfdCt; pi++) {
+            if (pfds[pi].revents)
+                readEntry(&entries[pfdEntries[pi]], pfdEntries[pi] == cur);
+        }
+    }
+
+    writeCentralDirectory();
+    return 0;
+}
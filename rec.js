@@ -265,13 +265,24 @@ async function del(rid, uid, opts) {
 
     // Delete the files
     for (let footer of [
-        "header1", "header2", "data", "users", "info", "captions.tmp",
-        "captions"
+        "header1", "header2", "data", "idx", "meta", "manifest", "users", "info",
+        "captions.tmp", "captions"
     ]) {
         try {
             fs.unlinkSync(config.rec + "/" + rid + ".ogg." + footer);
         } catch (ex) {}
     }
+    try {
+        fs.rmSync(config.rec + "/" + rid + ".ogg.follow", {recursive: true});
+    } catch (ex) {}
+    try {
+        // Per-stream data
+        const prefix = rid + ".ogg.data.";
+        for (const file of fs.readdirSync(config.rec)) {
+            if (file.startsWith(prefix))
+                fs.unlinkSync(config.rec + "/" + file);
+        }
+    } catch (ex) {}
 
     // Then move the row to old_recordings
     while (true) {
@@ -92,10 +92,14 @@ try {
 }
 const hs = hss;
 
-/* Our data gets written to five files:
+/* Our data gets written to seven files:
  *   header1 and header2 are the Ogg file headers. Because of how Ogg works,
  * this has to be two files.
- *   data is the actual recorded data.
+ *   data is the actual recorded data. With perStreamData, it's instead
+ * data.<stream number>, one file per stream (see cook/oggindex.h).
+ *   idx is an index of the pages in data (see cook/oggindex.h).
+ *   meta is a copy of just the meta pages in data, so that they can be read
+ * without reading all the audio.
  *   users is the user information for each track, written such that you can
  * parse it as JSON if you're careful about it.
  *   info is the information on the recording, currently just the start
@@ -104,9 +108,16 @@ const hs = hss;
 var outHeader1 = null,
     outHeader2 = null,
     outData = null,
+    outMeta = null,
     outUsers = null,
     outInfo = null;
 
+/* If configured to, we also run a follower (oggcorrect --follow), which
+ * corrects each track into the follow directory as it's recorded, so that
+ * cooking doesn't have to do it all at the end. It finishes when its stdin
+ * closes. */
+var follower = null;
+
 // Recording info for this recording
 var recInfo = null;
 
@@ -1260,8 +1271,9 @@ function recMeta(data, opt?: any) {
     // Get the time
     opt.time = opt.time || curGranule();
 
-    // Write this data
-    outData.write(opt.time, 0, track.packetNo++, data);
+    // Write this data, and its copy in the meta file
+    outData.write(opt.time, 0, track.packetNo, data);
+    outMeta.write(opt.time, 0, track.packetNo++, data);
 }
 
 // Once we get the recording info, we can start
@@ -1334,10 +1346,23 @@ async function recvRecInfo(r) {
     }
     outHeader1 = o("header1");
     outHeader2 = o("header2");
-    outData = o("data");
+    if (config.perStreamData)
+        outData = new ogg.OggStreamEncoder(streamNo => s("data." + streamNo), s("idx"));
+    else
+        outData = new ogg.OggEncoder(s("data"), s("idx"));
+    outMeta = o("meta");
     outUsers = s("users");
     outInfo = s("info");
 
+    // Start following it, if we're supposed to (and can)
+    if (config.follow && !config.perStreamData) {
+        const base = config.rec + "/" + rid + ".ogg";
+        follower = cproc.spawn(config.repo + "/cook/oggcorrect", [
+            "--follow", base, base + ".follow"
+        ], {stdio: ["pipe", "ignore", "inherit"]});
+        follower.on("error", () => { follower = null; });
+    }
+
     // Write out the recording info
     outInfo.write(JSON.stringify(r));
     outUsers.write("\"0\":{}\n");
@@ -1535,10 +1560,13 @@ async function stopRec() {
         outHeader1.end();
         outHeader2.end();
         outData.end();
+        outMeta.end();
         outUsers.end();
         outInfo.end();
 
         setTimeout(function() {
+            if (follower)
+                follower.stdin.end();
             process.exit(0);
         }, 60000);
     }, 1000*60*5);
@@ -24,19 +24,68 @@
 
 const crc32 = require("cyclic-32");
 
+/* The native page assembler (oggmux.c), if it's been built. With it, pages are
+ * buffered and written out in groups, rather than one write per page. */
+let oggmux = null;
+try {
+    oggmux = require("./oggmux.node");
+} catch (ex) {}
+
+/* Buffered encoders are all flushed together, after this long, or once any one
+ * has this much buffered. The writes to each file are asynchronous, so a page
+ * can reach the disk before pages written earlier to other files (e.g. data
+ * before its headers). Readers of a recording in progress, like oggcorrect's
+ * follower, must wait for a track's headers rather than assume them. */
+const FLUSH_TIME = 100;
+const FLUSH_SIZE = 65536;
+const buffered = [];
+let flushTimeout = null;
+
+function flushAll() {
+    if (flushTimeout) {
+        clearTimeout(flushTimeout);
+        flushTimeout = null;
+    }
+    for (const enc of buffered)
+        enc.flush();
+}
+
 // Flags for all ogg
 const BOS = 2;
 const EOS = 4;
 exports.BOS = BOS;
 exports.EOS = EOS;
 
-// Our ogg encoder itself
-function OggEncoder(fstream) {
+/* Our ogg encoder itself. If istream is given, an index entry is written to it
+ * for every page, in the format described by cook/oggindex.h:
+ *   8 bytes: offset of the page in the file
+ *   8 bytes: granule position
+ *   4 bytes: stream number
+ *   2 bytes: packet size (without the page header)
+ *   1 byte: flags
+ *   1 byte: number of segments */
+function OggEncoder(fstream, istream) {
     this.fstream = fstream;
+    this.istream = istream || null;
+    this.offset = 0;
+    this.mux = null;
+    if (oggmux) {
+        this.mux = oggmux.create(!!istream);
+        buffered.push(this);
+    }
 }
 exports.OggEncoder = OggEncoder;
 
 OggEncoder.prototype.write = function(granulePos, streamNo, packetNo, chunk, flags) {
+    if (this.mux) {
+        if (oggmux.write(this.mux, granulePos, ~~streamNo, ~~packetNo, chunk, flags) >= FLUSH_SIZE)
+            flushAll();
+        else if (!flushTimeout)
+            flushTimeout = setTimeout(flushAll, FLUSH_TIME);
+        this.offset += 28 + Math.floor(chunk.length / 255) + chunk.length;
+        return;
+    }
+
     // How many bytes will be required to explain this chunk?
     var lengthBytes = Math.ceil((chunk.length+1) / 255) + 1;
 
@@ -88,8 +137,100 @@ OggEncoder.prototype.write = function(granulePos, streamNo, packetNo, chunk, fla
 
     // And write it out
     this.fstream.write(chunk);
+
+    // Index it
+    if (this.istream) {
+        var entry = Buffer.alloc(24);
+        entry.writeUIntLE(this.offset, 0, 6);
+        entry.writeUIntLE(granulePos, 8, 6);
+        entry.writeInt32LE(~~streamNo, 16);
+        entry.writeUInt16LE(chunk.length - headerBytes, 20);
+        entry.writeUInt8(flags, 22);
+        entry.writeUInt8(lengthBytes - 1, 23);
+        this.istream.write(entry);
+    }
+    this.offset += chunk.length;
+}
+
+// Write out anything buffered by the native assembler
+OggEncoder.prototype.flush = function() {
+    if (!this.mux)
+        return;
+    const out = oggmux.flush(this.mux);
+    if (!out)
+        return;
+    this.fstream.write(out[0]);
+    if (this.istream)
+        this.istream.write(out[1]);
 }
 
 OggEncoder.prototype.end = function() {
+    if (this.mux) {
+        flushAll();
+        buffered.splice(buffered.indexOf(this), 1);
+    }
     this.fstream.end();
+    if (this.istream)
+        this.istream.end();
+}
+
+/* An encoder for the per-stream layout (see cook/oggindex.h). Each stream's
+ * pages are written to their own file, from openStream(streamNo), and istream
+ * gets one index of every page, in the order they were written, with offsets
+ * into those files. */
+function OggStreamEncoder(openStream, istream) {
+    this.openStream = openStream;
+    this.istream = istream;
+    this.streams = Object.create(null);
+    this.index = Buffer.alloc(24 * 1024);
+    this.indexUsed = 0;
+    if (oggmux)
+        buffered.push(this);
+}
+exports.OggStreamEncoder = OggStreamEncoder;
+
+OggStreamEncoder.prototype.write = function(granulePos, streamNo, packetNo, chunk, flags) {
+    streamNo >>>= 0;
+    let stream = this.streams[streamNo];
+    if (!stream)
+        stream = this.streams[streamNo] = new OggEncoder(this.openStream(streamNo));
+
+    // Index it
+    if (this.indexUsed >= this.index.length)
+        this.flush();
+    const entry = this.index.subarray(this.indexUsed, this.indexUsed + 24);
+    entry.fill(0);
+    entry.writeUIntLE(stream.offset, 0, 6);
+    entry.writeUIntLE(granulePos, 8, 6);
+    entry.writeUInt32LE(streamNo, 16);
+    entry.writeUInt16LE(chunk.length, 20);
+    entry.writeUInt8(flags || 0, 22);
+    entry.writeUInt8(Math.floor(chunk.length / 255) + 1, 23);
+    this.indexUsed += 24;
+
+    stream.write(granulePos, streamNo, packetNo, chunk, flags);
+
+    // Without the native assembler, nothing else is buffered either
+    if (!oggmux)
+        this.flush();
+}
+
+/* Write out the buffered index, after the pages it refers to, so that the
+ * index is never ahead of the data */
+OggStreamEncoder.prototype.flush = function() {
+    if (!this.indexUsed)
+        return;
+    for (const streamNo in this.streams)
+        this.streams[streamNo].flush();
+    this.istream.write(Buffer.from(this.index.subarray(0, this.indexUsed)));
+    this.indexUsed = 0;
+}
+
+OggStreamEncoder.prototype.end = function() {
+    for (const streamNo in this.streams)
+        this.streams[streamNo].end();
+    this.flush();
+    if (oggmux)
+        buffered.splice(buffered.indexOf(this), 1);
+    this.istream.end();
 }
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2024 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Native Ogg page assembly for ogg.js. Pages (and, if asked for, their index
+ * entries, as described in cook/oggindex.h) are assembled into a buffer per
+ * file, with the same CRC code as the cook tools, and handed back to JS in
+ * one piece when it flushes, so that it does one write per flush instead of
+ * one allocation, JS CRC and write per page. The actual writing stays in JS,
+ * so it's still asynchronous.
+ *
+ * oggmux.create(indexed) -> mux
+ * oggmux.write(mux, granulePos, streamNo, packetNo, chunk, flags) -> bytes buffered
+ * oggmux.flush(mux) -> [data, index (or undefined)], or null if there's nothing
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <node_api.h>
+
+#include "../cook/oggcrc.h"
+
+/* NOTE: Like the cook tools, this assumes little-endian */
+
+struct OggMux {
+    int indexed;
+
+    // Offset in the file of the start of our buffered data
+    uint64_t offset;
+
+    // Buffered pages
+    unsigned char *data;
+    size_t dataUsed, dataAlloc;
+
+    // Buffered index entries
+    unsigned char *index;
+    size_t indexUsed, indexAlloc;
+};
+
+// Same as struct OggIndexEntry in cook/oggindex.h
+struct OggMuxIndexEntry {
+    uint64_t offset;
+    uint64_t granulePos;
+    uint32_t streamNo;
+    uint16_t packetSize;
+    unsigned char flags;
+    unsigned char segmentCount;
+} __attribute__((packed));
+
+#define CHECK(call) do { \
+    if ((call) != napi_ok) { \
+        napi_throw_error(env, NULL, "oggmux: " #call " failed"); \
+        return NULL; \
+    } \
+} while (0)
+
+// Make sure there's room for this much more in a buffer
+static int reserve(unsigned char **buf, size_t *alloc, size_t used, size_t more)
+{
+    unsigned char *newBuf;
+    size_t newAlloc;
+
+    if (used + more <= *alloc)
+        return 0;
+    newAlloc = *alloc ? *alloc * 2 : 65536;
+    while (newAlloc < used + more)
+        newAlloc *= 2;
+    newBuf = (unsigned char *) realloc(*buf, newAlloc);
+    if (!newBuf)
+        return -1;
+    *buf = newBuf;
+    *alloc = newAlloc;
+    return 0;
+}
+
+static void finalize(napi_env env, void *data, void *hint)
+{
+    struct OggMux *mux = (struct OggMux *) data;
+    free(mux->data);
+    free(mux->index);
+    free(mux);
+}
+
+static struct OggMux *getMux(napi_env env, napi_value value)
+{
+    void *mux;
+    if (napi_get_value_external(env, value, &mux) != napi_ok)
+        return NULL;
+    return (struct OggMux *) mux;
+}
+
+static napi_value create(napi_env env, napi_callback_info info)
+{
+    size_t argc = 1;
+    napi_value argv[1], ret;
+    struct OggMux *mux;
+    bool indexed = false;
+
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    if (argc >= 1)
+        napi_get_value_bool(env, argv[0], &indexed);
+
+    mux = (struct OggMux *) calloc(1, sizeof(struct OggMux));
+    if (!mux) {
+        napi_throw_error(env, NULL, "oggmux: out of memory");
+        return NULL;
+    }
+    mux->indexed = indexed;
+
+    if (napi_create_external(env, mux, finalize, NULL, &ret) != napi_ok) {
+        finalize(env, mux, NULL);
+        napi_throw_error(env, NULL, "oggmux: napi_create_external failed");
+        return NULL;
+    }
+    return ret;
+}
+
+static napi_value write(napi_env env, napi_callback_info info)
+{
+    size_t argc = 6;
+    napi_value argv[6], ret;
+    napi_valuetype flagsType;
+    struct OggMux *mux;
+    int64_t granulePos;
+    int32_t streamNo, packetNo;
+    uint32_t flags = 0, crc;
+    void *chunk;
+    size_t size, segmentCount, headerSize, i;
+    unsigned char *page;
+
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    if (argc < 5 || !(mux = getMux(env, argv[0]))) {
+        napi_throw_type_error(env, NULL, "oggmux.write: invalid arguments");
+        return NULL;
+    }
+    CHECK(napi_get_value_int64(env, argv[1], &granulePos));
+    CHECK(napi_get_value_int32(env, argv[2], &streamNo));
+    CHECK(napi_get_value_int32(env, argv[3], &packetNo));
+    CHECK(napi_get_buffer_info(env, argv[4], &chunk, &size));
+    if (argc >= 6) {
+        CHECK(napi_typeof(env, argv[5], &flagsType));
+        if (flagsType == napi_number)
+            CHECK(napi_get_value_uint32(env, argv[5], &flags));
+    }
+
+    segmentCount = size / 255 + 1;
+    if (segmentCount > 255) {
+        napi_throw_range_error(env, NULL, "oggmux.write: packet too large");
+        return NULL;
+    }
+    headerSize = 27 + segmentCount;
+
+    if (reserve(&mux->data, &mux->dataAlloc, mux->dataUsed, headerSize + size) != 0 ||
+        (mux->indexed &&
+         reserve(&mux->index, &mux->indexAlloc, mux->indexUsed,
+                 sizeof(struct OggMuxIndexEntry)) != 0)) {
+        napi_throw_error(env, NULL, "oggmux: out of memory");
+        return NULL;
+    }
+
+    // Header
+    page = mux->data + mux->dataUsed;
+    memcpy(page, "OggS\0", 5);
+    page[5] = flags;
+    memcpy(page + 6, &granulePos, 8);
+    memcpy(page + 14, &streamNo, 4);
+    memcpy(page + 18, &packetNo, 4);
+    memset(page + 22, 0, 4);
+    page[26] = segmentCount;
+    for (i = 0; i < segmentCount - 1; i++)
+        page[27 + i] = 255;
+    page[27 + i] = size % 255;
+
+    // Data
+    memcpy(page + headerSize, chunk, size);
+
+    // CRC
+    crc = 0;
+    oggCRC(page, headerSize + size, &crc);
+    memcpy(page + 22, &crc, 4);
+
+    // Index
+    if (mux->indexed) {
+        struct OggMuxIndexEntry entry;
+        entry.offset = mux->offset + mux->dataUsed;
+        entry.granulePos = granulePos;
+        entry.streamNo = streamNo;
+        entry.packetSize = size;
+        entry.flags = flags;
+        entry.segmentCount = segmentCount;
+        memcpy(mux->index + mux->indexUsed, &entry, sizeof(entry));
+        mux->indexUsed += sizeof(entry);
+    }
+
+    mux->dataUsed += headerSize + size;
+
+    CHECK(napi_create_double(env, mux->dataUsed, &ret));
+    return ret;
+}
+
+static napi_value flush(napi_env env, napi_callback_info info)
+{
+    size_t argc = 1;
+    napi_value argv[1], ret, data, index;
+    struct OggMux *mux;
+
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    if (argc < 1 || !(mux = getMux(env, argv[0]))) {
+        napi_throw_type_error(env, NULL, "oggmux.flush: invalid arguments");
+        return NULL;
+    }
+
+    if (!mux->dataUsed) {
+        CHECK(napi_get_null(env, &ret));
+        return ret;
+    }
+
+    CHECK(napi_create_buffer_copy(env, mux->dataUsed, mux->data, NULL, &data));
+    if (mux->indexed)
+        CHECK(napi_create_buffer_copy(env, mux->indexUsed, mux->index, NULL, &index));
+    else
+        CHECK(napi_get_undefined(env, &index));
+    CHECK(napi_create_array_with_length(env, 2, &ret));
+    CHECK(napi_set_element(env, ret, 0, data));
+    CHECK(napi_set_element(env, ret, 1, index));
+
+    mux->offset += mux->dataUsed;
+    mux->dataUsed = mux->indexUsed = 0;
+    return ret;
+}
+
+static napi_value init(napi_env env, napi_value exports)
+{
+    napi_property_descriptor props[] = {
+        {"create", NULL, create, NULL, NULL, NULL, napi_default, NULL},
+        {"write", NULL, write, NULL, NULL, NULL, napi_default, NULL},
+        {"flush", NULL, flush, NULL, NULL, NULL, napi_default, NULL}
+    };
+    CHECK(napi_define_properties(env, exports, sizeof(props) / sizeof(props[0]), props));
+    return exports;
+}
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, init)